@@ -0,0 +1,124 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "index.h"
+#include "searcher.h"
+#include "stream_vbyte.h"
+
+// Compares posting decoding across the on-disk versions and the raw codecs.
+// Usage: bench_codecs [num_docs] [num_terms]
+
+template <typename Func>
+static double timeIt(Func&& f, int repeats) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < repeats; ++i) f();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(end - start).count() / repeats;
+}
+
+static std::shared_ptr<RamIndexSource> buildSource(uint32_t num_docs, uint32_t num_terms) {
+    auto src = std::make_shared<RamIndexSource>();
+    std::mt19937 rng(42);
+    for (uint32_t d = 0; d < num_docs; ++d) src->addUrl("http://doc/" + std::to_string(d));
+
+    // Zipf-like document frequencies: term t appears in about num_docs / (t + 2) documents
+    for (uint32_t t = 0; t < num_terms; ++t) {
+        std::string term = "t" + std::to_string(t);
+        double p = 1.0 / (t + 2);
+        std::bernoulli_distribution appears(p);
+        for (uint32_t d = 0; d < num_docs; ++d) {
+            if (appears(rng)) src->addDocument(term, d, rng() % 8 + 1);
+        }
+    }
+    return src;
+}
+
+static void benchCodecs(uint32_t count) {
+    std::mt19937 rng(1);
+    std::vector<uint32_t> ids(count);
+    uint32_t cur = 0;
+    for (auto& id : ids) id = cur += rng() % 300 + 1;
+
+    std::string varint;
+    uint32_t prev = 0;
+    for (uint32_t id : ids) {
+        appendVarInt(varint, id - prev);
+        prev = id;
+    }
+    std::vector<uint8_t> svb(count * 5 + StreamVByte::PADDING);
+    StreamVByte::encodeDelta(ids.data(), count, 0, svb.data());
+
+    std::vector<uint32_t> out(count);
+    const int repeats = 50;
+
+    double t_varint = timeIt(
+        [&] {
+            const char* ptr = varint.data();
+            uint32_t doc = 0;
+            for (uint32_t i = 0; i < count; ++i) out[i] = doc += readVarInt(ptr);
+        },
+        repeats);
+    double t_scalar = timeIt([&] { StreamVByte::decodeDeltaScalar(svb.data(), count, 0, out.data()); }, repeats);
+    double t_simd = timeIt([&] { StreamVByte::decodeDelta(svb.data(), count, 0, out.data()); }, repeats);
+
+    auto rate = [&](double t) { return count / t / 1e6; };
+    std::cout << "Raw codecs, " << count << " doc deltas (SIMD " << (StreamVByte::simdAvailable() ? "on" : "off") << ")\n";
+    std::cout << "  varint             " << rate(t_varint) << " M ints/s\n";
+    std::cout << "  streamvbyte scalar " << rate(t_scalar) << " M ints/s\n";
+    std::cout << "  streamvbyte simd   " << rate(t_simd) << " M ints/s\n";
+}
+
+static void benchFormats(const std::shared_ptr<RamIndexSource>& src, uint32_t num_terms) {
+    std::vector<std::string> terms;
+    for (uint32_t t = 0; t < num_terms; ++t) terms.push_back("t" + std::to_string(t));
+
+    std::cout << "Index formats, " << src->getTotalDocs() << " docs\n";
+    for (auto format : {BinaryFormat::PostingFormat::Raw, BinaryFormat::PostingFormat::VarInt,
+                        BinaryFormat::PostingFormat::Blocked, BinaryFormat::PostingFormat::StreamVByte}) {
+        std::string path = "/tmp/bench_codecs_" + std::to_string((int)format) + ".idx";
+        src->dump(path, format);
+        MappedIndexSource mapped(path);
+
+        uint64_t postings = 0;
+        double t_scan = timeIt(
+            [&] {
+                postings = 0;
+                for (const auto& term : terms) {
+                    for (PostingCursor c = mapped.openCursor(term); c.valid(); c.next()) postings++;
+                }
+            },
+            5);
+
+        // Rare AND common: t0 is in half the docs, the tail terms in a handful
+        size_t matches = 0;
+        double t_and = timeIt(
+            [&] {
+                matches = 0;
+                for (uint32_t t = num_terms / 2; t < num_terms; ++t) {
+                    PostingCursor rare = mapped.openCursor(terms[t]);
+                    PostingCursor common = mapped.openCursor(terms[0]);
+                    matches += intersect_lists(rare, common).size();
+                }
+            },
+            5);
+
+        std::cout << "  v" << (int)format << ": scan " << postings / t_scan / 1e6 << " M postings/s, rare&common "
+                  << t_and * 1e3 << " ms (" << matches << " matches)\n";
+        unlink(path.c_str());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t num_docs = argc > 1 ? std::stoul(argv[1]) : 200000;
+    uint32_t num_terms = argc > 2 ? std::stoul(argv[2]) : 200;
+
+    benchCodecs(1 << 20);
+    auto src = buildSource(num_docs, num_terms);
+    benchFormats(src, num_terms);
+}
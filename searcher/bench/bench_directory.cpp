@@ -0,0 +1,71 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "index.h"
+
+// Term lookup rate for the directory layouts: binary search over TermEntry, the Eytzinger hash
+// section and the minimal perfect hash. Half of the probes are misses.
+// Usage: bench_directory [num_terms] [num_lookups]
+
+template <typename Func>
+static double timeIt(Func&& f, int repeats) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < repeats; ++i) f();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(end - start).count() / repeats;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t num_terms = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    uint32_t num_lookups = argc > 2 ? std::stoul(argv[2]) : 2000000;
+    const uint32_t num_docs = 64;
+
+    RamIndexSource src;
+    for (uint32_t d = 0; d < num_docs; ++d) src.addUrl("http://doc/" + std::to_string(d));
+    for (uint32_t t = 0; t < num_terms; ++t) {
+        std::string term = "term" + std::to_string(t);
+        src.addDocument(term, t % num_docs, 1);
+        src.addDocument(term, (t + 1) % num_docs, 1);
+    }
+
+    std::mt19937 rng(7);
+    std::vector<std::string> probes(num_lookups);
+    for (auto& probe : probes) {
+        uint32_t t = rng() % num_terms;
+        probe = (rng() & 1) ? "term" + std::to_string(t) : "miss" + std::to_string(t);
+    }
+
+    struct Layout {
+        const char* name;
+        bool eytzinger;
+        bool perfect_hash;
+    };
+    std::cout << num_terms << " terms, " << num_lookups << " lookups\n";
+    for (Layout layout : {Layout{"binary search ", false, false}, Layout{"eytzinger     ", true, false},
+                          Layout{"perfect hash  ", false, true}}) {
+        std::string path = "/tmp/bench_directory_" + std::to_string(getpid()) + ".idx";
+        BinaryFormat::DumpOptions options;
+        options.eytzinger_directory = layout.eytzinger;
+        options.perfect_hash = layout.perfect_hash;
+        src.dump(path, options);
+
+        LoadOptions load_options;
+        load_options.populate = true;
+        MappedIndexSource mapped(path, load_options);
+
+        size_t found = 0;
+        double t = timeIt(
+            [&] {
+                found = 0;
+                for (const auto& probe : probes) found += mapped.openCursor(probe).size();
+            },
+            3);
+        std::cout << "  " << layout.name << num_lookups / t / 1e6 << " M lookups/s (" << found << " postings)\n";
+        unlink(path.c_str());
+    }
+}
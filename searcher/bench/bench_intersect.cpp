@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "intersect.h"
+
+// Intersection kernels on random lists with a growing length ratio. The long list is fixed, the
+// short one shrinks; the crossover where galloping overtakes the block kernels sets GALLOP_RATIO.
+// Usage: bench_intersect [long_list_size]
+
+template <typename Func>
+static double timeIt(Func&& f, int repeats) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < repeats; ++i) f();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(end - start).count() / repeats;
+}
+
+static std::vector<TermInfo> randomList(std::mt19937& rng, uint32_t size, uint32_t universe) {
+    std::vector<uint32_t> docs(size);
+    for (auto& d : docs) d = rng() % universe;
+    std::sort(docs.begin(), docs.end());
+    docs.erase(std::unique(docs.begin(), docs.end()), docs.end());
+    std::vector<TermInfo> list;
+    list.reserve(docs.size());
+    for (uint32_t d : docs) list.push_back({d, 1});
+    return list;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t long_size = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    uint32_t universe = long_size * 4;
+    std::mt19937 rng(11);
+    auto long_list = randomList(rng, long_size, universe);
+
+    struct Kernel {
+        const char* name;
+        Intersect::Kernel kernel;
+    };
+    std::vector<Kernel> kernels = {{"merge", Intersect::Kernel::Merge}, {"gallop", Intersect::Kernel::Gallop},
+                                   {"sse", Intersect::Kernel::Sse}};
+    if (Intersect::avx2Available()) kernels.push_back({"avx2", Intersect::Kernel::Avx2});
+
+    std::cout << long_list.size() << " postings in the long list, times in ms\nratio";
+    for (const auto& k : kernels) std::cout << "\t" << k.name;
+    std::cout << "\tauto\n";
+
+    std::vector<TermInfo> out;
+    uint32_t crossover = 0;
+    for (uint32_t ratio = 1; ratio <= 1024; ratio *= 2) {
+        auto short_list = randomList(rng, long_size / ratio, universe);
+        std::cout << ratio;
+        double best_block = 1e9, gallop = 0;
+        for (const auto& k : kernels) {
+            double t = timeIt(
+                [&] {
+                    out.clear();
+                    Intersect::intersect(short_list, long_list, out, k.kernel);
+                },
+                5);
+            std::cout << "\t" << t * 1e3;
+            if (k.kernel == Intersect::Kernel::Gallop) {
+                gallop = t;
+            } else {
+                best_block = std::min(best_block, t);
+            }
+        }
+        double t = timeIt(
+            [&] {
+                out.clear();
+                Intersect::intersect(short_list, long_list, out);
+            },
+            5);
+        std::cout << "\t" << t * 1e3 << "\n";
+        if (!crossover && gallop < best_block) crossover = ratio;
+    }
+    std::cout << "galloping wins from ratio " << crossover << ", GALLOP_RATIO = " << Intersect::GALLOP_RATIO << "\n";
+}
@@ -8,8 +8,10 @@
 #include <mongocxx/instance.hpp>
 #include <mongocxx/options/find.hpp>
 #include <mongocxx/uri.hpp>
+#include <string_view>
 
 #include "indexator.h"
+#include "indexing_pipeline.h"
 
 struct Document {
     std::string url;
@@ -22,9 +24,18 @@ private:
     uint64_t total_bytes{0};
     std::shared_ptr<IIndexator> indexator;
 
+    // Appends the cleaned text of the page; the pipeline and the token statistics parse the same way
+    void htmlToText(std::string_view html, std::string& content);
+    IndexingPipeline::Extractor htmlExtractor();
+    void feed(IndexingPipeline& pipeline, int max_documents);
+
 public:
     DocumentDownloader(const std::string& uri, std::shared_ptr<IIndexator> indexator);
-    void downloadDocuments(int max_documents = 1000000000);
+    // workers parse and tokenize in parallel, 0 means one per spare core; doc ids follow cursor order
+    void downloadDocuments(int max_documents = 1000000000, unsigned workers = 0);
+    // Same, but `indexers` threads fill shards made by factory; write them with RamIndexSource::dumpShards
+    std::vector<std::shared_ptr<RamIndexSource>> downloadShards(IndexingPipeline::IndexatorFactory factory,
+                                                                int max_documents, unsigned workers, unsigned indexers);
     void downloadDocumentsWithonIndexation();
     void extractText(GumboNode* node, std::string& buffer);
     void cleanText(std::string& text);
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "indexator.h"
+
+// Index construction under a memory budget (SPIMI). Documents go into an in-memory run; once the run
+// passes the budget its dictionary is sorted, written to a temp file and the run starts over empty.
+// finish() merges all runs with a k-way merge straight into the regular index format. Runs are mapped
+// and every list is decoded and encoded a block at a time, while URLs, document lengths, directory
+// entries and block maxes go through temp files, so memory stays at one run during the build and at a
+// few blocks per run during the merge. Only the PerfectHash, EytzingerHashes and SortedTerms sections
+// need the whole dictionary at once (see IndexWriter::Layout). Temp files live in a private directory
+// made with mkdtemp under Options::temp_dir.
+//
+// It is an indexator itself, so it drops in wherever one is expected (DocumentDownloader, IndexingPipeline).
+class ExternalIndexBuilder : public IIndexator {
+public:
+    struct Options {
+        uint64_t memory_budget = 256ull << 20;  // RamIndexSource::memoryUsage() of a run before it is flushed
+        std::string temp_dir = "/tmp";
+    };
+
+    struct Stats {
+        uint32_t runs = 0;
+        uint32_t docs = 0;
+        uint64_t run_bytes = 0;    // written to temp files
+        uint64_t peak_memory = 0;  // largest run, by memoryUsage()
+        double flush_seconds = 0.;
+        double merge_seconds = 0.;
+    };
+
+    // make_indexator is called for every run. getTokenizer() is the first run's tokenizer: pipeline workers
+    // use it while the runs are replaced under them.
+    ExternalIndexBuilder(IndexatorFactory make_indexator, Options options);
+    // Removes the temp files and their directory
+    ~ExternalIndexBuilder();
+
+    ExternalIndexBuilder(const ExternalIndexBuilder&) = delete;
+    ExternalIndexBuilder& operator=(const ExternalIndexBuilder&) = delete;
+
+    void addDocument(const std::string_view& url_view, const std::string_view& doc_view) override;
+    void addTokens(const std::string_view& url_view, const std::vector<std::string>& tokens) override;
+    // doc_id is local to the current run
+    void processTokens(const std::vector<std::string>& tokens, int doc_id) override;
+
+    // Writes the index, once, after the last document. options.impacts and options.impact_ordered need
+    // whole lists in memory and are rejected with std::invalid_argument.
+    BinaryFormat::DumpStats finish(const std::string& file, const BinaryFormat::DumpOptions& options);
+
+    const Stats& stats() const { return build_stats; }
+
+private:
+    void flushIfFull();
+    void flush();
+    void removeTempFiles();
+    std::string tempFile(const std::string& name) const { return work_dir + "/" + name; }
+
+    IndexatorFactory make_indexator;
+    Options options;
+    std::string work_dir;  // private to this builder, empty once removed
+    std::shared_ptr<RamIndexSource> run_source;
+    std::shared_ptr<IIndexator> run;
+    std::vector<std::string> run_files;
+    uint64_t total_tokens = 0;
+    Stats build_stats;
+};
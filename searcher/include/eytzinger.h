@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Sorted keys stored in Eytzinger (BFS) order: the root at index 1, the children of k at 2k and 2k + 1.
+// A binary search then walks down a heap-shaped array, so the first levels share a few cache lines and
+// the 16 possible descendants four levels down are contiguous, which makes them easy to prefetch.
+namespace Eytzinger {
+
+// keys and ranks get n + 1 slots, slot 0 is unused. ranks[k] is the position of keys[k] in `sorted`.
+void build(const uint32_t* sorted, uint32_t n, std::vector<uint32_t>& keys, std::vector<uint32_t>& ranks);
+
+// Position in the sorted order of the first key >= x, or n if there is none
+inline uint32_t lowerBound(const uint32_t* keys, const uint32_t* ranks, uint32_t n, uint32_t x) {
+    uint64_t k = 1;
+    while (k <= n) {
+        // keys + 16k is the first of k's descendants four levels down, one 64-byte line when keys is aligned
+        __builtin_prefetch(keys + 16 * k);
+        k = 2 * k + (keys[k] < x);
+    }
+    // Undo the trailing right turns plus the last left turn
+    k >>= __builtin_ffsll((long long)~k);
+    return k ? ranks[k] : n;
+}
+
+}  // namespace Eytzinger
@@ -1,7 +1,19 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
 #include <vector>
 
+#include "perfect_hash.h"
+#include "posting_cache.h"
+#include "term_dictionary.h"
+
 namespace BinaryFormat {
 struct Header {
     uint32_t magic;
@@ -15,8 +27,125 @@ struct TermEntry {
     uint64_t term_offset;
     uint64_t data_offset;
     uint32_t doc_count;
+    // Sum of tf over the posting list. Occupies what used to be padding, so it is only
+    // meaningful in files that carry the DocLengths section. Saturates at UINT32_MAX.
+    uint32_t collection_freq;
+};
+
+// Version 3 splits every posting list into BLOCK_SIZE-doc blocks. The list starts with one
+// BlockHeader per block, followed by the blocks themselves; inside a block docs are varint
+// deltas against the previous block's last_doc_id. offset is relative to the end of the headers.
+struct BlockHeader {
+    uint32_t last_doc_id;
+    uint32_t offset;
+};
+
+// Version 4 keeps the same block headers, but a block is two StreamVByte streams: doc deltas, then tfs
+const uint32_t BLOCK_SIZE = 128;
+
+enum class PostingFormat : uint32_t { Raw = 1, VarInt = 2, Blocked = 3, StreamVByte = 4 };
+
+// Optional sections go after the postings and are listed in a table at the very end of the
+// file (8-aligned table, then Footer). Any version may carry them, readers skip ids they do not know.
+// SortedTerms is the exception: when present the plain term strings are not written and
+// TermEntry::term_offset holds the term's ordinal in that section instead.
+enum class SectionId : uint32_t {
+    PerfectHash = 1,
+    SortedTerms = 2,
+    UrlOffsets = 3,
+    EytzingerHashes = 4,
+    DocLengths = 5,
+    BlockMax = 6,
+    BitmapTerms = 7,
+    Impacts = 8,
+    ImpactOrdered = 9,
+};
+
+struct SectionEntry {
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct Footer {
+    uint64_t table_offset;
+    uint32_t num_sections;
+    uint32_t magic;
+};
+
+// UrlOffsets section: uint64_t offsets[num_docs], absolute offset of each URL's length prefix.
+// It lets the loader find URLs (and the term directory right after them) without walking them all.
+// PerfectHash section: PerfectHash::Header, uint32_t pilots[num_buckets], then
+// uint32_t entries[num_keys] mapping a hash slot to its TermEntry index
+// EytzingerHashes section (64-byte aligned): uint32_t hashes[num_terms + 1] in Eytzinger order, then
+// uint32_t entries[num_terms + 1] with the TermEntry index of each hash; slot 0 of both is unused
+// DocLengths section: DocLengthsHeader, then either uint32_t lengths[num_docs] or, when quantized,
+// uint32_t table[256] followed by uint8_t codes[num_docs] with length = table[code]
+struct DocLengthsHeader {
+    uint32_t num_docs;
+    uint32_t quantized;
+    uint64_t total_tokens;
+};
+
+// BlockMax section: uint32_t first_block[num_terms + 1], then BlockMax blocks[first_block[num_terms]].
+// Every posting list is cut into BLOCK_SIZE-doc blocks whatever its format, blocks[first_block[t] + b]
+// bounds the b-th block of term t. Scores grow with tf, so max_tf bounds the block's score.
+struct BlockMax {
+    uint32_t last_doc_id;
+    uint32_t max_tf;
+};
+
+// BitmapTerms section: uint64_t bits[(num_terms + 63) / 64]. A set bit means the term's data_offset
+// points at a Roaring set with tfs (see roaring.h) instead of a list in the file's posting format.
+// Readers that do not know the section cannot read such terms, so it is only written on request.
+
+// Impacts section: ImpactsHeader, ImpactTerm terms[num_terms + 1], then uint8_t impacts[num_postings].
+// impacts[terms[t].first + i] is the quantized score of the i-th posting of term t in doc order.
+// One impact unit is worth `scale` for every term, so the impacts of a query's terms add up.
+// terms[t] extends TermEntry t with the idf the scores were computed with; terms[num_terms].first == num_postings.
+struct ImpactsHeader {
+    float scale;
+    uint32_t num_terms;
+    uint64_t num_postings;
+};
+
+struct ImpactTerm {
+    uint64_t first;
+    float idf;
+    uint32_t max_impact;
 };
 
+// ImpactOrdered section (only with Impacts): uint32_t first_segment[num_terms + 1], ImpactSegment
+// segments[first_segment[num_terms]], then uint32_t docs[num_postings]. The segments of a term go from
+// its highest impact down, each one `count` ascending doc ids; the term's docs start at ImpactTerm::first.
+struct ImpactSegment {
+    uint32_t impact;
+    uint32_t count;
+};
+
+struct DumpOptions {
+    PostingFormat format = PostingFormat::Raw;
+    bool perfect_hash = false;
+    bool front_coded_terms = false;
+    bool eytzinger_directory = false;
+    bool quantize_doc_lengths = false;  // one byte per document, within 1/16 of the real length
+    bool block_max = false;
+    bool bitmap_containers = false;  // dense terms as Roaring sets when that is smaller
+    bool impacts = false;            // 8-bit tf-idf per posting plus the idf of every term
+    bool impact_ordered = false;     // also a copy of every list sorted by impact, implies impacts
+    unsigned threads = 0;  // posting encoders, 0 means one per hardware thread
+};
+
+struct DumpStats {
+    uint64_t bytes = 0;
+    uint32_t terms = 0;
+    double seconds = 0;
+    double megabytesPerSecond() const { return seconds > 0 ? bytes / (1024.0 * 1024.0) / seconds : 0; }
+};
+
+const uint32_t FOOTER_MAGIC = 0x5EC7AB1E;
+
 const uint32_t MAGIC = 0xABC1234;
 }  // namespace BinaryFormat
 
@@ -90,6 +219,18 @@ public:
         return nullptr;
     }
 
+    const T* find(const U& key) const {
+        size_t h = getHash(key);
+        const HashNode<U, T>* curr = buckets[h].get();
+        while (curr) {
+            if (curr->key == key) {
+                return &curr->value;
+            }
+            curr = curr->next.get();
+        }
+        return nullptr;
+    }
+
     template <typename Func>
     void traverse(Func callback) {
         for (const auto& bucket : buckets) {
@@ -101,6 +242,17 @@ public:
         }
     }
 
+    template <typename Func>
+    void traverse(Func callback) const {
+        for (const auto& bucket : buckets) {
+            const HashNode<U, T>* curr = bucket.get();
+            while (curr) {
+                callback(curr->key, curr->value);
+                curr = curr->next.get();
+            }
+        }
+    }
+
     uint32_t size() const {
         int size = 0;
         for (const auto& bucket : buckets) {
@@ -114,7 +266,11 @@ public:
     }
 };
 
+// 32-bit FNV-1a, the key the term directory is sorted by
+uint32_t stringHash(std::string_view str);
+
 void writeVarInt(std::ofstream& out, uint32_t value);
+void appendVarInt(std::string& out, uint32_t value);
 int getVarIntSize(uint32_t value);
 uint32_t readVarInt(const char*& ptr);
 
@@ -123,58 +279,355 @@ struct TermInfo {
     uint32_t tf;
 };
 
+// Forward-only iterator over one posting list. Decodes straight from the source bytes
+// (RAM vector or mmap) into a small window, so no list is ever materialized as a whole.
+class PostingCursor {
+public:
+    static constexpr uint32_t END = std::numeric_limits<uint32_t>::max();
+    static constexpr uint32_t WINDOW_SIZE = BinaryFormat::BLOCK_SIZE;
+
+    PostingCursor() = default;
+    explicit PostingCursor(std::span<const TermInfo> postings);
+    static PostingCursor fromVarInt(const char* data, uint32_t count);
+    static PostingCursor fromBlocks(const char* data, uint32_t count, bool stream_vbyte = false);
+    static PostingCursor fromRoaring(const char* data);
+    // Walks a shared decoded list and keeps it alive for as long as the cursor (or a copy) exists
+    static PostingCursor fromShared(std::shared_ptr<const std::vector<TermInfo>> postings);
+
+    PostingCursor(const PostingCursor& other);
+    PostingCursor& operator=(const PostingCursor& other);
+
+    bool valid() const { return pos < len; }
+    uint32_t doc() const { return pos < len ? window[pos].doc_id : END; }
+    uint32_t tf() const { return window[pos].tf; }
+    const TermInfo& current() const { return window[pos]; }
+    uint32_t size() const { return count; }
+
+    void next() {
+        if (++pos >= len) refill();
+    }
+    // Decoded postings from the current one to the end of the window
+    std::span<const TermInfo> buffered() const { return {window + pos, len - pos}; }
+    // The serialized Roaring set behind a cursor that has not moved yet, nullptr otherwise
+    const char* roaring() const { return encoding == Encoding::Roaring && next_block <= 1 && pos == 0 ? stream : nullptr; }
+    // Moves forward by n <= buffered().size() postings
+    void advance(uint32_t n) {
+        pos += n;
+        if (pos >= len) refill();
+    }
+    // Moves to the first posting with doc_id >= target
+    void skipTo(uint32_t target);
+
+private:
+    enum class Encoding : uint8_t { Raw, VarInt, Blocked, StreamVByte, Roaring };
+
+    void refill();
+    void decodeBlock(uint32_t block);
+
+    Encoding encoding = Encoding::Raw;
+    const TermInfo* window = nullptr;
+    uint32_t pos = 0;
+    uint32_t len = 0;
+    uint32_t count = 0;
+
+    const char* stream = nullptr;
+    uint32_t remaining = 0;
+    uint32_t last_doc_id = 0;
+
+    const BinaryFormat::BlockHeader* blocks = nullptr;
+    uint32_t num_blocks = 0;
+    uint32_t next_block = 0;
+
+    std::shared_ptr<const void> owner;
+    std::array<TermInfo, WINDOW_SIZE> buffer;
+};
+
+// Token counts per document, viewed in place: either exact or one byte code plus a 256-entry decode table
+struct DocLengths {
+    const uint32_t* exact = nullptr;
+    const uint8_t* codes = nullptr;
+    const uint32_t* table = nullptr;
+    uint32_t size = 0;
+
+    bool empty() const { return size == 0; }
+    uint32_t operator[](uint32_t doc_id) const { return exact ? exact[doc_id] : table[codes[doc_id]]; }
+};
+
+// TF-IDF weight of a term that occurs tf times in a document, (1 + ln tf), from a table for common tfs
+double tfWeight(uint32_t tf);
+
+// Precomputed scores of one term, viewed in place; empty when the index has no Impacts section
+struct TermImpacts {
+    float scale = 0;  // score of one impact unit
+    float idf = 0;
+    uint32_t max_impact = 0;
+    std::span<const uint8_t> impacts;  // one per posting, in cursor order
+    // Impact-ordered copy, when stored: segments from the highest impact down, their docs back to back
+    std::span<const BinaryFormat::ImpactSegment> segments;
+    const uint32_t* docs = nullptr;
+};
+
+struct CollectionStats {
+    uint32_t num_docs = 0;
+    uint64_t total_tokens = 0;
+    double averageDocLength() const { return num_docs ? (double)total_tokens / num_docs : 0; }
+};
+
 class IIndexSource {
 public:
     virtual ~IIndexSource() = default;
 
-    virtual std::vector<TermInfo> getPostings(const std::string& term) = 0;
+    virtual PostingCursor openCursor(const std::string& term) const = 0;
 
-    virtual std::string getUrl(int doc_id) const = 0;
+    // Views stay valid for the lifetime of the source
+    virtual std::string_view getUrl(int doc_id) const = 0;
 
     virtual uint32_t getTotalDocs() const = 0;
+
+    // Empty for indexes built without lengths
+    virtual DocLengths getDocLengths() const = 0;
+    virtual CollectionStats getCollectionStats() const = 0;
+    // Total occurrences of the term over the collection
+    virtual uint64_t getCollectionFrequency(const std::string& term) const = 0;
+
+    // Indexed terms starting with prefix, in lexicographic order, at most `limit` of them
+    virtual std::vector<std::string> expandPrefix(std::string_view prefix, size_t limit) const = 0;
+
+    // Per-block tf bounds for dynamic pruning, empty when the index does not store them
+    virtual std::span<const BinaryFormat::BlockMax> getBlockMaxes(const std::string&) const { return {}; }
+    virtual bool hasImpacts() const { return false; }
+    virtual TermImpacts getImpacts(const std::string&) const { return {}; }
+
+    // Materializes the whole posting list, prefer openCursor on hot paths
+    std::vector<TermInfo> getPostings(const std::string& term) const;
+
+    // Bumped whenever the indexed data changes (new documents, a reloaded file), so anything
+    // derived from it can tell it is stale
+    uint64_t generation() const { return data_generation; }
+
+protected:
+    uint64_t data_generation = 0;
+};
+
+// The file writer behind RamIndexSource::dump, shared with the external build (external_index.h).
+// Posting lists are encoded term by term in directory order, then writeIndexFile lays out the file
+// around them: header, URLs, term directory, term strings, postings, sections.
+namespace IndexWriter {
+// Terms with a single posting of tf 1, or in at least 95% of the documents, are left out
+bool keepTerm(size_t doc_count, uint32_t first_tf, uint32_t num_docs);
+// Every list starts at a multiple of this from the 8-aligned start of the postings, so its headers can be
+// read in place; pad after each list with padList
+size_t listAlignment(const BinaryFormat::DumpOptions& options);
+void padList(const BinaryFormat::DumpOptions& options, std::string& out);
+// Sum of tf over the list, saturated at UINT32_MAX to fit TermEntry::collection_freq
+uint32_t collectionFrequency(const std::vector<TermInfo>& docs);
+// Appends the posting list in the given format to out
+void encodePostings(const std::vector<TermInfo>& docs, BinaryFormat::PostingFormat format, std::string& out);
+// Replaces the list encoded at out[begin..] with a Roaring set when bitmaps are enabled and the set is smaller
+bool encodeBitmap(const std::vector<TermInfo>& docs, uint32_t num_docs, const BinaryFormat::DumpOptions& options,
+                  size_t begin, std::string& out);
+void appendBlockMax(const std::vector<TermInfo>& docs, std::vector<BinaryFormat::BlockMax>& blocks);
+// Bound of one block of BLOCK_SIZE postings (the last one of a list may be shorter)
+BinaryFormat::BlockMax blockMax(const TermInfo* docs, uint32_t n);
+
+// A posting list handed out in blocks of BLOCK_SIZE postings, the last one possibly shorter, in doc order.
+// Every call replays the list from the start, so a list too long to hold is written in a few passes.
+using ListBlocks = std::function<void(const std::function<void(const TermInfo* docs, uint32_t n)>&)>;
+struct WrittenList {
+    uint64_t bytes;
+    bool bitmap;
+};
+// Writes the bytes encodePostings, encodeBitmap and padList would append for the list, one block in memory at a time
+WrittenList writeList(const ListBlocks& blocks, uint32_t doc_count, uint32_t num_docs, const BinaryFormat::DumpOptions& options,
+                      std::ostream& out);
+
+struct Term {
+    uint32_t hash;
+    std::string_view term;  // valid during the visit only
+    uint32_t doc_count;
+    uint32_t collection_freq;
+    uint64_t bytes;  // of the encoded list
+    bool bitmap;
+};
+
+// What goes into the file, handed out by callbacks so the writer can stream it from memory or from temp files.
+// Each for_each callback replays its items in order on every call; the writer makes a few passes over the terms.
+// Only the PerfectHash, EytzingerHashes and SortedTerms sections need the whole dictionary at once: they
+// hold the term hashes, and for SortedTerms the term strings, while they are built.
+struct Layout {
+    uint32_t num_docs = 0;
+    uint64_t total_tokens = 0;
+    uint32_t num_terms = 0;
+    // Calls its argument with every document's length in doc id order
+    std::function<void(const std::function<void(uint32_t)>&)> for_each_doc_length;
+    // Calls its argument with every URL in doc id order
+    std::function<void(const std::function<void(std::string_view)>&)> for_each_url;
+    // Calls its argument with every term in directory order
+    std::function<void(const std::function<void(const Term&)>&)> for_each_term;
+    // With block_max, writes the BlockMax of every block of every list back to back in directory order
+    std::function<void(std::ostream&)> write_block_maxes;
+    std::vector<std::pair<BinaryFormat::SectionId, std::string>> impact_sections;
+    // Writes the encoded lists of terms back to back
+    std::function<void(std::ostream&)> write_postings;
 };
 
+BinaryFormat::DumpStats writeIndexFile(const std::string& file, const BinaryFormat::DumpOptions& options, const Layout& layout);
+}  // namespace IndexWriter
+
 class RamIndexSource : public IIndexSource {
 public:
     std::vector<std::string> urls;
+    std::vector<uint32_t> doc_lengths;
+    uint64_t total_tokens = 0;
     HashMap<std::string, std::vector<TermInfo>> index;
 
-    std::vector<TermInfo> getPostings(const std::string& term) override {
-        auto* node = index.getNode(term);
-        return node ? node->value : std::vector<TermInfo>{};
+    PostingCursor openCursor(const std::string& term) const override {
+        const auto* postings = index.find(term);
+        return postings ? PostingCursor(*postings) : PostingCursor{};
     }
 
-    void addUrl(std::string_view url);
+    // length is the document's token count
+    void addUrl(std::string_view url, uint32_t length = 0);
     void addDocument(const std::string& token, uint32_t doc_id, uint32_t tf = 1);
+    // Rough heap footprint: vector capacities, terms, URLs and the hash table's buckets, which an empty source
+    // already holds
+    uint64_t memoryUsage() const { return memory_bytes + index.buckets.capacity() * sizeof(index.buckets[0]); }
 
-    std::string getUrl(int doc_id) const override {
+    std::string_view getUrl(int doc_id) const override {
         if (doc_id >= 0 && doc_id < (int)urls.size()) return urls[doc_id];
         return "";
     }
 
     uint32_t getTotalDocs() const override { return (int)urls.size(); }
-    void dump(const std::string& file, bool zip);
+    DocLengths getDocLengths() const override { return {doc_lengths.data(), nullptr, nullptr, (uint32_t)doc_lengths.size()}; }
+    CollectionStats getCollectionStats() const override { return {(uint32_t)urls.size(), total_tokens}; }
+    uint64_t getCollectionFrequency(const std::string& term) const override;
+    std::vector<std::string> expandPrefix(std::string_view prefix, size_t limit) const override;
+    BinaryFormat::DumpStats dump(const std::string& file, bool zip);
+    BinaryFormat::DumpStats dump(const std::string& file, BinaryFormat::PostingFormat format);
+    BinaryFormat::DumpStats dump(const std::string& file, const BinaryFormat::DumpOptions& options);
+
+    // Writes shards filled independently (e.g. one per indexing thread) as one index. Every shard numbers its
+    // documents from 0; shard s holds the documents that follow those of shards 0..s-1. Term dictionaries are
+    // k-way merged and posting lists concatenated with doc id offsets, so the file is byte-identical to dumping
+    // one source that indexed all documents in the same order.
+    static BinaryFormat::DumpStats dumpShards(const std::vector<std::shared_ptr<RamIndexSource>>& shards,
+                                              const std::string& file, const BinaryFormat::DumpOptions& options);
+
+private:
+    uint64_t memory_bytes = 0;
+
+    static BinaryFormat::DumpStats write(const std::string& file, const BinaryFormat::DumpOptions& options,
+                                         const std::vector<const RamIndexSource*>& shards);
+};
+
+// How the mapped file is brought into and kept in memory. Defaults match a plain lazy MAP_PRIVATE mapping.
+struct LoadOptions {
+    enum class Advice { Normal, Random, Sequential, WillNeed };
+
+    bool populate = false;  // MAP_POPULATE: read the whole file at open instead of faulting it in
+    // The dictionary region is the header, URLs, term directory, term strings and the trailing sections
+    Advice dictionary_advice = Advice::Normal;
+    Advice postings_advice = Advice::Normal;
+    bool lock_dictionary = false;
+    uint32_t lock_top_postings = 0;  // mlock the posting lists of the N terms with the most documents
+    bool huge_pages = false;         // MADV_HUGEPAGE, only honoured by kernels with file-backed THP
+    size_t posting_cache_bytes = 0;  // Budget for decoded lists of hot terms in compressed files, 0 disables
+};
+
+// Page-cache residency of the mapping, as reported by mincore
+struct ResidencyReport {
+    struct Region {
+        size_t pages = 0;
+        size_t resident = 0;
+        double coverage() const { return pages ? (double)resident / pages : 1.0; }
+    };
+
+    Region dictionary;
+    Region postings;
+    Region total;
+    size_t locked_bytes = 0;
+    uint32_t lock_failures = 0;  // usually RLIMIT_MEMLOCK; locking is best effort
 };
 
 class MappedIndexSource : public IIndexSource {
-    int fd = -1;
-    size_t file_size = 0;
-    const char* map_addr = nullptr;
+    // Owns the descriptor and the mapping, so a moved-from source never unmaps what the new one uses
+    struct Mapping {
+        int fd = -1;
+        size_t size = 0;
+        const char* addr = nullptr;
+
+        Mapping() = default;
+        Mapping(Mapping&& other) noexcept;
+        Mapping& operator=(Mapping&& other) = delete;
+        ~Mapping();
+        void release();
+    };
+
+    Mapping file;
+
+    // Postings occupy [postings_begin, postings_end), everything around them is dictionary data
+    uint64_t postings_begin = 0;
+    uint64_t postings_end = 0;
+    size_t locked_bytes = 0;
+    uint32_t lock_failures = 0;
 
     const BinaryFormat::TermEntry* term_directory = nullptr;
     uint32_t num_terms = 0;
-    std::vector<std::string> urls;
+    uint32_t num_docs = 0;
     uint32_t file_version = 0;
 
+    // Absolute offset of every URL's length prefix; only legacy files without the section fill legacy_url_offsets
+    const uint64_t* url_offsets = nullptr;
+    std::vector<uint64_t> legacy_url_offsets;
+
+    std::span<const BinaryFormat::SectionEntry> sections;
+    const PerfectHash::Header* perfect_hash = nullptr;
+    const uint32_t* perfect_hash_pilots = nullptr;
+    const uint32_t* perfect_hash_entries = nullptr;
+    const uint32_t* eytzinger_hashes = nullptr;
+    const uint32_t* eytzinger_entries = nullptr;
+    const uint32_t* block_max_first = nullptr;
+    const BinaryFormat::BlockMax* block_max_blocks = nullptr;
+    const uint64_t* bitmap_terms = nullptr;
+    const BinaryFormat::ImpactsHeader* impacts_header = nullptr;
+    const BinaryFormat::ImpactTerm* impact_terms = nullptr;
+    const uint8_t* impact_values = nullptr;
+    const uint32_t* impact_first_segment = nullptr;
+    const BinaryFormat::ImpactSegment* impact_segments = nullptr;
+    const uint32_t* impact_docs = nullptr;
+    DocLengths doc_lengths;
+    CollectionStats stats;
+    FrontCoding::Reader sorted_terms;
+    std::unique_ptr<PostingCache> posting_cache;
+
+    const BinaryFormat::SectionEntry* findSection(BinaryFormat::SectionId id) const;
     const BinaryFormat::TermEntry* findTermEntry(std::string_view term) const;
+    bool termEquals(const BinaryFormat::TermEntry& entry, std::string_view term) const;
+    void unload();
+    void applyResidency(const LoadOptions& options);
+    bool lockRange(uint64_t begin, uint64_t end);
 
 public:
-    MappedIndexSource(const std::string& filename) { load(filename); }
-    ~MappedIndexSource();
-
-    void load(const std::string& filename);
-
-    std::vector<TermInfo> getPostings(const std::string& term) override;
-    std::string getUrl(int doc_id) const override;
-    uint32_t getTotalDocs() const override { return (int)urls.size(); }
-};
\ No newline at end of file
+    MappedIndexSource(const std::string& filename, const LoadOptions& options = {}) { load(filename, options); }
+    MappedIndexSource(MappedIndexSource&& other) noexcept = default;
+
+    void load(const std::string& filename, const LoadOptions& options = {});
+    ResidencyReport residency() const;
+    PostingCache::Stats postingCacheStats() const { return posting_cache ? posting_cache->stats() : PostingCache::Stats{}; }
+
+    PostingCursor openCursor(const std::string& term) const override;
+    std::string_view getUrl(int doc_id) const override;
+    std::vector<std::string> expandPrefix(std::string_view prefix, size_t limit) const override;
+    bool hasPerfectHash() const { return perfect_hash != nullptr; }
+    bool hasEytzingerDirectory() const { return eytzinger_hashes != nullptr; }
+    bool hasSortedTerms() const { return sorted_terms.valid(); }
+    uint32_t getTotalDocs() const override { return num_docs; }
+    DocLengths getDocLengths() const override { return doc_lengths; }
+    CollectionStats getCollectionStats() const override { return stats; }
+    uint64_t getCollectionFrequency(const std::string& term) const override;
+    std::span<const BinaryFormat::BlockMax> getBlockMaxes(const std::string& term) const override;
+    bool hasImpacts() const override { return impacts_header != nullptr; }
+    bool hasImpactOrder() const { return impact_first_segment != nullptr; }
+    TermImpacts getImpacts(const std::string& term) const override;
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <functional>
+
 #include "index.h"
 #include "tokenizer.h"
 
@@ -11,6 +13,10 @@ protected:
 public:
     IIndexator(std::shared_ptr<RamIndexSource> src, std::shared_ptr<Tokenizer> tok);
     virtual void addDocument(const std::string_view& url_view, const std::string_view& doc_view);
+    // Same as addDocument for text tokenized elsewhere, e.g. by pipeline workers
+    virtual void addTokens(const std::string_view& url_view, const std::vector<std::string>& tokens);
+    const Tokenizer& getTokenizer() const { return *tokenizer; }
+    std::shared_ptr<Tokenizer> sharedTokenizer() const { return tokenizer; }
     virtual void processTokens(const std::vector<std ::string>& tokens, int doc_id) = 0;
 };
 
@@ -25,3 +31,7 @@ public:
     TFIDFIndexator(std::shared_ptr<RamIndexSource> src, std::shared_ptr<Tokenizer> tok);
     void processTokens(const std::vector<std ::string>& tokens, int doc_id) override;
 };
+
+// Makes the indexator of a fresh source, e.g. a shard or a run of a multi-source build; all of them must
+// tokenize the same way
+using IndexatorFactory = std::function<std::shared_ptr<IIndexator>(std::shared_ptr<RamIndexSource>)>;
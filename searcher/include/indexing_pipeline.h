@@ -0,0 +1,286 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "indexator.h"
+
+// Bounded multi-producer multi-consumer ring (Vyukov). Every cell carries a sequence number that
+// tells producers and consumers whose turn it is, so push and pop are one CAS on the happy path.
+// Blocked callers spin a little and then sleep on a condition variable, so idle stages cost no CPU.
+template <typename T>
+class BoundedQueue {
+public:
+    // capacity is rounded up to a power of two
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        cells = std::vector<Cell>(size);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // Fails when the queue is full, value is left untouched then
+    bool tryPush(T& value) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T& value) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Spins briefly, then sleeps until there is room
+    void push(T value) {
+        for (int i = 0; i < SPINS; ++i) {
+            if (tryPush(value)) {
+                wake(not_empty, waiting_pop);
+                return;
+            }
+            std::this_thread::yield();
+        }
+        {
+            std::unique_lock lock(park_mutex);
+            waiting_push.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            not_full.wait(lock, [&] { return tryPush(value); });
+            waiting_push.fetch_sub(1);
+        }
+        wake(not_empty, waiting_pop);
+    }
+
+    // Waits for an item, spinning briefly before sleeping; nullopt once the queue is closed and drained
+    std::optional<T> pop() {
+        T value;
+        for (int i = 0; i < SPINS; ++i) {
+            if (tryPop(value)) return popped(std::move(value));
+            if (closed.load(std::memory_order_acquire)) break;
+            std::this_thread::yield();
+        }
+        bool got = false;
+        {
+            std::unique_lock lock(park_mutex);
+            waiting_pop.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            not_empty.wait(lock, [&] { return (got = tryPop(value)) || closed.load(std::memory_order_acquire); });
+            waiting_pop.fetch_sub(1);
+        }
+        // Everything pushed before close() is visible now, look once more
+        if (got || tryPop(value)) return popped(std::move(value));
+        return std::nullopt;
+    }
+
+    // Producers are done; call after the last push has returned
+    void close() {
+        closed.store(true, std::memory_order_release);
+        std::lock_guard lock(park_mutex);
+        not_empty.notify_all();
+    }
+
+    // Approximate while other threads are working
+    size_t size() const {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_relaxed);
+        return t > h ? t - h : 0;
+    }
+    size_t capacity() const { return cells.size(); }
+
+private:
+    static constexpr int SPINS = 64;
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    // Pairs with the fence a sleeper issues after announcing itself: either the sleeper sees the change
+    // in its predicate or this sees the sleeper and notifies under the lock
+    void wake(std::condition_variable& cv, std::atomic<int>& waiting) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed) == 0) return;
+        std::lock_guard lock(park_mutex);
+        cv.notify_one();
+    }
+    std::optional<T> popped(T&& value) {
+        wake(not_full, waiting_push);
+        return std::move(value);
+    }
+
+    std::vector<Cell> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) std::atomic<size_t> head{0};
+    std::atomic<bool> closed{false};
+
+    // Only touched once a thread gives up spinning
+    std::mutex park_mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::atomic<int> waiting_push{0};
+    std::atomic<int> waiting_pop{0};
+};
+
+struct StageStats {
+    uint64_t items = 0;
+    uint64_t bytes = 0;         // raw bytes read or parsed, tokens for the index stage
+    double busy_seconds = 0.;   // summed over the stage's threads
+    size_t max_depth = 0;       // of the queue feeding the stage, none for the read stage
+    double avg_depth = 0.;      // sampled at every push into that queue
+    unsigned threads = 1;
+
+    double itemsPerSecond() const { return busy_seconds > 0 ? items / busy_seconds : 0.; }
+    double megabytesPerSecond() const { return busy_seconds > 0 ? bytes / (1024.0 * 1024.0) / busy_seconds : 0.; }
+};
+
+struct PipelineStats {
+    StageStats read;   // time the caller spent producing documents, measured between pushes
+    StageStats parse;  // extract + tokenize
+    StageStats index;  // posting list appends, in document order within a shard
+    size_t max_reorder = 0;  // documents parsed ahead of the next one to index
+    double seconds = 0.;
+};
+
+// Three-stage build: the caller pushes raw documents, a pool of workers turns them into tokens,
+// and indexer threads append them to the index. Documents are numbered as they are pushed and
+// indexed in that order, so doc ids and the resulting index match a serial addDocument loop.
+//
+// With one indexator everything goes into its source. With a factory, every shard_docs consecutive
+// documents go into a fresh shard, shards are dealt round-robin to the indexer threads, and no two
+// threads ever touch the same source; RamIndexSource::dumpShards(shards()) writes the index.
+class IndexingPipeline {
+public:
+    // Turns a raw document into the text to tokenize; runs on several workers at once
+    using Extractor = std::function<void(const std::string& raw, std::string& text)>;
+    using IndexatorFactory = ::IndexatorFactory;
+
+    struct Options {
+        unsigned workers = 0;        // 0 means one per hardware thread, minus the reader and the indexers
+        size_t queue_capacity = 256;
+        unsigned indexers = 1;       // only with a factory
+        size_t shard_docs = 1 << 16;
+        // Documents an indexer may hold back behind one that is still being parsed; push() waits beyond that,
+        // so a worker stuck on a huge document does not make the indexer buffer the rest of the corpus
+        size_t reorder_window = 1024;
+    };
+
+    IndexingPipeline(std::shared_ptr<IIndexator> indexator, Extractor extract);
+    IndexingPipeline(std::shared_ptr<IIndexator> indexator, Extractor extract, Options options);
+    IndexingPipeline(IndexatorFactory make_indexator, Extractor extract, Options options);
+    // Finishes the build if finish() was not called
+    ~IndexingPipeline();
+
+    IndexingPipeline(const IndexingPipeline&) = delete;
+    IndexingPipeline& operator=(const IndexingPipeline&) = delete;
+
+    // Blocks while the parse queue is full or the document is too far ahead of its indexer
+    void push(std::string url, std::string raw);
+    // Waits until every pushed document is indexed and joins the threads
+    PipelineStats finish();
+
+    // In document order; empty without a factory. Complete after finish()
+    const std::vector<std::shared_ptr<RamIndexSource>>& shards() const { return finished_shards; }
+
+    unsigned workers() const { return (unsigned)parsers.size(); }
+
+private:
+    struct RawDocument {
+        uint64_t seq;
+        std::string url;
+        std::string raw;
+    };
+    struct ParsedDocument {
+        uint64_t seq;
+        std::string url;
+        std::vector<std::string> tokens;
+    };
+    struct Indexer {
+        explicit Indexer(size_t capacity) : queue(capacity) {}
+
+        BoundedQueue<ParsedDocument> queue;
+        std::thread thread;
+        StageStats stats;
+        std::atomic<uint64_t> depth_sum{0};  // of queue, sampled by the workers
+        std::atomic<size_t> max_depth{0};
+        size_t max_reorder = 0;
+        std::atomic<uint64_t> next{0};  // seq of the next document to index
+        std::vector<std::pair<uint64_t, std::shared_ptr<RamIndexSource>>> shards;  // shard number, source
+    };
+
+    void start(unsigned workers, unsigned indexers);
+    Indexer& indexerOf(uint64_t seq) { return *indexers[seq / shard_docs % indexers.size()]; }
+    // Index of seq among the documents of its indexer
+    uint64_t position(uint64_t seq) const {
+        uint64_t round = shard_docs * indexers.size();
+        return seq / round * shard_docs + seq % round % shard_docs;
+    }
+    void parse(unsigned worker);
+    void index(unsigned indexer);
+
+    std::shared_ptr<IIndexator> indexator;  // of shard 0 with a factory
+    std::shared_ptr<RamIndexSource> first_shard;
+    IndexatorFactory make_indexator;
+    Extractor extract;
+    uint64_t shard_docs = UINT64_MAX;
+    uint64_t reorder_window;
+    BoundedQueue<RawDocument> raw_queue;
+    std::vector<std::unique_ptr<Indexer>> indexers;
+    std::vector<std::thread> parsers;
+    std::vector<std::shared_ptr<RamIndexSource>> finished_shards;
+    bool finished = false;
+
+    // The reader parks here while its next document is outside the reorder window
+    std::mutex window_mutex;
+    std::condition_variable window_moved;
+    std::atomic<bool> reader_waiting{false};
+
+    // Per-worker parse counters, merged in finish()
+    std::vector<StageStats> parse_stats;
+    StageStats read_stats;
+    uint64_t raw_depth_sum = 0;
+    size_t raw_max_depth = 0;
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point last_push;
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "index.h"
+
+// Intersection kernels for sorted posting arrays. Matches are appended with the tf of the first list.
+// Galloping wins when one list is much shorter: every probe into the long list costs O(log gap).
+// For lists of similar size the block kernels compare 4 (SSE2) or 8 (AVX2) doc ids against as many
+// from the other list at once, which removes the unpredictable branch of the merge loop.
+namespace Intersect {
+
+enum class Kernel { Auto, Merge, Gallop, Sse, Avx2 };
+
+// Auto gallops once the longer list is at least this many times longer; measured with bench_intersect
+constexpr size_t GALLOP_RATIO = 128;
+
+void intersect(std::span<const TermInfo> a, std::span<const TermInfo> b, std::vector<TermInfo>& out,
+               Kernel kernel = Kernel::Auto);
+
+// Block kernel for cursors: consumes both arrays until one of them is exhausted and returns how many
+// entries of each were consumed. Leftovers of the other array can still match later input.
+std::pair<size_t, size_t> intersectPrefix(std::span<const TermInfo> a, std::span<const TermInfo> b, std::vector<TermInfo>& out);
+
+bool avx2Available();
+
+}  // namespace Intersect
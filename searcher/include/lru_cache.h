@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// String-keyed LRU cache split into independently locked shards, so concurrent lookups of
+// different keys rarely contend. Entries are tagged with the generation of the data they were
+// computed from; a lookup with a newer generation drops everything cached before it.
+template <typename Value>
+class ShardedLruCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+
+    explicit ShardedLruCache(size_t capacity, size_t num_shards = 16)
+        : shards(std::max<size_t>(1, num_shards)), shard_capacity((capacity + shards.size() - 1) / shards.size()) {}
+
+    // A copy of the cached value when it exists and `usable` accepts it
+    template <typename Accept>
+    std::optional<Value> get(const std::string& key, uint64_t generation, Accept&& usable) {
+        Shard& shard = shardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.advanceTo(generation);
+        auto it = shard.entries.find(key);
+        if (it == shard.entries.end() || shard.generation != generation || !usable(it->second->second)) {
+            misses.fetch_add(1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return it->second->second;
+    }
+
+    std::optional<Value> get(const std::string& key, uint64_t generation) {
+        return get(key, generation, [](const Value&) { return true; });
+    }
+
+    void put(const std::string& key, uint64_t generation, Value value) {
+        if (shard_capacity == 0) return;
+        Shard& shard = shardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.advanceTo(generation);
+        // Results of an older generation are stale already
+        if (shard.generation != generation) return;
+
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end()) {
+            it->second->second = std::move(value);
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            return;
+        }
+        if (shard.lru.size() >= shard_capacity) {
+            shard.entries.erase(shard.lru.back().first);
+            shard.lru.pop_back();
+            evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+        shard.lru.emplace_front(key, std::move(value));
+        shard.entries.emplace(key, shard.lru.begin());
+    }
+
+    Stats stats() const {
+        return {hits.load(std::memory_order_relaxed), misses.load(std::memory_order_relaxed),
+                evictions.load(std::memory_order_relaxed)};
+    }
+
+    size_t capacity() const { return shard_capacity * shards.size(); }
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        uint64_t generation = 0;
+        std::list<std::pair<std::string, Value>> lru;  // most recently used first
+        std::unordered_map<std::string, typename std::list<std::pair<std::string, Value>>::iterator> entries;
+
+        void advanceTo(uint64_t newer) {
+            if (newer <= generation) return;
+            entries.clear();
+            lru.clear();
+            generation = newer;
+        }
+    };
+
+    Shard& shardOf(const std::string& key) { return shards[std::hash<std::string>{}(key) % shards.size()]; }
+
+    std::vector<Shard> shards;
+    size_t shard_capacity;
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> evictions{0};
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Minimal perfect hash in the "hash and displace" style (CHD / PTHash): keys are grouped into
+// small buckets, and every bucket gets a pilot value that moves all of its keys to free slots.
+// A lookup is one pilot read plus one hash, the slot still has to be verified by the caller.
+namespace PerfectHash {
+
+uint64_t hash(std::string_view key);
+
+struct Header {
+    uint64_t seed;
+    uint32_t num_keys;
+    uint32_t num_buckets;
+};
+
+struct Table {
+    Header header{};
+    std::vector<uint32_t> pilots;
+};
+
+// Returns a table mapping each of the (distinct) hashes to a unique slot in [0, hashes.size())
+Table build(const std::vector<uint64_t>& hashes);
+
+uint32_t slot(uint64_t key_hash, const Header& header, const uint32_t* pilots);
+
+}  // namespace PerfectHash
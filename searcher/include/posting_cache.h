@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct TermInfo;
+
+// Approximate access counts in a count-min sketch of saturating 4-bit counters. All counters are
+// halved every `sample_size` increments, so old popularity fades (the TinyLFU "reset").
+class FrequencySketch {
+public:
+    explicit FrequencySketch(size_t expected_keys);
+
+    void record(uint32_t key);
+    uint32_t estimate(uint32_t key) const;
+
+private:
+    static constexpr int ROWS = 4;
+    static constexpr uint8_t MAX_COUNT = 15;
+
+    size_t slot(uint32_t key, int row) const;
+
+    std::vector<uint8_t> counters;  // ROWS rows of `width` counters
+    size_t width;
+    size_t sample_size;
+    size_t additions = 0;
+};
+
+// Decoded posting lists of hot terms, bounded by the bytes of their TermInfo arrays. Eviction is LRU.
+// Admission is TinyLFU: a list only gets in when it was asked for before and is more popular than
+// every entry it would push out, so one scan over a few huge lists cannot flush the hot set.
+// Lists are shared and immutable; a reader keeps its list alive after eviction.
+class PostingCache {
+public:
+    using List = std::shared_ptr<const std::vector<TermInfo>>;
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t admitted = 0;
+        uint64_t rejected = 0;
+        size_t bytes = 0;
+    };
+
+    PostingCache(size_t budget_bytes, size_t expected_terms);
+
+    // Counts the access; the cached list or nullptr
+    List find(uint32_t term);
+    // Whether a list of `bytes` for this term is worth decoding and caching right now
+    bool shouldAdmit(uint32_t term, size_t bytes);
+    void insert(uint32_t term, List list);
+
+    Stats stats() const;
+
+private:
+    struct Entry {
+        List list;
+        size_t bytes;
+        std::list<uint32_t>::iterator position;
+    };
+
+    mutable std::mutex mutex;
+    size_t budget;
+    size_t used = 0;
+    FrequencySketch sketch;
+    std::list<uint32_t> lru;  // most recently used first
+    std::unordered_map<uint32_t, Entry> entries;
+    Stats counters;
+};
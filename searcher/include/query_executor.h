@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "searcher.h"
+
+// Fixed pool of threads answering queries with one shared searcher. Queries only read the searcher,
+// its tokenizer and its index source, so a single mapped index serves every core.
+class QueryExecutor {
+public:
+    // threads == 0 means one per hardware thread
+    explicit QueryExecutor(std::shared_ptr<const ISearcher> searcher, unsigned threads = 0);
+    // Answers what is already queued, then joins the workers
+    ~QueryExecutor();
+
+    QueryExecutor(const QueryExecutor&) = delete;
+    QueryExecutor& operator=(const QueryExecutor&) = delete;
+
+    // The page findDocument(query, k, offset) would return; errors come out of the future
+    std::future<std::vector<SearchHit>> submit(std::string query, size_t k, size_t offset = 0);
+
+    size_t threads() const { return workers.size(); }
+
+private:
+    struct Task {
+        std::string query;
+        size_t k;
+        size_t offset;
+        std::promise<std::vector<SearchHit>> result;
+    };
+
+    void work();
+
+    std::shared_ptr<const ISearcher> searcher;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<Task> queue;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
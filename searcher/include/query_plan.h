@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "index.h"
+
+// Boolean query plan built from the shunting-yard RPN. Chains of & and | become n-ary nodes,
+// identical subexpressions are shared (a & a is just a), and AND operands run from the shortest
+// posting list up, so the intermediate result never outgrows the rarest term. Costs are posting
+// list lengths, which the term directory stores anyway. Negated AND operands are subtracted
+// from the positive ones instead of being materialized as complements. Operands stored as Roaring
+// sets are combined word-wise; such results only carry doc ids (tf 0).
+class QueryPlan {
+public:
+    explicit QueryPlan(int total_docs);
+
+    // Builders, called in RPN order. An operator without enough operands is ignored.
+    void pushTerm(const std::string& term, PostingCursor cursor);
+    void pushPrefix(const std::string& prefix, std::vector<PostingCursor> expansions);
+    void applyNot();
+    void applyAnd();
+    void applyOr();
+
+    // Matches in doc order; a negated root only generates the first `limit` of them
+    std::vector<TermInfo> execute(size_t limit = std::numeric_limits<size_t>::max());
+    // True when no match can contain a query term (!a, !(a | b*)), so every match scores 0
+    bool unscored() const;
+    // The optimized plan in execution order, e.g. "&(messi,football,the)"
+    std::string describe() const;
+
+    // Index-independent normal form of an RPN: & and | chains flattened, operands deduplicated and
+    // sorted by name. Equivalent queries ("b a", "a & b & a") map to the same string.
+    static std::string canonicalQuery(const std::vector<std::string>& rpn);
+
+private:
+    enum class Kind : uint8_t { Term, Prefix, Not, And, Or };
+
+    struct Node {
+        Kind kind = Kind::Term;
+        std::string key = {};  // canonical form, equal keys mean equal result sets
+        uint64_t cost = 0;  // upper bound on the number of matches
+        std::vector<uint32_t> children = {};
+        std::vector<PostingCursor> cursors = {};
+        bool evaluated = false;
+        std::vector<TermInfo> result = {};
+        std::string bits = {};  // Roaring set, when the result came from set operations on bitmap terms
+    };
+
+    uint32_t addNode(Node node);
+    void applyNary(Kind kind);
+    PostingCursor run(uint32_t id);
+    static PostingCursor resultCursor(const Node& node);
+
+    uint64_t total_docs;
+    std::deque<Node> nodes;
+    std::unordered_map<std::string, uint32_t> by_key;
+    std::vector<uint32_t> stack;
+};
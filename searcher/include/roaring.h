@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <span>
+#include <string>
+#include <vector>
+
+// Roaring-style doc id sets for dense posting lists. Doc ids are split by their high 16 bits into
+// containers: one with at most ARRAY_MAX docs is a sorted uint16_t array, a fuller one a 65536-bit
+// bitmap. Bitmap against bitmap set operations are word-wise AND / OR / ANDNOT, with popcount
+// giving the cardinality, so two frequent terms intersect at 1024 word operations per 65536 docs.
+namespace Roaring {
+
+constexpr uint32_t ARRAY_MAX = 4096;
+constexpr uint32_t BITMAP_WORDS = 1024;
+// Term frequencies are stored in StreamVByte blocks of this many docs, matching the cursor windows
+constexpr uint32_t TF_BLOCK_SIZE = 128;
+
+enum class ContainerType : uint16_t { Array = 0, Bitmap = 1 };
+
+// Serialized set: Header, Container[num_containers], uint32_t tf_offsets[num_tf_blocks], then the
+// 8-aligned container payloads and the tf blocks. Offsets are relative to the start of the set.
+struct Header {
+    uint32_t num_containers;
+    uint32_t cardinality;
+    uint32_t num_tf_blocks;  // 0 when the set carries no term frequencies
+    uint32_t reserved;
+};
+
+struct Container {
+    uint16_t key;  // doc_id >> 16
+    ContainerType type;
+    uint32_t cardinality;
+    uint32_t rank;  // docs in the preceding containers
+    uint32_t offset;
+};
+
+// Appends a set with the given sorted doc ids; tfs may be empty, otherwise one per doc. Decoding the
+// tfs reads up to StreamVByte::PADDING bytes past the set.
+void append(std::span<const uint32_t> docs, std::span<const uint32_t> tfs, std::string& out);
+
+// Docs with their tfs, handed out in ascending batches of any size. Every call replays the whole set.
+using Batches = std::function<void(const std::function<void(const uint32_t* docs, const uint32_t* tfs, uint32_t n)>&)>;
+
+// Writes the bytes append() would for a set too long to hold: the constructor lays it out in two passes
+// over the batches and write() makes three more, keeping one container and one tf block in memory.
+class StreamWriter {
+public:
+    explicit StreamWriter(Batches batches);
+
+    uint64_t size() const { return header_size + payload_size + tf_size; }
+    void write(std::ostream& out) const;
+
+private:
+    Batches batches;
+    std::vector<Container> containers;  // at most one per 65536 doc ids
+    uint32_t cardinality = 0;
+    uint32_t num_tf_blocks = 0;
+    uint64_t header_size = 0;
+    uint64_t payload_size = 0;
+    uint64_t tf_size = 0;
+};
+
+// Read-only view of a serialized set
+class Set {
+public:
+    Set() = default;
+    explicit Set(const char* data) : data(data) {}
+
+    uint32_t size() const { return header().cardinality; }
+    bool hasTfs() const { return header().num_tf_blocks > 0; }
+    bool contains(uint32_t doc) const;
+    // Number of docs below doc, i.e. the position of the first doc >= doc
+    uint32_t rank(uint32_t doc) const;
+    // Writes the docs at positions [from, from + n) to out
+    void decodeDocs(uint32_t from, uint32_t n, uint32_t* out) const;
+    // Tfs of the docs in [block * TF_BLOCK_SIZE, + n); zeros when the set has none
+    void decodeTfs(uint32_t block, uint32_t n, uint32_t* out) const;
+
+    const char* bytes() const { return data; }
+
+private:
+    friend std::string intersect(Set a, Set b);
+    friend std::string unite(Set a, Set b);
+    friend std::string subtract(Set a, Set b);
+
+    const Header& header() const { return *reinterpret_cast<const Header*>(data); }
+    const Container* containers() const { return reinterpret_cast<const Container*>(data + sizeof(Header)); }
+    const uint16_t* array(const Container& c) const { return reinterpret_cast<const uint16_t*>(data + c.offset); }
+    const uint64_t* bitmap(const Container& c) const { return reinterpret_cast<const uint64_t*>(data + c.offset); }
+
+    const char* data = nullptr;
+};
+
+// Results carry no tfs
+std::string intersect(Set a, Set b);
+std::string unite(Set a, Set b);
+std::string subtract(Set a, Set b);
+
+}  // namespace Roaring
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Dense per-document score array that is reused from query to query. Every slot carries the
+// epoch it was last written in, so starting a query is one counter bump instead of clearing
+// N doubles, and storage only grows when the collection does.
+class ScoreAccumulator {
+public:
+    // Starts a new query over doc ids in [0, num_docs); every document is untracked again
+    void reset(uint32_t num_docs) {
+        if (slots.size() < num_docs) slots.resize(num_docs);
+        if (++epoch == 0) {
+            // The tags wrapped around: stale slots could look current, clear them once
+            for (auto& slot : slots) slot.epoch = 0;
+            epoch = 1;
+        }
+    }
+
+    // Starts accumulating for doc from zero
+    void track(uint32_t doc) { slots[doc] = {0.0, epoch, 0}; }
+    bool tracked(uint32_t doc) const { return slots[doc].epoch == epoch; }
+    void add(uint32_t doc, double score) { slots[doc].score += score; }
+    // Same, also remembering which of the first 32 query terms contributed
+    void add(uint32_t doc, double score, uint32_t term) {
+        slots[doc].score += score;
+        slots[doc].terms |= 1u << term;
+    }
+    // Only meaningful for tracked documents
+    double score(uint32_t doc) const { return slots[doc].score; }
+    uint32_t terms(uint32_t doc) const { return slots[doc].terms; }
+
+    size_t capacity() const { return slots.size(); }
+
+    // One accumulator per thread, so concurrent queries never share slots
+    static ScoreAccumulator& local() {
+        thread_local ScoreAccumulator accumulator;
+        return accumulator;
+    }
+
+private:
+    struct Slot {
+        double score;
+        uint32_t epoch;
+        uint32_t terms;  // fills what would be padding
+    };
+
+    std::vector<Slot> slots;
+    uint32_t epoch = 0;
+};
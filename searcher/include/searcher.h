@@ -1,36 +1,109 @@
 #pragma once
 #include <cstdlib>
 #include <cstring>
+#include <limits>
+#include <optional>
 #include <span>
 #include <vector>
 
 #include "index.h"
+#include "lru_cache.h"
+#include "query_plan.h"
 #include "tokenizer.h"
 
+std::vector<TermInfo> intersect_lists(PostingCursor& c1, PostingCursor& c2);
+std::vector<TermInfo> union_lists(PostingCursor& c1, PostingCursor& c2);
+// Documents in [0, total_docs) missing from c, only the first `limit` of them are generated
+std::vector<TermInfo> not_list(PostingCursor& c, int total_docs, size_t limit = std::numeric_limits<size_t>::max());
+// c1 without the documents of c2, i.e. c1 & !c2 without building the complement
+std::vector<TermInfo> difference_lists(PostingCursor& c1, PostingCursor& c2);
+// N-way union, tf of a doc is the sum over the lists that contain it
+std::vector<TermInfo> union_many(std::vector<PostingCursor>& cursors);
+
 std::vector<TermInfo> intersect_lists(std::span<const TermInfo> l1, std::span<const TermInfo> l2);
 std::vector<TermInfo> union_lists(std::span<const TermInfo> l1, std::span<const TermInfo> l2);
 std::vector<TermInfo> not_list(std::span<const TermInfo> l, int total_docs);
+std::vector<TermInfo> difference_lists(std::span<const TermInfo> l1, std::span<const TermInfo> l2);
+
+struct SearchHit {
+    uint32_t doc_id;
+    double score;
+};
+
+struct BatchStats {
+    size_t queries = 0;
+    size_t distinct_terms = 0;
+    size_t decoded_terms = 0;  // lists shared by several queries, decoded once up front
+    uint64_t decoded_postings = 0;
+    double decode_seconds = 0;
+    double seconds = 0;  // the whole batch, decoding included
+    double queriesPerSecond() const { return seconds > 0 ? queries / seconds : 0; }
+};
+
+struct BatchResult {
+    std::vector<std::vector<SearchHit>> hits;  // one page per query, in input order
+    BatchStats stats;
+};
 
 class ISearcher {
 protected:
     std::shared_ptr<Tokenizer> tokenizer;
     std::shared_ptr<IIndexSource> source;
 
+    // Upper bound on the number of terms a `foo*` prefix query expands to
+    static constexpr size_t MAX_PREFIX_TERMS = 1024;
+
+    // The best hits of one canonical query; complete when there are no more than these
+    struct CachedHits {
+        std::vector<SearchHit> hits;
+        bool complete = false;
+    };
+    std::unique_ptr<ShardedLruCache<CachedHits>> result_cache;
+
 public:
+    using CacheStats = ShardedLruCache<CachedHits>::Stats;
+
     ISearcher(std::shared_ptr<IIndexSource> src, std::shared_ptr<Tokenizer> tok);
     virtual ~ISearcher() = default;
-    virtual std::vector<std::pair<std::string, double>> findDocument(const std::string& query);
+    virtual std::vector<std::pair<std::string, double>> findDocument(const std::string& query) const;
+    // One page of the ranking, hits offset .. offset + k - 1 best first. Only the page is kept in memory,
+    // URLs are left to the caller (getUrl) so nothing outside the page is resolved. Pages come from the
+    // result cache when an equivalent query (same canonical RPN and term multiset) already ranked offset + k hits.
+    std::vector<SearchHit> findDocument(const std::string& query, size_t k, size_t offset = 0) const;
+    std::string_view getUrl(uint32_t doc_id) const { return source->getUrl(doc_id); }
+    // The top k of every query, like findDocument(query, k). All queries are parsed first; posting lists
+    // needed by more than one of them are decoded once and shared, then the queries run on `threads`
+    // workers (0: one per hardware thread). Bypasses the result cache.
+    BatchResult findDocuments(const std::vector<std::string>& queries, size_t k, unsigned threads = 0) const;
+
+    // At most `entries` queries are cached, 0 (the default) turns the cache off. Drops what is cached now.
+    void setResultCacheCapacity(size_t entries);
+    CacheStats resultCacheStats() const;
 
 protected:
-    int getPriority(const std::string& op);
-    bool isOperator(const std::string& token);
-    std::vector<TermInfo> evaluate(const std::vector<std::string>& tokens, int total_docs);
+    int getPriority(const std::string& op) const;
+    bool isOperator(const std::string& token) const;
+    bool isPrefixTerm(const std::string& token) const;
+    // A searcher with the same ranking settings over another source, without a result cache
+    virtual std::unique_ptr<ISearcher> withSource(std::shared_ptr<IIndexSource> src) const = 0;
+    // Leaf terms of the parsed query in query order, prefix terms replaced by their expansions
+    std::vector<std::string> collectQueryTerms(const std::vector<std::string>& tokens) const;
+    std::vector<TermInfo> evaluate(const std::vector<std::string>& tokens, int total_docs) const;
+    QueryPlan buildPlan(const std::vector<std::string>& rpn, int total_docs) const;
+    // True when rankHits keeps doc order, so a page never needs matches past offset + k
+    virtual bool ranksInDocOrder() const { return false; }
+    // The best `limit` hits of a parsed query in ranking order
+    virtual std::vector<SearchHit> searchHits(const std::vector<std::string>& tokens, const std::vector<std::string>& rpn,
+                                              size_t limit) const;
 
     virtual std::vector<std::pair<std::string, double>> processResults(const std::vector<TermInfo>& docIds,
-                                                                       const std::vector<std::string>& terms) = 0;
+                                                                       const std::vector<std::string>& terms) const = 0;
+    // The best `limit` matches in ranking order
+    virtual std::vector<SearchHit> rankHits(const std::vector<TermInfo>& docIds, const std::vector<std::string>& terms,
+                                            size_t limit) const = 0;
 
-    std::vector<std::string> parseQuery(const std::string& query);
-    std::vector<std::string> sortingStation(const std::vector<std::string>& tokens);
+    std::vector<std::string> parseQuery(const std::string& query) const;
+    std::vector<std::string> sortingStation(const std::vector<std::string>& tokens) const;
 };
 
 class BinarySearcher : public ISearcher {
@@ -39,15 +112,44 @@ public:
 
 private:
     std::vector<std::pair<std::string, double>> processResults(const std::vector<TermInfo>& docIds,
-                                                               const std::vector<std::string>& terms) override;
+                                                               const std::vector<std::string>& terms) const override;
+    std::vector<SearchHit> rankHits(const std::vector<TermInfo>& docIds, const std::vector<std::string>& terms,
+                                    size_t limit) const override;
+    bool ranksInDocOrder() const override { return true; }
+    std::unique_ptr<ISearcher> withSource(std::shared_ptr<IIndexSource> src) const override;
 };
 
 class TFIDFSearcher : public ISearcher {
 public:
     TFIDFSearcher(std::shared_ptr<IIndexSource> src, std::shared_ptr<Tokenizer> tok);
 
+    // Top k with URLs resolved
+    std::vector<std::pair<std::string, double>> findTopDocuments(const std::string& query, size_t k) const;
+
+    // Rank with the 8-bit impacts stored in the index instead of computing tf-idf per posting. Scores then
+    // differ from the exact ones by at most half an impact unit per term. Pure OR queries over impact-ordered
+    // lists are evaluated score-at-a-time and stop once the rest of the lists cannot change the page.
+    // Indexes without impacts keep exact scoring. Drops the result cache.
+    void setImpactScoring(bool enabled);
+
 private:
-    std::vector<std::pair<int, double>> rankResults(const std::vector<TermInfo>& doc_ids, const std::vector<std::string>& terms);
+    bool impact_scoring = false;
+    bool useImpacts() const { return impact_scoring && source->hasImpacts(); }
+    std::unique_ptr<ISearcher> withSource(std::shared_ptr<IIndexSource> src) const override;
+
+    std::vector<SearchHit> rankHits(const std::vector<TermInfo>& docIds, const std::vector<std::string>& terms,
+                                    size_t limit) const override;
+    // Scores match the exhaustive ranking. Pure OR queries run Block-Max WAND, pure AND queries skip
+    // blocks whose bounds cannot reach the page; anything else (negation, mixed operators, prefixes
+    // under AND) is evaluated exhaustively and ranked through a bounded heap.
+    std::vector<SearchHit> searchHits(const std::vector<std::string>& tokens, const std::vector<std::string>& rpn,
+                                      size_t limit) const override;
+    std::vector<SearchHit> topKUnion(const std::vector<std::string>& terms, size_t k) const;
+    std::vector<SearchHit> topKIntersection(const std::vector<std::string>& terms, size_t k) const;
+    std::vector<SearchHit> rankImpactHits(const std::vector<TermInfo>& docIds, const std::vector<std::string>& terms,
+                                          size_t limit) const;
+    // Empty optional when some term has no impact-ordered list
+    std::optional<std::vector<SearchHit>> topKImpacts(const std::vector<std::string>& terms, size_t k) const;
     std::vector<std::pair<std::string, double>> processResults(const std::vector<TermInfo>& docIds,
-                                                               const std::vector<std::string>& terms) override;
+                                                               const std::vector<std::string>& terms) const override;
 };
\ No newline at end of file
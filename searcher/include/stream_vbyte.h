@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// StreamVByte: 2-bit length codes for four integers are packed into one control byte, the
+// integer bytes follow in a separate data stream. That layout lets a whole group be decoded
+// with a single shuffle instead of the byte-at-a-time branches of classic varint.
+namespace StreamVByte {
+
+// Decoders load 16 bytes at a time and may read up to PADDING bytes past the encoded data,
+// so the caller must keep that much readable memory after it
+constexpr size_t PADDING = 16;
+
+// Bytes needed to encode `count` values
+size_t encodedSize(const uint32_t* in, uint32_t count);
+// Same as encodedSize for the deltas in[i] - in[i - 1], starting from `prev`
+size_t encodedDeltaSize(const uint32_t* in, uint32_t count, uint32_t prev);
+
+// Both return the number of bytes written to out
+size_t encode(const uint32_t* in, uint32_t count, uint8_t* out);
+size_t encodeDelta(const uint32_t* in, uint32_t count, uint32_t prev, uint8_t* out);
+
+// Both return the pointer just past the consumed bytes
+const uint8_t* decode(const uint8_t* in, uint32_t count, uint32_t* out);
+const uint8_t* decodeDelta(const uint8_t* in, uint32_t count, uint32_t prev, uint32_t* out);
+
+// Portable versions, exposed so tests and benchmarks can compare them with the SIMD path
+const uint8_t* decodeScalar(const uint8_t* in, uint32_t count, uint32_t* out);
+const uint8_t* decodeDeltaScalar(const uint8_t* in, uint32_t count, uint32_t prev, uint32_t* out);
+
+bool simdAvailable();
+
+}  // namespace StreamVByte
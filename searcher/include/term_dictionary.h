@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Lexicographically sorted term dictionary with front coding. Terms are grouped in blocks of
+// BLOCK_SIZE, each term stores only the suffix that differs from the previous one; the first
+// term of a block is stored whole, so the block offsets double as a sparse index for binary search.
+namespace FrontCoding {
+
+const uint32_t BLOCK_SIZE = 16;
+
+// Section layout: Header, uint32_t block_offsets[num_blocks], then the blocks. A term is
+// varint shared_len, varint suffix_len, suffix bytes, varint entry (index into the TermEntry directory)
+struct Header {
+    uint32_t num_terms;
+    uint32_t num_blocks;
+};
+
+// sorted_terms must be sorted and unique, entries[i] is the directory index of sorted_terms[i]
+std::string encode(const std::vector<std::string_view>& sorted_terms, const std::vector<uint32_t>& entries);
+
+class Reader {
+    const Header* header = nullptr;
+    const uint32_t* block_offsets = nullptr;
+    const char* blocks = nullptr;
+
+    std::string_view firstTerm(uint32_t block) const;
+
+public:
+    Reader() = default;
+    explicit Reader(const char* section);
+
+    bool valid() const { return header != nullptr; }
+    uint32_t size() const { return header ? header->num_terms : 0; }
+
+    // Compares the term at `ordinal` against `term` without materializing it
+    bool equals(uint32_t ordinal, std::string_view term) const;
+    std::string termAt(uint32_t ordinal) const;
+
+    // Terms starting with prefix in lexicographic order with their entry index, at most `limit`
+    std::vector<std::pair<std::string, uint32_t>> prefixRange(std::string_view prefix, size_t limit) const;
+};
+
+}  // namespace FrontCoding
@@ -4,6 +4,7 @@
 #include <string_view>
 #include <vector>
 
+// stem may be called from several threads at once, implementations keep no per-word state in members
 class IStemmer {
 public:
     virtual ~IStemmer() = default;
@@ -44,6 +45,8 @@ private:
 
     void step5();
 
+    void run(std::string& input_word);
+
 public:
     void stem(std::string& input_word) override;
     PorterStemmer() = default;
@@ -65,6 +68,9 @@ public:
     Tokenizer(std::unique_ptr<IStemmer> stemmer);
     Tokenizer();
     virtual void tokenize(const std::string_view& text);
+    // Reentrant version: appends the tokens to `out` and returns their total length before stemming.
+    // Nothing is stored in the tokenizer, so one instance can serve any number of threads.
+    size_t tokenize(std::string_view text, std::vector<std::string>& out) const;
     virtual std::vector<std::string> getRawTokens(const std::string_view& text) const;
 
     std::vector<std::string> getTokens() const;
@@ -1,20 +1,39 @@
 #include "searcher.h"
 
 #include <cxxopts.hpp>
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include <mongocxx/instance.hpp>
 #include <string>
 
 #include "db_downloader.h"
+#include "external_index.h"
 #include "indexator.h"
 #include "tokenizer.h"
 
 int main(int argc, char* argv[]) {
     cxxopts::Options options("searcher", "Searcher");
 
-    options.add_options()("z,zip", "Compress index")("i,index", "Build index")("limit", "Download limit",
-                                                                               cxxopts::value<int>()->default_value("1000000"))(
+    options.add_options()("z,zip", "Compress index")("b,blocks", "Block-structured index with skip data (v3)")(
+        "format", "Posting format: 1 raw, 2 varint, 3 blocked, 4 stream vbyte", cxxopts::value<int>())(
+        "mph", "Add minimal perfect hash term dictionary")("front-coding", "Sorted front-coded term dictionary (prefix queries)")(
+        "block-max", "Store per-block max tf for top-k pruning")("bitmaps", "Store dense terms as Roaring bitmaps")(
+        "impacts", "Store 8-bit impact-ordered postings and rank with them")(
+        "exhaustive", "Rank every matching document instead of top-k")(
+        "cache", "Result cache size in queries, 0 disables it", cxxopts::value<size_t>())("i,index", "Build index")(
+        "populate", "Read the whole index into the page cache at open")(
+        "advice", "madvise for postings: random, sequential or willneed", cxxopts::value<std::string>())(
+        "mlock-dict", "Lock the term dictionary in memory")(
+        "mlock-top", "Lock the N longest posting lists", cxxopts::value<uint32_t>())(
+        "huge-pages", "Advise transparent huge pages for the mapping")(
+        "batch", "Run the queries of a file (one per line) as one batch and report throughput",
+        cxxopts::value<std::string>())(
+        "threads", "Batch and index build worker threads, 0 for all cores", cxxopts::value<unsigned>()->default_value("0"))(
+        "indexers", "Index build threads, each filling its own shards", cxxopts::value<unsigned>()->default_value("1"))(
+        "memory-budget", "Build in spilled runs of this many megabytes and merge them", cxxopts::value<uint64_t>())(
+        "posting-cache", "Megabytes of decoded posting lists to keep for hot terms", cxxopts::value<size_t>())(
+        "limit", "Download limit", cxxopts::value<int>()->default_value("1000000"))(
         "dump", "Dump path", cxxopts::value<std::string>()->default_value("../dump.idx"))("h,help", "Print help");
 
     auto r = options.parse(argc, argv);
@@ -26,6 +45,23 @@ int main(int argc, char* argv[]) {
 
     bool build_index = r.count("index") > 0;
     bool zip = r.count("zip") > 0;
+    BinaryFormat::DumpOptions dump_options;
+    dump_options.format = zip ? BinaryFormat::PostingFormat::VarInt : BinaryFormat::PostingFormat::Raw;
+    if (r.count("blocks")) dump_options.format = BinaryFormat::PostingFormat::Blocked;
+    if (r.count("format")) {
+        int format = r["format"].as<int>();
+        if (format < 1 || format > 4) {
+            std::cerr << "--format must be 1-4, got " << format << "\n";
+            return 1;
+        }
+        dump_options.format = (BinaryFormat::PostingFormat)format;
+    }
+    dump_options.perfect_hash = r.count("mph") > 0;
+    dump_options.front_coded_terms = r.count("front-coding") > 0;
+    dump_options.block_max = r.count("block-max") > 0;
+    dump_options.bitmap_containers = r.count("bitmaps") > 0;
+    dump_options.impact_ordered = r.count("impacts") > 0;
+    bool exhaustive = r.count("exhaustive") > 0;
     int limit = r["limit"].as<int>();
     std::string dump_path = r["dump"].as<std::string>();
 
@@ -33,33 +69,98 @@ int main(int argc, char* argv[]) {
     auto stemmer = std::make_unique<PorterStemmer>();
     auto tokenizer = std::make_shared<Tokenizer>(std::move(stemmer));
     auto source = std::make_shared<RamIndexSource>();
-    auto indexator = std::make_shared<TFIDFIndexator>(source, tokenizer);
+    std::shared_ptr<IIndexator> indexator = std::make_shared<TFIDFIndexator>(source, tokenizer);
     if (build_index) {
         mongocxx::instance inst{};
+        auto factory = [&](std::shared_ptr<RamIndexSource> shard) { return std::make_shared<TFIDFIndexator>(shard, tokenizer); };
+        std::shared_ptr<ExternalIndexBuilder> builder;
+        if (r.count("memory-budget")) {
+            builder = std::make_shared<ExternalIndexBuilder>(
+                factory, ExternalIndexBuilder::Options{r["memory-budget"].as<uint64_t>() << 20, "/tmp"});
+            indexator = builder;
+        }
         DocumentDownloader downloader("mongodb://localhost:27017", indexator);
 
         std::cout << "Started downloading documents\n";
         auto start_time = std::chrono::high_resolution_clock::now();
-        downloader.downloadDocuments(limit);
+        unsigned indexers = r["indexers"].as<unsigned>();
+        std::vector<std::shared_ptr<RamIndexSource>> shards;
+        if (indexers > 1 && !builder) {
+            shards = downloader.downloadShards(factory, limit, r["threads"].as<unsigned>(), indexers);
+        } else {
+            downloader.downloadDocuments(limit, r["threads"].as<unsigned>());
+        }
         auto end_time = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double> duration = end_time - start_time;
         std::cout << "Total time: " << duration.count() << " sec\n";
 
-        start_time = std::chrono::high_resolution_clock::now();
-        source->dump(dump_path, zip);
-        end_time = std::chrono::high_resolution_clock::now();
-        duration = end_time - start_time;
-        std::cout << "Index dumped in " << duration.count() << " sec!\n";
+        BinaryFormat::DumpStats stats;
+        if (builder) {
+            stats = builder->finish(dump_path, dump_options);
+            std::cout << builder->stats().runs << " runs, " << builder->stats().run_bytes / (1024.0 * 1024.0)
+                      << " MB spilled\n";
+        } else if (!shards.empty()) {
+            stats = RamIndexSource::dumpShards(shards, dump_path, dump_options);
+        } else {
+            stats = source->dump(dump_path, dump_options);
+        }
+        std::cout << "Index dumped in " << stats.seconds << " sec (" << stats.bytes / (1024.0 * 1024.0) << " MB, "
+                  << stats.megabytesPerSecond() << " MB/s)!\n";
+    }
+    LoadOptions load_options;
+    load_options.populate = r.count("populate") > 0;
+    load_options.dictionary_advice = LoadOptions::Advice::Random;
+    if (r.count("advice")) {
+        std::string advice = r["advice"].as<std::string>();
+        if (advice == "random") load_options.postings_advice = LoadOptions::Advice::Random;
+        if (advice == "sequential") load_options.postings_advice = LoadOptions::Advice::Sequential;
+        if (advice == "willneed") load_options.postings_advice = LoadOptions::Advice::WillNeed;
     }
-    auto mapped_source = std::make_shared<MappedIndexSource>(dump_path);
+    load_options.lock_dictionary = r.count("mlock-dict") > 0;
+    if (r.count("mlock-top")) load_options.lock_top_postings = r["mlock-top"].as<uint32_t>();
+    load_options.huge_pages = r.count("huge-pages") > 0;
+    if (r.count("posting-cache")) load_options.posting_cache_bytes = r["posting-cache"].as<size_t>() << 20;
+
+    auto mapped_source = std::make_shared<MappedIndexSource>(dump_path, load_options);
+    ResidencyReport residency = mapped_source->residency();
+    std::cout << "Resident: dictionary " << residency.dictionary.coverage() * 100 << "%, postings "
+              << residency.postings.coverage() * 100 << "%, total " << residency.total.coverage() * 100 << "% ("
+              << residency.total.resident << "/" << residency.total.pages << " pages), locked " << residency.locked_bytes
+              << " bytes";
+    if (residency.lock_failures) std::cout << ", " << residency.lock_failures << " mlock calls refused";
+    std::cout << "\n";
     TFIDFSearcher searcher(mapped_source, tokenizer);
+    if (r.count("cache")) searcher.setResultCacheCapacity(r["cache"].as<size_t>());
+    searcher.setImpactScoring(r.count("impacts") > 0);
+    if (r.count("batch")) {
+        std::ifstream in(r["batch"].as<std::string>());
+        std::vector<std::string> queries;
+        for (std::string line; std::getline(in, line);) {
+            if (!line.empty()) queries.push_back(line);
+        }
+        BatchResult batch = searcher.findDocuments(queries, 10, r["threads"].as<unsigned>());
+        const BatchStats& stats = batch.stats;
+        std::cout << "Batch: " << stats.queries << " queries in " << stats.seconds << " sec, " << stats.queriesPerSecond()
+                  << " queries/sec\n";
+        std::cout << "Terms: " << stats.distinct_terms << " distinct, " << stats.decoded_terms << " shared lists ("
+                  << stats.decoded_postings << " postings) decoded in " << stats.decode_seconds << " sec\n";
+        return 0;
+    }
     while (true) {
         std::cout << "Enter query: ";
         std::string request;
         std::getline(std::cin, request);
 
         auto start_time = std::chrono::high_resolution_clock::now();
-        auto result = searcher.findDocument(request);
+        std::vector<std::pair<std::string, double>> result;
+        if (exhaustive) {
+            result = searcher.findDocument(request);
+        } else {
+            // Only the shown page gets its URLs resolved
+            for (const auto& hit : searcher.findDocument(request, 10)) {
+                result.push_back({std::string(searcher.getUrl(hit.doc_id)), hit.score});
+            }
+        }
         auto end_time = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double> duration = end_time - start_time;
 
@@ -69,5 +170,10 @@ int main(int argc, char* argv[]) {
         }
         std::cout << "Query time: " << duration.count() << " sec\n";
         std::cout << "Number of results: " << result.size() << " items\n";
+        auto cache = searcher.resultCacheStats();
+        std::cout << "Result cache: " << cache.hits << " hits, " << cache.misses << " misses\n";
+        auto postings = mapped_source->postingCacheStats();
+        std::cout << "Posting cache: " << postings.hits << " hits, " << postings.misses << " misses, " << postings.bytes
+                  << " bytes\n";
     }
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <unordered_map>
 
 #include "indexator.h"
+#include "indexing_pipeline.h"
 #include "tokenizer.h"
 
 DocumentDownloader::DocumentDownloader(const std::string& uri, std::shared_ptr<IIndexator> idxator)
@@ -14,27 +15,39 @@ DocumentDownloader::DocumentDownloader(const std::string& uri, std::shared_ptr<I
 using bsoncxx::builder::stream::document;
 using bsoncxx::builder::stream::finalize;
 
-void DocumentDownloader::downloadDocuments(int max_documents) {
-    std::vector<Document> documents;
+static void print_stage(const char* name, const StageStats& stage) {
+    std::clog << name << ": " << stage.items << " docs on " << stage.threads << " thread(s), " << stage.busy_seconds
+              << " s busy, " << stage.itemsPerSecond() << " docs/s, queue depth avg " << stage.avg_depth << " max "
+              << stage.max_depth << std::endl;
+}
+
+void DocumentDownloader::htmlToText(std::string_view html, std::string& content) {
+    GumboOutput* output = gumbo_parse_with_options(&kGumboDefaultOptions, html.data(), html.length());
+    extractText(output->root, content);
+    cleanText(content);
+    gumbo_destroy_output(&kGumboDefaultOptions, output);
+}
 
+IndexingPipeline::Extractor DocumentDownloader::htmlExtractor() {
+    return [this](const std::string& html, std::string& content) {
+        content.reserve(html.length() / 5);
+        htmlToText(html, content);
+    };
+}
+
+// This thread only reads the cursor; HTML parsing, tokenizing and indexing run on the pipeline threads
+void DocumentDownloader::feed(IndexingPipeline& pipeline, int max_documents) {
     auto db = client["sports_corpus"];
     auto coll = db["documents"];
 
     auto projection = document{} << "normalized_url" << 1 << "html_content" << 1 << "_id" << 0 << finalize;
 
-    int64_t count = coll.count_documents({});
-    if (count > 0) {
-        documents.reserve(static_cast<std::size_t>(count));
-    }
-
     mongocxx::options::find opts;
     opts.projection(projection.view());
 
     auto cursor = coll.find({}, opts);
     int counter = 0;
     uint64_t total_downloaded_bytes = 0;
-    uint64_t total_content_bytes = 0;
-    double total_indexate_time = 0.;
 
     for (auto&& doc : cursor) {
         auto url_ele = doc["normalized_url"];
@@ -42,37 +55,44 @@ void DocumentDownloader::downloadDocuments(int max_documents) {
 
         if (url_ele && content_ele && url_ele.type() == bsoncxx::type::k_string &&
             content_ele.type() == bsoncxx::type::k_string) {
-            std::string url = std::string(url_ele.get_string().value);
             std::string html = std::string(content_ele.get_string().value);
-            GumboOutput* output = gumbo_parse(html.c_str());
-
-            std::string content;
-            content.reserve(html.length() / 5);
-            extractText(output->root, content);
-            cleanText(content);
-
-            auto start_time = std::chrono::high_resolution_clock::now();
-            indexator->addDocument(url, content);
-            auto end_time = std::chrono::high_resolution_clock::now();
-            std::chrono::duration<double> duration = end_time - start_time;
-            total_indexate_time += duration.count();
-
             total_downloaded_bytes += html.size();
-            total_content_bytes += content.size();
-            std::clog << "\rDownloaded: " << counter++ << " docs";
-            gumbo_destroy_output(&kGumboDefaultOptions, output);
+            pipeline.push(std::string(url_ele.get_string().value), std::move(html));
+            if (++counter % 100 == 0) {
+                std::clog << "\rDownloaded: " << counter << " docs";
+            }
             if (counter == max_documents) {
                 break;
             }
         }
     }
-    double speed_kb_s = (total_content_bytes / 1024.0) / total_indexate_time;
+    PipelineStats stats = pipeline.finish();
 
-    std::clog << "\nFinished. Total docs: " << counter << std::endl;
-    std::clog << "Total indexate time: " << total_indexate_time << std::endl;
-    std::clog << "Speed indexate: " << speed_kb_s << std::endl;
+    std::clog << "\nFinished. Total docs: " << counter << " in " << stats.seconds << " s" << std::endl;
+    print_stage("Read", stats.read);
+    print_stage("Parse", stats.parse);
+    print_stage("Index", stats.index);
+    std::clog << "Reorder buffer max: " << stats.max_reorder << " docs" << std::endl;
     std::cout << "Total downloaded bytes: " << total_downloaded_bytes / 1024.0 / 1024.0 << " MB\n";
-    std::cout << "Total indexated bytes: " << total_content_bytes / 1024.0 / 1024.0 << " MB\n";
+    std::cout << "Parse speed: " << stats.parse.megabytesPerSecond() << " MB/s per worker\n";
+}
+
+void DocumentDownloader::downloadDocuments(int max_documents, unsigned workers) {
+    IndexingPipeline::Options options;
+    options.workers = workers;
+    IndexingPipeline pipeline(indexator, htmlExtractor(), options);
+    feed(pipeline, max_documents);
+}
+
+std::vector<std::shared_ptr<RamIndexSource>> DocumentDownloader::downloadShards(IndexingPipeline::IndexatorFactory factory,
+                                                                                int max_documents, unsigned workers,
+                                                                                unsigned indexers) {
+    IndexingPipeline::Options options;
+    options.workers = workers;
+    options.indexers = indexers;
+    IndexingPipeline pipeline(std::move(factory), htmlExtractor(), options);
+    feed(pipeline, max_documents);
+    return pipeline.shards();
 }
 
 void DocumentDownloader::downloadDocumentsWithonIndexation() {
@@ -105,11 +125,8 @@ void DocumentDownloader::downloadDocumentsWithonIndexation() {
             content_ele.type() == bsoncxx::type::k_string) {
             auto html_view = content_ele.get_string().value;
 
-            GumboOutput* output = gumbo_parse_with_options(&kGumboDefaultOptions, html_view.data(), html_view.length());
-
             content.clear();
-            extractText(output->root, content);
-            cleanText(content);
+            htmlToText(html_view, content);
 
             auto start_time = std::chrono::high_resolution_clock::now();
 
@@ -126,8 +143,6 @@ void DocumentDownloader::downloadDocumentsWithonIndexation() {
             if (++counter % 100 == 0) {
                 std::clog << "\rProcessed: " << counter << " docs";
             }
-
-            gumbo_destroy_output(&kGumboDefaultOptions, output);
         }
     }
 
@@ -0,0 +1,376 @@
+#include "external_index.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <queue>
+#include <stdexcept>
+
+using Clock = std::chrono::steady_clock;
+
+static const size_t RUN_BUFFER_SIZE = 1 << 20;
+// Temp files are only read or written front to back, a small buffer each is enough
+static const size_t SPILL_BUFFER_SIZE = 1 << 16;
+
+static double seconds_since(Clock::time_point start) { return std::chrono::duration<double>(Clock::now() - start).count(); }
+
+template <typename T>
+static void write_pod(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static bool read_pod(std::istream& in, T& value) {
+    return (bool)in.read(reinterpret_cast<char*>(&value), sizeof(value));
+}
+
+namespace {
+// A temp file read or written front to back through its own buffer
+template <typename Stream>
+struct SpillFile {
+    std::vector<char> io_buffer = std::vector<char>(SPILL_BUFFER_SIZE);
+    Stream stream;
+
+    SpillFile(const std::string& path, std::ios::openmode mode) {
+        stream.rdbuf()->pubsetbuf(io_buffer.data(), io_buffer.size());
+        stream.open(path, mode | std::ios::binary);
+        if (!stream) throw std::runtime_error("Cannot open " + path);
+    }
+};
+
+void copyFile(const std::string& path, std::ostream& out) {
+    SpillFile<std::ifstream> in(path, std::ios::in);
+    std::vector<char> buffer(SPILL_BUFFER_SIZE);
+    while (in.stream.read(buffer.data(), buffer.size()) || in.stream.gcount() > 0) out.write(buffer.data(), in.stream.gcount());
+}
+
+// Reads a mapped run term by term. A run file is a sequence of
+// [uint32 hash][uint32 term length][term][uint32 doc count][uint32 payload bytes][varint (doc delta, tf) pairs]
+// in directory order, with doc ids already global. The term and the payload are read in place.
+class RunReader {
+public:
+    uint32_t hash = 0;
+    std::string_view term;
+    uint32_t count = 0;
+    const char* payload = nullptr;
+
+    explicit RunReader(const std::string& path) {
+        fd = open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1) throw std::runtime_error("Cannot open run " + path);
+        size = st.st_size;
+        if (size > 0) {
+            void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) throw std::runtime_error("Cannot map run " + path);
+            data = static_cast<const char*>(addr);
+            madvise(addr, size, MADV_SEQUENTIAL);
+        }
+        ptr = data;
+    }
+    ~RunReader() {
+        if (data) munmap((void*)data, size);
+        if (fd != -1) close(fd);
+    }
+    RunReader(const RunReader&) = delete;
+    RunReader& operator=(const RunReader&) = delete;
+
+    // False at the end of the run
+    bool next() {
+        if (ptr == data + size) return false;
+        uint32_t length = read();
+        hash = length;
+        length = read();
+        need(length);
+        term = {ptr, length};
+        ptr += length;
+        count = read();
+        uint32_t bytes = read();
+        need(bytes);
+        payload = ptr;
+        ptr += bytes;
+        return true;
+    }
+
+private:
+    int fd = -1;
+    size_t size = 0;
+    const char* data = nullptr;
+    const char* ptr = nullptr;
+
+    void need(size_t bytes) const {
+        if ((size_t)(data + size - ptr) < bytes) throw std::runtime_error("Truncated run");
+    }
+    uint32_t read() {
+        uint32_t value;
+        need(sizeof(value));
+        std::memcpy(&value, ptr, sizeof(value));
+        ptr += sizeof(value);
+        return value;
+    }
+};
+}  // namespace
+
+ExternalIndexBuilder::ExternalIndexBuilder(IndexatorFactory factory, Options opts)
+    : IIndexator(nullptr, nullptr), make_indexator(std::move(factory)), options(std::move(opts)) {
+    // A directory only this builder can enter, so no other user can predict or plant the temp file names
+    std::string pattern = options.temp_dir + "/web_spider_spimi_XXXXXX";
+    if (!mkdtemp(pattern.data())) throw std::runtime_error("Cannot create a temp directory in " + options.temp_dir);
+    work_dir = pattern;
+    run_source = std::make_shared<RamIndexSource>();
+    run = make_indexator(run_source);
+    tokenizer = run->sharedTokenizer();
+}
+
+ExternalIndexBuilder::~ExternalIndexBuilder() { removeTempFiles(); }
+
+void ExternalIndexBuilder::addDocument(const std::string_view& url_view, const std::string_view& doc_view) {
+    run->addDocument(url_view, doc_view);
+    flushIfFull();
+}
+
+void ExternalIndexBuilder::addTokens(const std::string_view& url_view, const std::vector<std::string>& tokens) {
+    run->addTokens(url_view, tokens);
+    flushIfFull();
+}
+
+void ExternalIndexBuilder::processTokens(const std::vector<std::string>& tokens, int doc_id) {
+    run->processTokens(tokens, doc_id);
+}
+
+void ExternalIndexBuilder::flushIfFull() {
+    if (run_source->memoryUsage() >= options.memory_budget) flush();
+}
+
+void ExternalIndexBuilder::flush() {
+    const uint32_t run_docs = run_source->getTotalDocs();
+    if (run_docs == 0) return;
+    auto start = Clock::now();
+    const uint32_t base = build_stats.docs;
+
+    {
+        SpillFile<std::ofstream> urls(tempFile("urls"), std::ios::out | std::ios::app);
+        SpillFile<std::ofstream> lengths(tempFile("lengths"), std::ios::out | std::ios::app);
+        for (uint32_t d = 0; d < run_docs; ++d) {
+            const std::string& url = run_source->urls[d];
+            write_pod(urls.stream, (uint32_t)url.size());
+            urls.stream.write(url.data(), url.size());
+            write_pod(lengths.stream, d < run_source->doc_lengths.size() ? run_source->doc_lengths[d] : 0u);
+        }
+        urls.stream.close();
+        lengths.stream.close();
+        if (!urls.stream || !lengths.stream) throw std::runtime_error("Failed to write the documents of a run");
+    }
+    total_tokens += run_source->total_tokens;
+
+    struct RunTerm {
+        uint32_t hash;
+        const std::string* term;
+        const std::vector<TermInfo>* docs;
+    };
+    std::vector<RunTerm> terms;
+    run_source->index.traverse([&](const std::string& term, const std::vector<TermInfo>& docs) {
+        if (!docs.empty()) terms.push_back({stringHash(term), &term, &docs});
+    });
+    std::sort(terms.begin(), terms.end(), [](const RunTerm& a, const RunTerm& b) {
+        return a.hash != b.hash ? a.hash < b.hash : *a.term < *b.term;
+    });
+
+    std::string path = tempFile(std::to_string(run_files.size()) + ".run");
+    run_files.push_back(path);
+    std::vector<char> io_buffer(RUN_BUFFER_SIZE);
+    std::ofstream out;
+    out.rdbuf()->pubsetbuf(io_buffer.data(), io_buffer.size());
+    out.open(path, std::ios::binary);
+    if (!out) throw std::runtime_error("Cannot open run " + path);
+
+    std::string payload;
+    for (const auto& t : terms) {
+        payload.clear();
+        uint32_t prev_id = 0;
+        for (const auto& p : *t.docs) {
+            appendVarInt(payload, base + p.doc_id - prev_id);
+            appendVarInt(payload, p.tf);
+            prev_id = base + p.doc_id;
+        }
+        write_pod(out, t.hash);
+        write_pod(out, (uint32_t)t.term->size());
+        out.write(t.term->data(), t.term->size());
+        write_pod(out, (uint32_t)t.docs->size());
+        write_pod(out, (uint32_t)payload.size());
+        out.write(payload.data(), payload.size());
+    }
+    build_stats.run_bytes += (uint64_t)out.tellp();
+    out.close();
+    if (!out) throw std::runtime_error("Failed to write run " + path);
+
+    build_stats.runs++;
+    build_stats.docs += run_docs;
+    build_stats.peak_memory = std::max(build_stats.peak_memory, run_source->memoryUsage());
+    run_source = std::make_shared<RamIndexSource>();
+    run = make_indexator(run_source);
+    build_stats.flush_seconds += seconds_since(start);
+}
+
+BinaryFormat::DumpStats ExternalIndexBuilder::finish(const std::string& file, const BinaryFormat::DumpOptions& dump_options) {
+    if (dump_options.impacts || dump_options.impact_ordered) {
+        throw std::invalid_argument("Impact sections are not supported by the external build");
+    }
+    flush();
+    auto start = Clock::now();
+
+    std::vector<std::unique_ptr<RunReader>> readers;
+    for (const auto& path : run_files) readers.push_back(std::make_unique<RunReader>(path));
+
+    // Runs hold consecutive doc ranges, so equal terms are taken in run order
+    auto later = [&](size_t a, size_t b) {
+        const RunReader& x = *readers[a];
+        const RunReader& y = *readers[b];
+        if (x.hash != y.hash) return x.hash > y.hash;
+        if (x.term != y.term) return x.term > y.term;
+        return a > b;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heads(later);
+    for (size_t r = 0; r < readers.size(); ++r) {
+        if (readers[r]->next()) heads.push(r);
+    }
+
+    IndexWriter::Layout layout;
+    layout.num_docs = build_stats.docs;
+    layout.total_tokens = total_tokens;
+
+    // The parts of the term being merged, one per run that has it, in doc order
+    struct Part {
+        const char* payload;
+        uint32_t count;
+    };
+    std::vector<Part> parts;
+    IndexWriter::ListBlocks blocks = [&](const auto& visit) {
+        TermInfo block[BinaryFormat::BLOCK_SIZE];
+        uint32_t n = 0;
+        for (const Part& part : parts) {
+            const char* ptr = part.payload;
+            uint32_t doc_id = 0;
+            for (uint32_t i = 0; i < part.count; ++i) {
+                doc_id += readVarInt(ptr);
+                block[n++] = {doc_id, readVarInt(ptr)};
+                if (n == BinaryFormat::BLOCK_SIZE) {
+                    visit(block, n);
+                    n = 0;
+                }
+            }
+        }
+        if (n > 0) visit(block, n);
+    };
+
+    // Encoded lists go to a temp file because the directory, which needs their sizes, comes first in the
+    // index; the directory entries and block maxes follow them into temp files of their own
+    {
+        SpillFile<std::ofstream> postings(tempFile("postings"), std::ios::out);
+        SpillFile<std::ofstream> terms(tempFile("terms"), std::ios::out);
+        std::unique_ptr<SpillFile<std::ofstream>> block_maxes;
+        if (dump_options.block_max) block_maxes = std::make_unique<SpillFile<std::ofstream>>(tempFile("blocks"), std::ios::out);
+
+        while (!heads.empty()) {
+            const RunReader& first = *readers[heads.top()];
+            const uint32_t hash = first.hash;
+            const std::string_view term = first.term;
+            uint64_t doc_count = 0;
+            parts.clear();
+            while (!heads.empty() && readers[heads.top()]->hash == hash && readers[heads.top()]->term == term) {
+                size_t r = heads.top();
+                heads.pop();
+                parts.push_back({readers[r]->payload, readers[r]->count});
+                doc_count += readers[r]->count;
+                // The run stays mapped, so term and the payloads remain valid after next()
+                if (readers[r]->next()) heads.push(r);
+            }
+            const char* head = parts[0].payload;
+            readVarInt(head);
+            if (!IndexWriter::keepTerm(doc_count, readVarInt(head), layout.num_docs)) continue;
+
+            uint64_t collection_freq = 0;
+            blocks([&](const TermInfo* docs, uint32_t n) {
+                for (uint32_t i = 0; i < n; ++i) collection_freq += docs[i].tf;
+                if (block_maxes) write_pod(block_maxes->stream, IndexWriter::blockMax(docs, n));
+            });
+            IndexWriter::WrittenList list =
+                IndexWriter::writeList(blocks, (uint32_t)doc_count, layout.num_docs, dump_options, postings.stream);
+
+            write_pod(terms.stream, hash);
+            write_pod(terms.stream, (uint32_t)doc_count);
+            write_pod(terms.stream, (uint32_t)std::min<uint64_t>(collection_freq, UINT32_MAX));
+            write_pod(terms.stream, list.bytes);
+            write_pod(terms.stream, (uint8_t)list.bitmap);
+            write_pod(terms.stream, (uint32_t)term.size());
+            terms.stream.write(term.data(), term.size());
+            ++layout.num_terms;
+        }
+        readers.clear();
+        postings.stream.close();
+        terms.stream.close();
+        if (block_maxes) block_maxes->stream.close();
+        if (!postings.stream || !terms.stream || (block_maxes && !block_maxes->stream)) {
+            throw std::runtime_error("Failed to write the merged lists");
+        }
+    }
+
+    layout.for_each_doc_length = [&](const std::function<void(uint32_t)>& visit) {
+        SpillFile<std::ifstream> lengths(tempFile("lengths"), std::ios::in);
+        uint32_t length;
+        while (read_pod(lengths.stream, length)) visit(length);
+    };
+    layout.for_each_url = [&](const std::function<void(std::string_view)>& visit) {
+        SpillFile<std::ifstream> urls(tempFile("urls"), std::ios::in);
+        std::string url;
+        uint32_t length;
+        while (read_pod(urls.stream, length)) {
+            url.resize(length);
+            urls.stream.read(url.data(), length);
+            visit(url);
+        }
+    };
+    layout.for_each_term = [&](const std::function<void(const IndexWriter::Term&)>& visit) {
+        SpillFile<std::ifstream> terms(tempFile("terms"), std::ios::in);
+        std::string term;
+        IndexWriter::Term t;
+        uint8_t bitmap;
+        uint32_t length;
+        while (read_pod(terms.stream, t.hash)) {
+            read_pod(terms.stream, t.doc_count);
+            read_pod(terms.stream, t.collection_freq);
+            read_pod(terms.stream, t.bytes);
+            read_pod(terms.stream, bitmap);
+            read_pod(terms.stream, length);
+            term.resize(length);
+            if (!terms.stream.read(term.data(), length)) throw std::runtime_error("Truncated term spill");
+            t.bitmap = bitmap != 0;
+            t.term = term;
+            visit(t);
+        }
+    };
+    layout.write_block_maxes = [&](std::ostream& out) { copyFile(tempFile("blocks"), out); };
+    layout.write_postings = [&](std::ostream& out) { copyFile(tempFile("postings"), out); };
+
+    BinaryFormat::DumpStats stats = IndexWriter::writeIndexFile(file, dump_options, layout);
+    build_stats.merge_seconds = seconds_since(start);
+    stats.seconds = build_stats.merge_seconds;
+    removeTempFiles();
+    return stats;
+}
+
+void ExternalIndexBuilder::removeTempFiles() {
+    if (work_dir.empty()) return;
+    for (const auto& path : run_files) std::remove(path.c_str());
+    run_files.clear();
+    for (const char* name : {"urls", "lengths", "postings", "terms", "blocks"}) std::remove(tempFile(name).c_str());
+    rmdir(work_dir.c_str());
+    work_dir.clear();
+}
@@ -0,0 +1,24 @@
+#include "eytzinger.h"
+
+namespace Eytzinger {
+
+namespace {
+
+// In-order walk of the implicit tree hands out the sorted keys one by one
+uint32_t fill(const uint32_t* sorted, uint32_t n, uint32_t* keys, uint32_t* ranks, uint32_t next, uint64_t k) {
+    if (k > n) return next;
+    next = fill(sorted, n, keys, ranks, next, 2 * k);
+    keys[k] = sorted[next];
+    ranks[k] = next++;
+    return fill(sorted, n, keys, ranks, next, 2 * k + 1);
+}
+
+}  // namespace
+
+void build(const uint32_t* sorted, uint32_t n, std::vector<uint32_t>& keys, std::vector<uint32_t>& ranks) {
+    keys.assign(n + 1, 0);
+    ranks.assign(n + 1, 0);
+    fill(sorted, n, keys.data(), ranks.data(), 0, 1);
+}
+
+}  // namespace Eytzinger
@@ -6,12 +6,29 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
 #include <cstring>
+#include <deque>
 #include <fstream>
 #include <iostream>
+#include <numeric>
+#include <queue>
 #include <span>
 #include <string_view>
+#include <thread>
+#include <utility>
+
+#include "eytzinger.h"
+#include "roaring.h"
+#include "stream_vbyte.h"
+
+static const size_t WRITE_BUFFER_SIZE = 1 << 20;
+static const size_t DUMP_CHUNK_TERMS = 256;
+// Terms in fewer than 1 / BITMAP_MIN_DENSITY of the docs are never smaller as bitmaps
+static const size_t BITMAP_MIN_DENSITY = 32;
 
 uint32_t stringHash(std::string_view str) {
     uint32_t hash = 2166136261u;
@@ -30,6 +47,14 @@ void writeVarInt(std::ofstream& out, uint32_t value) {
     out.put((char)value);
 }
 
+void appendVarInt(std::string& out, uint32_t value) {
+    while (value >= 128) {
+        out.push_back((char)((value & 127) | 128));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
 int getVarIntSize(uint32_t value) {
     int size = 1;
     while (value >= 128) {
@@ -51,157 +76,1191 @@ uint32_t readVarInt(const char*& ptr) {
     return value;
 }
 
-void RamIndexSource::addUrl(std::string_view url) { urls.emplace_back(url); }
+PostingCursor::PostingCursor(std::span<const TermInfo> postings)
+    : encoding(Encoding::Raw), window(postings.data()), len((uint32_t)postings.size()), count((uint32_t)postings.size()) {}
+
+PostingCursor PostingCursor::fromVarInt(const char* data, uint32_t count) {
+    PostingCursor cursor;
+    cursor.encoding = Encoding::VarInt;
+    cursor.stream = data;
+    cursor.count = count;
+    cursor.remaining = count;
+    cursor.refill();
+    return cursor;
+}
+
+PostingCursor PostingCursor::fromBlocks(const char* data, uint32_t count, bool stream_vbyte) {
+    PostingCursor cursor;
+    cursor.encoding = stream_vbyte ? Encoding::StreamVByte : Encoding::Blocked;
+    cursor.count = count;
+    cursor.num_blocks = (count + BinaryFormat::BLOCK_SIZE - 1) / BinaryFormat::BLOCK_SIZE;
+    cursor.blocks = reinterpret_cast<const BinaryFormat::BlockHeader*>(data);
+    cursor.stream = data + cursor.num_blocks * sizeof(BinaryFormat::BlockHeader);
+    cursor.refill();
+    return cursor;
+}
+
+PostingCursor PostingCursor::fromRoaring(const char* data) {
+    PostingCursor cursor;
+    cursor.encoding = Encoding::Roaring;
+    cursor.stream = data;
+    cursor.count = Roaring::Set(data).size();
+    cursor.num_blocks = (cursor.count + WINDOW_SIZE - 1) / WINDOW_SIZE;
+    cursor.refill();
+    return cursor;
+}
+
+PostingCursor PostingCursor::fromShared(std::shared_ptr<const std::vector<TermInfo>> postings) {
+    PostingCursor cursor{std::span<const TermInfo>(*postings)};
+    cursor.owner = std::move(postings);
+    return cursor;
+}
+
+PostingCursor::PostingCursor(const PostingCursor& other) { *this = other; }
+
+PostingCursor& PostingCursor::operator=(const PostingCursor& other) {
+    if (this == &other) return *this;
+    encoding = other.encoding;
+    pos = other.pos;
+    len = other.len;
+    count = other.count;
+    stream = other.stream;
+    remaining = other.remaining;
+    last_doc_id = other.last_doc_id;
+    blocks = other.blocks;
+    num_blocks = other.num_blocks;
+    next_block = other.next_block;
+    owner = other.owner;
+    if (other.window == other.buffer.data()) {
+        std::copy(other.buffer.begin(), other.buffer.begin() + other.len, buffer.begin());
+        window = buffer.data();
+    } else {
+        window = other.window;
+    }
+    return *this;
+}
+
+void PostingCursor::refill() {
+    pos = 0;
+    len = 0;
+    if (encoding == Encoding::Blocked || encoding == Encoding::StreamVByte || encoding == Encoding::Roaring) {
+        if (next_block < num_blocks) decodeBlock(next_block);
+        return;
+    }
+    if (encoding == Encoding::Raw || remaining == 0) return;
+
+    uint32_t n = std::min(remaining, WINDOW_SIZE);
+    const char* ptr = stream;
+    uint32_t doc_id = last_doc_id;
+    for (uint32_t i = 0; i < n; ++i) {
+        doc_id += readVarInt(ptr);
+        buffer[i] = {doc_id, readVarInt(ptr)};
+    }
+    stream = ptr;
+    last_doc_id = doc_id;
+    remaining -= n;
+    window = buffer.data();
+    len = n;
+}
+
+void PostingCursor::decodeBlock(uint32_t block) {
+    uint32_t n = std::min(count - block * BinaryFormat::BLOCK_SIZE, BinaryFormat::BLOCK_SIZE);
+    if (encoding == Encoding::Roaring) {
+        uint32_t doc_ids[BinaryFormat::BLOCK_SIZE];
+        uint32_t tfs[BinaryFormat::BLOCK_SIZE];
+        Roaring::Set set(stream);
+        set.decodeDocs(block * BinaryFormat::BLOCK_SIZE, n, doc_ids);
+        set.decodeTfs(block, n, tfs);
+        for (uint32_t i = 0; i < n; ++i) buffer[i] = {doc_ids[i], tfs[i]};
+        window = buffer.data();
+        pos = 0;
+        len = n;
+        next_block = block + 1;
+        return;
+    }
+    const char* ptr = stream + blocks[block].offset;
+    uint32_t doc_id = block > 0 ? blocks[block - 1].last_doc_id : 0;
+    if (encoding == Encoding::StreamVByte) {
+        uint32_t doc_ids[BinaryFormat::BLOCK_SIZE];
+        uint32_t tfs[BinaryFormat::BLOCK_SIZE];
+        auto* in = reinterpret_cast<const uint8_t*>(ptr);
+        in = StreamVByte::decodeDelta(in, n, doc_id, doc_ids);
+        StreamVByte::decode(in, n, tfs);
+        for (uint32_t i = 0; i < n; ++i) buffer[i] = {doc_ids[i], tfs[i]};
+    } else {
+        for (uint32_t i = 0; i < n; ++i) {
+            doc_id += readVarInt(ptr);
+            buffer[i] = {doc_id, readVarInt(ptr)};
+        }
+    }
+    window = buffer.data();
+    pos = 0;
+    len = n;
+    next_block = block + 1;
+}
+
+void PostingCursor::skipTo(uint32_t target) {
+    if (pos < len && window[len - 1].doc_id < target) {
+        if (encoding == Encoding::Blocked || encoding == Encoding::StreamVByte) {
+            // Skip data lets us jump over whole blocks without decoding them
+            auto* it = std::lower_bound(blocks + next_block, blocks + num_blocks, target,
+                                        [](const BinaryFormat::BlockHeader& b, uint32_t val) { return b.last_doc_id < val; });
+            pos = len = 0;
+            if (it == blocks + num_blocks) {
+                next_block = num_blocks;
+                return;
+            }
+            decodeBlock((uint32_t)(it - blocks));
+        } else if (encoding == Encoding::Roaring) {
+            // The set answers rank queries directly, only the window holding the target is decoded
+            uint32_t rank = Roaring::Set(stream).rank(target);
+            pos = len = 0;
+            if (rank >= count) {
+                next_block = num_blocks;
+                return;
+            }
+            decodeBlock(rank / WINDOW_SIZE);
+            pos = rank % WINDOW_SIZE;
+            return;
+        } else {
+            while (pos < len && window[len - 1].doc_id < target) {
+                pos = len;
+                refill();
+            }
+        }
+    }
+    if (pos >= len) return;
+
+    // Targets are usually close to the current position, so gallop before the binary search
+    uint32_t bound = 1;
+    while (pos + bound < len && window[pos + bound].doc_id < target) bound *= 2;
+    auto it = std::lower_bound(window + pos + bound / 2, window + std::min(pos + bound + 1, len), target,
+                               [](const TermInfo& info, uint32_t val) { return info.doc_id < val; });
+    pos = (uint32_t)(it - window);
+}
+
+std::vector<TermInfo> IIndexSource::getPostings(const std::string& term) const {
+    PostingCursor cursor = openCursor(term);
+    std::vector<TermInfo> results;
+    results.reserve(cursor.size());
+    for (; cursor.valid(); cursor.next()) results.push_back(cursor.current());
+    return results;
+}
+
+void RamIndexSource::addUrl(std::string_view url, uint32_t length) {
+    ++data_generation;
+    const size_t url_capacity = urls.capacity(), length_capacity = doc_lengths.capacity();
+    urls.emplace_back(url);
+    doc_lengths.push_back(length);
+    total_tokens += length;
+    memory_bytes += (urls.capacity() - url_capacity) * sizeof(std::string) + url.size() +
+                    (doc_lengths.capacity() - length_capacity) * sizeof(uint32_t);
+}
+
+uint64_t RamIndexSource::getCollectionFrequency(const std::string& term) const {
+    const auto* postings = index.find(term);
+    if (!postings) return 0;
+    uint64_t total = 0;
+    for (const auto& p : *postings) total += p.tf;
+    return total;
+}
+
+// Exact up to 31, then every code is about 1/16 larger than the previous one; code 255 is ~24M tokens
+static std::array<uint32_t, 256> docLengthTable() {
+    std::array<uint32_t, 256> table;
+    for (uint32_t c = 0; c < 256; ++c) {
+        table[c] = c < 32 ? c : std::max<uint32_t>(table[c - 1] + 1, (uint32_t)((uint64_t)table[c - 1] * 17 / 16));
+    }
+    return table;
+}
+
+// Largest code whose length does not exceed the real one
+static uint8_t quantizeDocLength(const std::array<uint32_t, 256>& table, uint32_t length) {
+    return (uint8_t)(std::upper_bound(table.begin(), table.end(), length) - table.begin() - 1);
+}
+
+std::vector<std::string> RamIndexSource::expandPrefix(std::string_view prefix, size_t limit) const {
+    std::vector<std::string> result;
+    index.traverse([&](const std::string& term, const std::vector<TermInfo>& docs) {
+        if (!docs.empty() && term.starts_with(prefix)) result.push_back(term);
+    });
+    std::sort(result.begin(), result.end());
+    if (result.size() > limit) result.resize(limit);
+    return result;
+}
 
 void RamIndexSource::addDocument(const std::string& token, uint32_t doc_id, uint32_t tf) {
+    ++data_generation;
     std::vector<TermInfo>& postings = index.get(token);
 
+    if (postings.empty()) memory_bytes += sizeof(HashNode<std::string, std::vector<TermInfo>>) + token.size();
     if (postings.empty() || postings.back().doc_id != doc_id) {
+        const size_t capacity = postings.capacity();
         postings.push_back({doc_id, tf});
+        memory_bytes += (postings.capacity() - capacity) * sizeof(TermInfo);
     }
 }
 
-void RamIndexSource::dump(const std::string& filename, bool zip) {
-    std::ofstream ofs(filename, std::ios::binary);
-    if (!ofs) throw std::runtime_error("Cannot open file for writing");
+double tfWeight(uint32_t tf) {
+    static const auto table = [] {
+        std::array<double, 1024> weights{};
+        for (uint32_t t = 1; t < weights.size(); ++t) weights[t] = 1.0 + std::log((double)t);
+        return weights;
+    }();
+    return tf < table.size() ? table[tf] : 1.0 + std::log((double)tf);
+}
 
-    std::vector<std::string> terms;
-    terms.reserve(index.size());
+// Scores round to the nearest unit, but a matching posting never rounds down to nothing
+static uint8_t quantizeImpact(double score, double scale) {
+    if (score <= 0) return 0;
+    return (uint8_t)std::clamp<long>(std::lround(score / scale), 1, 255);
+}
 
-    index.traverse([&](const std::string& term, const std::vector<TermInfo>& docs) {
-        if ((docs.size() > 1 || docs[0].tf > 1) && (docs.size() < 0.95 * urls.size())) {
-            terms.push_back(term);
+bool IndexWriter::keepTerm(size_t doc_count, uint32_t first_tf, uint32_t num_docs) {
+    return (doc_count > 1 || first_tf > 1) && doc_count < 0.95 * num_docs;
+}
+
+size_t IndexWriter::listAlignment(const BinaryFormat::DumpOptions& options) {
+    // Roaring headers and bitmap words are 8-aligned relative to the start of the set
+    if (options.bitmap_containers) return alignof(uint64_t);
+    bool blocks = options.format == BinaryFormat::PostingFormat::Blocked ||
+                  options.format == BinaryFormat::PostingFormat::StreamVByte;
+    return blocks ? alignof(BinaryFormat::BlockHeader) : 1;
+}
+
+void IndexWriter::padList(const BinaryFormat::DumpOptions& options, std::string& out) {
+    size_t alignment = listAlignment(options);
+    out.resize((out.size() + alignment - 1) / alignment * alignment, '\0');
+}
+
+uint32_t IndexWriter::collectionFrequency(const std::vector<TermInfo>& docs) {
+    uint64_t sum = 0;
+    for (const auto& p : docs) sum += p.tf;
+    return (uint32_t)std::min<uint64_t>(sum, UINT32_MAX);
+}
+
+// Appends one block payload of a block format. VarInt lists are the Blocked payloads back to back, without headers.
+static void encodeBlock(const TermInfo* docs, uint32_t n, uint32_t prev_id, BinaryFormat::PostingFormat format,
+                        std::string& out) {
+    if (format == BinaryFormat::PostingFormat::StreamVByte) {
+        uint32_t doc_ids[BinaryFormat::BLOCK_SIZE];
+        uint32_t tfs[BinaryFormat::BLOCK_SIZE];
+        for (uint32_t i = 0; i < n; ++i) {
+            doc_ids[i] = docs[i].doc_id;
+            tfs[i] = docs[i].tf;
+        }
+        size_t offset = out.size();
+        out.resize(offset + StreamVByte::encodedDeltaSize(doc_ids, n, prev_id) + StreamVByte::encodedSize(tfs, n));
+        auto* dst = reinterpret_cast<uint8_t*>(out.data() + offset);
+        dst += StreamVByte::encodeDelta(doc_ids, n, prev_id, dst);
+        StreamVByte::encode(tfs, n, dst);
+        return;
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        appendVarInt(out, docs[i].doc_id - prev_id);
+        appendVarInt(out, docs[i].tf);
+        prev_id = docs[i].doc_id;
+    }
+}
+
+static bool blockFormat(BinaryFormat::PostingFormat format) {
+    return format == BinaryFormat::PostingFormat::Blocked || format == BinaryFormat::PostingFormat::StreamVByte;
+}
+
+static uint64_t listBlockCount(uint64_t doc_count) {
+    return (doc_count + BinaryFormat::BLOCK_SIZE - 1) / BinaryFormat::BLOCK_SIZE;
+}
+
+// Block formats (v3, v4) get a BlockHeader per block, then the block payloads
+void IndexWriter::encodePostings(const std::vector<TermInfo>& docs, BinaryFormat::PostingFormat format, std::string& out) {
+    if (format == BinaryFormat::PostingFormat::Raw) {
+        size_t offset = out.size();
+        out.resize(offset + docs.size() * sizeof(TermInfo));
+        std::memcpy(out.data() + offset, docs.data(), docs.size() * sizeof(TermInfo));
+        return;
+    }
+    if (format == BinaryFormat::PostingFormat::VarInt) {
+        encodeBlock(docs.data(), (uint32_t)docs.size(), 0, format, out);
+        return;
+    }
+
+    uint32_t num_blocks = (uint32_t)listBlockCount(docs.size());
+    size_t headers_size = num_blocks * sizeof(BinaryFormat::BlockHeader);
+    size_t base = out.size();
+    out.resize(base + headers_size);
+    size_t data_begin = out.size();
+    uint32_t prev_id = 0;
+
+    for (uint32_t block = 0; block < num_blocks; ++block) {
+        size_t begin = block * BinaryFormat::BLOCK_SIZE;
+        uint32_t n = std::min<size_t>(docs.size() - begin, BinaryFormat::BLOCK_SIZE);
+
+        BinaryFormat::BlockHeader header = {docs[begin + n - 1].doc_id, (uint32_t)(out.size() - data_begin)};
+        std::memcpy(out.data() + base + block * sizeof(header), &header, sizeof(header));
+        encodeBlock(docs.data() + begin, n, prev_id, format, out);
+        prev_id = header.last_doc_id;
+    }
+}
+
+static bool bitmapCandidate(size_t doc_count, uint32_t num_docs, const BinaryFormat::DumpOptions& options) {
+    return options.bitmap_containers && doc_count * BITMAP_MIN_DENSITY >= num_docs;
+}
+
+bool IndexWriter::encodeBitmap(const std::vector<TermInfo>& docs, uint32_t num_docs, const BinaryFormat::DumpOptions& options,
+                               size_t begin, std::string& out) {
+    if (!bitmapCandidate(docs.size(), num_docs, options)) return false;
+    std::vector<uint32_t> doc_ids(docs.size()), tfs(docs.size());
+    for (size_t i = 0; i < docs.size(); ++i) {
+        doc_ids[i] = docs[i].doc_id;
+        tfs[i] = docs[i].tf;
+    }
+    std::string set;
+    Roaring::append(doc_ids, tfs, set);
+    if (set.size() >= out.size() - begin) return false;
+    out.resize(begin);
+    out += set;
+    return true;
+}
+
+BinaryFormat::BlockMax IndexWriter::blockMax(const TermInfo* docs, uint32_t n) {
+    BinaryFormat::BlockMax block = {docs[n - 1].doc_id, 0};
+    for (uint32_t i = 0; i < n; ++i) block.max_tf = std::max(block.max_tf, docs[i].tf);
+    return block;
+}
+
+void IndexWriter::appendBlockMax(const std::vector<TermInfo>& docs, std::vector<BinaryFormat::BlockMax>& blocks) {
+    for (size_t begin = 0; begin < docs.size(); begin += BinaryFormat::BLOCK_SIZE) {
+        const uint32_t n = (uint32_t)std::min<size_t>(BinaryFormat::BLOCK_SIZE, docs.size() - begin);
+        blocks.push_back(blockMax(docs.data() + begin, n));
+    }
+}
+
+IndexWriter::WrittenList IndexWriter::writeList(const ListBlocks& blocks, uint32_t doc_count, uint32_t num_docs,
+                                                const BinaryFormat::DumpOptions& options, std::ostream& out) {
+    const BinaryFormat::PostingFormat format = options.format;
+    std::string payload;
+    // Every block payload, each encoded into `payload` only, given the number of its first byte
+    auto forEachPayload = [&](const std::function<void(const TermInfo* docs, uint32_t n, uint64_t offset)>& visit) {
+        uint32_t prev_id = 0;
+        uint64_t offset = 0;
+        blocks([&](const TermInfo* docs, uint32_t n) {
+            payload.clear();
+            encodeBlock(docs, n, prev_id, format, payload);
+            visit(docs, n, offset);
+            offset += payload.size();
+            prev_id = docs[n - 1].doc_id;
+        });
+        return offset;
+    };
+
+    WrittenList list = {0, false};
+    if (bitmapCandidate(doc_count, num_docs, options)) {
+        Roaring::StreamWriter set([&](const auto& visit) {
+            uint32_t doc_ids[BinaryFormat::BLOCK_SIZE];
+            uint32_t tfs[BinaryFormat::BLOCK_SIZE];
+            blocks([&](const TermInfo* docs, uint32_t n) {
+                for (uint32_t i = 0; i < n; ++i) {
+                    doc_ids[i] = docs[i].doc_id;
+                    tfs[i] = docs[i].tf;
+                }
+                visit(doc_ids, tfs, n);
+            });
+        });
+        uint64_t plain_size = (uint64_t)doc_count * sizeof(TermInfo);
+        if (format != BinaryFormat::PostingFormat::Raw) {
+            plain_size = forEachPayload([](const TermInfo*, uint32_t, uint64_t) {});
+            if (blockFormat(format)) plain_size += listBlockCount(doc_count) * sizeof(BinaryFormat::BlockHeader);
+        }
+        if (set.size() < plain_size) {
+            set.write(out);
+            list = {set.size(), true};
+        }
+    }
+
+    if (!list.bitmap) {
+        if (format == BinaryFormat::PostingFormat::Raw) {
+            blocks([&](const TermInfo* docs, uint32_t n) {
+                out.write(reinterpret_cast<const char*>(docs), n * sizeof(TermInfo));
+            });
+            list.bytes = (uint64_t)doc_count * sizeof(TermInfo);
+        } else if (format == BinaryFormat::PostingFormat::VarInt) {
+            list.bytes = forEachPayload([&](const TermInfo*, uint32_t, uint64_t) { out.write(payload.data(), payload.size()); });
+        } else {
+            forEachPayload([&](const TermInfo* docs, uint32_t n, uint64_t offset) {
+                BinaryFormat::BlockHeader header = {docs[n - 1].doc_id, (uint32_t)offset};
+                out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            });
+            list.bytes = listBlockCount(doc_count) * sizeof(BinaryFormat::BlockHeader) +
+                         forEachPayload([&](const TermInfo*, uint32_t, uint64_t) { out.write(payload.data(), payload.size()); });
+        }
+    }
+
+    const char zeros[8] = {};
+    size_t alignment = listAlignment(options);
+    size_t padding = (alignment - list.bytes % alignment) % alignment;
+    out.write(zeros, padding);
+    list.bytes += padding;
+    return list;
+}
+
+BinaryFormat::DumpStats RamIndexSource::dump(const std::string& filename, bool zip) {
+    return dump(filename, zip ? BinaryFormat::PostingFormat::VarInt : BinaryFormat::PostingFormat::Raw);
+}
+
+BinaryFormat::DumpStats RamIndexSource::dump(const std::string& filename, BinaryFormat::PostingFormat format) {
+    BinaryFormat::DumpOptions options;
+    options.format = format;
+    return dump(filename, options);
+}
+
+// Runs body(0) .. body(count - 1) on up to `threads` threads, the calling one included
+template <typename Body>
+static void runParallel(size_t count, unsigned threads, const Body& body) {
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) body(i);
+    };
+    threads = std::min<size_t>(threads ? threads : std::max(1u, std::thread::hardware_concurrency()), std::max<size_t>(1, count));
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto& thread : pool) thread.join();
+}
+
+BinaryFormat::DumpStats RamIndexSource::dump(const std::string& filename, const BinaryFormat::DumpOptions& options) {
+    return write(filename, options, {this});
+}
+
+BinaryFormat::DumpStats RamIndexSource::dumpShards(const std::vector<std::shared_ptr<RamIndexSource>>& shards,
+                                                   const std::string& filename, const BinaryFormat::DumpOptions& options) {
+    std::vector<const RamIndexSource*> parts;
+    for (const auto& shard : shards) parts.push_back(shard.get());
+    return write(filename, options, parts);
+}
+
+BinaryFormat::DumpStats RamIndexSource::write(const std::string& filename, const BinaryFormat::DumpOptions& options,
+                                              const std::vector<const RamIndexSource*>& shards) {
+    auto start_time = std::chrono::steady_clock::now();
+    const BinaryFormat::PostingFormat format = options.format;
+
+    // Shard s holds documents [doc_offsets[s], doc_offsets[s + 1]) under local ids starting at 0
+    std::vector<uint32_t> doc_offsets(shards.size() + 1, 0);
+    uint64_t total_tokens = 0;
+    for (size_t s = 0; s < shards.size(); ++s) {
+        doc_offsets[s + 1] = doc_offsets[s] + (uint32_t)shards[s]->urls.size();
+        total_tokens += shards[s]->total_tokens;
+    }
+    const uint32_t num_docs = doc_offsets.back();
+
+    struct DumpTerm {
+        uint32_t hash;
+        const std::string* term;
+        const std::vector<TermInfo>* docs;
+    };
+    auto directoryOrder = [](const DumpTerm& a, const DumpTerm& b) {
+        return a.hash != b.hash ? a.hash < b.hash : *a.term < *b.term;
+    };
+
+    // Every shard's dictionary in directory order, then a k-way merge of them
+    std::vector<std::vector<DumpTerm>> shard_terms(shards.size());
+    runParallel(shards.size(), options.threads, [&](size_t s) {
+        shards[s]->index.traverse([&](const std::string& term, const std::vector<TermInfo>& docs) {
+            if (!docs.empty()) shard_terms[s].push_back({stringHash(term), &term, &docs});
+        });
+        std::sort(shard_terms[s].begin(), shard_terms[s].end(), directoryOrder);
+    });
+
+    std::vector<DumpTerm> terms;
+    // Lists of terms found in several shards, or in a shard that does not start at doc 0, with global doc ids
+    std::deque<std::vector<TermInfo>> merged_lists;
+    {
+        using Head = std::pair<uint32_t, size_t>;  // shard, position in its dictionary
+        auto later = [&](const Head& a, const Head& b) {
+            const DumpTerm& x = shard_terms[a.first][a.second];
+            const DumpTerm& y = shard_terms[b.first][b.second];
+            if (x.hash != y.hash || *x.term != *y.term) return directoryOrder(y, x);
+            return a.first > b.first;
+        };
+        std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+        for (uint32_t s = 0; s < shards.size(); ++s) {
+            if (!shard_terms[s].empty()) heads.push({s, 0});
+        }
+
+        std::vector<std::pair<uint32_t, const DumpTerm*>> parts;
+        while (!heads.empty()) {
+            // Equal terms come out in shard order, which is doc id order
+            parts.clear();
+            const DumpTerm& first = shard_terms[heads.top().first][heads.top().second];
+            while (!heads.empty()) {
+                auto [s, pos] = heads.top();
+                const DumpTerm& t = shard_terms[s][pos];
+                if (t.hash != first.hash || *t.term != *first.term) break;
+                heads.pop();
+                parts.push_back({s, &t});
+                if (pos + 1 < shard_terms[s].size()) heads.push({s, pos + 1});
+            }
+
+            size_t doc_count = 0;
+            for (const auto& part : parts) doc_count += part.second->docs->size();
+            const TermInfo& head = parts[0].second->docs->front();
+            if (!IndexWriter::keepTerm(doc_count, head.tf, num_docs)) continue;
+
+            if (parts.size() == 1 && doc_offsets[parts[0].first] == 0) {
+                terms.push_back(*parts[0].second);
+                continue;
+            }
+            std::vector<TermInfo>& docs = merged_lists.emplace_back();
+            docs.reserve(doc_count);
+            for (const auto& [s, part] : parts) {
+                for (const auto& p : *part->docs) docs.push_back({p.doc_id + doc_offsets[s], p.tf});
+            }
+            terms.push_back({first.hash, first.term, &docs});
+        }
+    }
+
+    // Posting lists are encoded in parallel into per-chunk buffers; chunks keep directory order,
+    // so the postings are just the concatenation of the buffers
+    const size_t num_chunks = (terms.size() + DUMP_CHUNK_TERMS - 1) / DUMP_CHUNK_TERMS;
+    std::vector<std::string> chunks(num_chunks);
+    std::vector<uint64_t> posting_offsets(terms.size() + 1);
+    std::vector<uint8_t> is_bitmap(terms.size(), 0);
+    std::vector<uint32_t> collection_freqs(terms.size());
+    runParallel(num_chunks, options.threads, [&](size_t c) {
+        size_t end = std::min(terms.size(), (c + 1) * DUMP_CHUNK_TERMS);
+        for (size_t i = c * DUMP_CHUNK_TERMS; i < end; ++i) {
+            posting_offsets[i] = chunks[c].size();
+            IndexWriter::encodePostings(*terms[i].docs, format, chunks[c]);
+            is_bitmap[i] = IndexWriter::encodeBitmap(*terms[i].docs, num_docs, options, posting_offsets[i], chunks[c]);
+            // Chunk sizes stay multiples of the alignment too, so offsets within a chunk keep it in the file
+            IndexWriter::padList(options, chunks[c]);
+            collection_freqs[i] = IndexWriter::collectionFrequency(*terms[i].docs);
         }
     });
 
-    std::sort(terms.begin(), terms.end(), [](const auto& a, const auto& b) { return stringHash(a) < stringHash(b); });
+    IndexWriter::Layout layout;
+    layout.num_docs = num_docs;
+    layout.total_tokens = total_tokens;
+    layout.num_terms = (uint32_t)terms.size();
+    layout.for_each_doc_length = [&](const std::function<void(uint32_t)>& visit) {
+        for (const RamIndexSource* shard : shards) {
+            // Documents added without a length count as empty
+            for (size_t d = 0; d < shard->urls.size(); ++d) visit(d < shard->doc_lengths.size() ? shard->doc_lengths[d] : 0);
+        }
+    };
+    layout.for_each_url = [&](const std::function<void(std::string_view)>& visit) {
+        for (const RamIndexSource* shard : shards) {
+            for (const auto& url : shard->urls) visit(url);
+        }
+    };
+
+    layout.for_each_term = [&](const std::function<void(const IndexWriter::Term&)>& visit) {
+        for (size_t i = 0; i < terms.size(); ++i) {
+            size_t chunk = i / DUMP_CHUNK_TERMS;
+            bool last_in_chunk = i + 1 == terms.size() || (i + 1) % DUMP_CHUNK_TERMS == 0;
+            uint64_t end = last_in_chunk ? chunks[chunk].size() : posting_offsets[i + 1];
+            visit({terms[i].hash, *terms[i].term, (uint32_t)terms[i].docs->size(), collection_freqs[i], end - posting_offsets[i],
+                   is_bitmap[i] != 0});
+        }
+    };
+    layout.write_postings = [&](std::ostream& out) {
+        for (const auto& chunk : chunks) out.write(chunk.data(), chunk.size());
+    };
+    layout.write_block_maxes = [&](std::ostream& out) {
+        std::vector<BinaryFormat::BlockMax> blocks;
+        for (const auto& term : terms) {
+            blocks.clear();
+            IndexWriter::appendBlockMax(*term.docs, blocks);
+            out.write(reinterpret_cast<const char*>(blocks.data()), blocks.size() * sizeof(BinaryFormat::BlockMax));
+        }
+    };
 
-    BinaryFormat::Header header = {BinaryFormat::MAGIC, zip ? 2u : 1u, (uint32_t)urls.size(), (uint32_t)terms.size()};
+    if (options.impacts || options.impact_ordered) {
+        // One scale for the whole index keeps impacts of different terms additive
+        const double N = num_docs;
+        std::vector<BinaryFormat::ImpactTerm> impact_terms(terms.size() + 1, BinaryFormat::ImpactTerm{0, 0, 0});
+        std::vector<double> idfs(terms.size());
+        double max_score = 0;
+        for (size_t i = 0; i < terms.size(); ++i) {
+            const auto& docs = *terms[i].docs;
+            idfs[i] = std::max(0.0, std::log(N / (1 + docs.size())));
+            uint32_t max_tf = 0;
+            for (const auto& p : docs) max_tf = std::max(max_tf, p.tf);
+            max_score = std::max(max_score, tfWeight(max_tf) * idfs[i]);
+            impact_terms[i].idf = (float)idfs[i];
+            impact_terms[i + 1].first = impact_terms[i].first + docs.size();
+        }
+        BinaryFormat::ImpactsHeader impacts_header = {max_score > 0 ? (float)(max_score / 255) : 1.0f, (uint32_t)terms.size(),
+                                                      impact_terms[terms.size()].first};
+
+        std::vector<uint8_t> impacts(impacts_header.num_postings);
+        for (size_t i = 0; i < terms.size(); ++i) {
+            const auto& docs = *terms[i].docs;
+            uint8_t* out = impacts.data() + impact_terms[i].first;
+            for (size_t j = 0; j < docs.size(); ++j) {
+                out[j] = quantizeImpact(tfWeight(docs[j].tf) * idfs[i], impacts_header.scale);
+                impact_terms[i].max_impact = std::max<uint32_t>(impact_terms[i].max_impact, out[j]);
+            }
+        }
+
+        std::string& section = layout.impact_sections.emplace_back(BinaryFormat::SectionId::Impacts, std::string()).second;
+        section.append(reinterpret_cast<const char*>(&impacts_header), sizeof(impacts_header));
+        section.append(reinterpret_cast<const char*>(impact_terms.data()),
+                       impact_terms.size() * sizeof(BinaryFormat::ImpactTerm));
+        section.append(reinterpret_cast<const char*>(impacts.data()), impacts.size());
+
+        if (options.impact_ordered) {
+            // A section of its own, 8-aligned apart from the uint8 impacts; every array in it stays 4-aligned
+            static_assert(sizeof(BinaryFormat::ImpactSegment) % alignof(uint32_t) == 0);
+            std::vector<uint32_t> first_segment(terms.size() + 1, 0);
+            std::vector<BinaryFormat::ImpactSegment> segments;
+            std::vector<uint32_t> docs(impacts_header.num_postings);
+            std::vector<uint32_t> order;
+            for (size_t i = 0; i < terms.size(); ++i) {
+                first_segment[i] = (uint32_t)segments.size();
+                const auto& postings = *terms[i].docs;
+                const uint8_t* term_impacts = impacts.data() + impact_terms[i].first;
+                order.resize(postings.size());
+                std::iota(order.begin(), order.end(), 0);
+                // Stable, so docs stay ascending inside a segment
+                std::stable_sort(order.begin(), order.end(),
+                                 [&](uint32_t a, uint32_t b) { return term_impacts[a] > term_impacts[b]; });
+                for (size_t j = 0; j < order.size(); ++j) {
+                    uint8_t impact = term_impacts[order[j]];
+                    if (j == 0 || impact != segments.back().impact) segments.push_back({impact, 0});
+                    ++segments.back().count;
+                    docs[impact_terms[i].first + j] = postings[order[j]].doc_id;
+                }
+            }
+            first_segment[terms.size()] = (uint32_t)segments.size();
+
+            std::string& ordered =
+                layout.impact_sections.emplace_back(BinaryFormat::SectionId::ImpactOrdered, std::string()).second;
+            ordered.append(reinterpret_cast<const char*>(first_segment.data()), first_segment.size() * sizeof(uint32_t));
+            ordered.append(reinterpret_cast<const char*>(segments.data()), segments.size() * sizeof(BinaryFormat::ImpactSegment));
+            ordered.append(reinterpret_cast<const char*>(docs.data()), docs.size() * sizeof(uint32_t));
+        }
+    }
+
+    BinaryFormat::DumpStats stats = IndexWriter::writeIndexFile(filename, options, layout);
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    return stats;
+}
+
+BinaryFormat::DumpStats IndexWriter::writeIndexFile(const std::string& filename, const BinaryFormat::DumpOptions& options,
+                                                    const Layout& layout) {
+    // The default stream buffer is a few KB, give it room for whole encoded chunks
+    std::vector<char> io_buffer(WRITE_BUFFER_SIZE);
+    std::ofstream ofs;
+    ofs.rdbuf()->pubsetbuf(io_buffer.data(), io_buffer.size());
+    ofs.open(filename, std::ios::binary);
+    if (!ofs) throw std::runtime_error("Cannot open file for writing");
+
+    const uint32_t num_terms = layout.num_terms;
+    BinaryFormat::Header header = {BinaryFormat::MAGIC, (uint32_t)options.format, layout.num_docs, num_terms};
     ofs.write(reinterpret_cast<char*>(&header), sizeof(header));
 
-    for (const auto& url : urls) {
+    layout.for_each_url([&](std::string_view url) {
         uint32_t len = (uint32_t)url.size();
         ofs.write(reinterpret_cast<char*>(&len), sizeof(len));
         ofs.write(url.data(), len);
+    });
+
+    // One pass collects what has to be known before the directory, and what the whole-dictionary sections need
+    uint64_t term_bytes = 0;
+    bool any_bitmap = false;
+    std::vector<uint64_t> perfect_hashes;
+    std::vector<uint32_t> eytzinger_hashes;
+    std::vector<std::string> sorted_terms;
+    if (options.perfect_hash) perfect_hashes.reserve(num_terms);
+    if (options.eytzinger_directory) eytzinger_hashes.reserve(num_terms);
+    if (options.front_coded_terms) sorted_terms.reserve(num_terms);
+    layout.for_each_term([&](const Term& t) {
+        term_bytes += t.term.size() + 1;
+        any_bitmap |= t.bitmap;
+        if (options.perfect_hash) perfect_hashes.push_back(PerfectHash::hash(t.term));
+        if (options.eytzinger_directory) eytzinger_hashes.push_back(t.hash);
+        if (options.front_coded_terms) sorted_terms.emplace_back(t.term);
+    });
+
+    // With front coding the term strings live only in the SortedTerms section
+    std::vector<uint32_t> sorted_order;
+    std::vector<uint32_t> ordinals;
+    if (options.front_coded_terms) {
+        sorted_order.resize(num_terms);
+        std::iota(sorted_order.begin(), sorted_order.end(), 0);
+        std::sort(sorted_order.begin(), sorted_order.end(),
+                  [&](uint32_t a, uint32_t b) { return sorted_terms[a] < sorted_terms[b]; });
+        ordinals.resize(num_terms);
+        for (uint32_t i = 0; i < sorted_order.size(); ++i) ordinals[sorted_order[i]] = i;
+        term_bytes = 0;
     }
 
-    uint64_t current_term_offset = (uint64_t)ofs.tellp() + (terms.size() * sizeof(BinaryFormat::TermEntry));
-    uint64_t current_data_offset = current_term_offset;
-    for (const auto& term : terms) current_data_offset += term.size() + 1;
+    uint64_t current_term_offset = (uint64_t)ofs.tellp() + ((uint64_t)num_terms * sizeof(BinaryFormat::TermEntry));
+    // The postings start 8-aligned, and each list is padded to listAlignment() within them
+    uint64_t strings_end = current_term_offset + term_bytes;
+    uint64_t strings_padding = (8 - strings_end % 8) % 8;
+    uint64_t data_offset = strings_end + strings_padding;
 
-    for (const auto& term : terms) {
-        const std::vector<TermInfo>& docs = index.get(term);
-        BinaryFormat::TermEntry entry;
-        entry.term_hash = stringHash(term);
-        entry.term_offset = current_term_offset;
-        entry.data_offset = current_data_offset;
-        entry.doc_count = (uint32_t)docs.size();
-        ofs.write(reinterpret_cast<char*>(&entry), sizeof(entry));
+    uint32_t term_index = 0;
+    layout.for_each_term([&](const Term& t) {
+        BinaryFormat::TermEntry entry = {};
+        entry.term_hash = t.hash;
+        entry.term_offset = options.front_coded_terms ? ordinals[term_index++] : current_term_offset;
+        entry.data_offset = data_offset;
+        entry.doc_count = t.doc_count;
+        entry.collection_freq = t.collection_freq;
+        ofs.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        current_term_offset += t.term.size() + 1;
+        data_offset += t.bytes;
+    });
 
-        current_term_offset += term.size() + 1;
+    const char zeros[64] = {};
+    if (!options.front_coded_terms) {
+        layout.for_each_term([&](const Term& t) {
+            ofs.write(t.term.data(), t.term.size());
+            ofs.put('\0');
+        });
+    }
+    ofs.write(zeros, strings_padding);
+    layout.write_postings(ofs);
 
-        if (zip) {
-            uint32_t prev_id = 0;
-            for (const auto& p : docs) {
-                current_data_offset += getVarIntSize(p.doc_id - prev_id) + getVarIntSize(p.tf);
-                prev_id = p.doc_id;
-            }
+    // StreamVByte blocks are decoded with 16-byte loads, keep the tail of the file readable for them.
+    // Roaring sets keep their tfs in StreamVByte blocks too.
+    if (options.format == BinaryFormat::PostingFormat::StreamVByte || any_bitmap) {
+        ofs.write(zeros, StreamVByte::PADDING);
+    }
+
+    std::vector<BinaryFormat::SectionEntry> sections;
+    auto beginSection = [&](BinaryFormat::SectionId id, uint64_t alignment = 8) {
+        ofs.write(zeros, (alignment - ofs.tellp() % alignment) % alignment);
+        sections.push_back({(uint32_t)id, 0, (uint64_t)ofs.tellp(), 0});
+    };
+    auto endSection = [&]() { sections.back().size = (uint64_t)ofs.tellp() - sections.back().offset; };
+
+    // The URLs are replayed: their offsets follow from the lengths
+    beginSection(BinaryFormat::SectionId::UrlOffsets);
+    uint64_t url_offset = sizeof(header);
+    layout.for_each_url([&](std::string_view url) {
+        ofs.write(reinterpret_cast<const char*>(&url_offset), sizeof(url_offset));
+        url_offset += sizeof(uint32_t) + url.size();
+    });
+    endSection();
+
+    {
+        BinaryFormat::DocLengthsHeader lengths_header = {layout.num_docs, options.quantize_doc_lengths, layout.total_tokens};
+
+        beginSection(BinaryFormat::SectionId::DocLengths);
+        ofs.write(reinterpret_cast<const char*>(&lengths_header), sizeof(lengths_header));
+        if (options.quantize_doc_lengths) {
+            const auto table = docLengthTable();
+            ofs.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(uint32_t));
+            layout.for_each_doc_length([&](uint32_t length) { ofs.put((char)quantizeDocLength(table, length)); });
         } else {
-            current_data_offset += docs.size() * sizeof(uint32_t) * 2;
+            layout.for_each_doc_length([&](uint32_t length) {
+                ofs.write(reinterpret_cast<const char*>(&length), sizeof(length));
+            });
+        }
+        endSection();
+    }
+
+    if (options.perfect_hash) {
+        PerfectHash::Table table = PerfectHash::build(perfect_hashes);
+        std::vector<uint32_t> entries(num_terms);
+        for (uint32_t i = 0; i < num_terms; ++i) {
+            entries[PerfectHash::slot(perfect_hashes[i], table.header, table.pilots.data())] = i;
         }
+
+        beginSection(BinaryFormat::SectionId::PerfectHash);
+        ofs.write(reinterpret_cast<const char*>(&table.header), sizeof(table.header));
+        ofs.write(reinterpret_cast<const char*>(table.pilots.data()), table.pilots.size() * sizeof(uint32_t));
+        ofs.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(uint32_t));
+        endSection();
     }
 
-    for (const auto& term : terms) {
-        ofs.write(term.c_str(), term.size() + 1);
+    if (options.block_max) {
+        // A list of n postings has ceil(n / BLOCK_SIZE) blocks, so first_block follows from the doc counts
+        beginSection(BinaryFormat::SectionId::BlockMax);
+        uint32_t first_block = 0;
+        layout.for_each_term([&](const Term& t) {
+            ofs.write(reinterpret_cast<const char*>(&first_block), sizeof(first_block));
+            first_block += (uint32_t)listBlockCount(t.doc_count);
+        });
+        ofs.write(reinterpret_cast<const char*>(&first_block), sizeof(first_block));
+        layout.write_block_maxes(ofs);
+        endSection();
     }
 
-    for (const auto& term : terms) {
-        const std::vector<TermInfo>& docs = index.get(term);
-        uint32_t prev_id = 0;
-        for (const auto& p : docs) {
-            if (zip) {
-                writeVarInt(ofs, p.doc_id - prev_id);
-                writeVarInt(ofs, p.tf);
-                prev_id = p.doc_id;
-            } else {
-                ofs.write(reinterpret_cast<const char*>(&p.doc_id), sizeof(uint32_t));
-                ofs.write(reinterpret_cast<const char*>(&p.tf), sizeof(uint32_t));
+    for (const auto& [id, section] : layout.impact_sections) {
+        beginSection(id);
+        ofs.write(section.data(), section.size());
+        endSection();
+    }
+
+    if (any_bitmap) {
+        beginSection(BinaryFormat::SectionId::BitmapTerms);
+        uint64_t word = 0;
+        uint32_t i = 0;
+        layout.for_each_term([&](const Term& t) {
+            word |= (uint64_t)t.bitmap << (i % 64);
+            if (++i % 64 == 0) {
+                ofs.write(reinterpret_cast<const char*>(&word), sizeof(word));
+                word = 0;
             }
-        }
+        });
+        if (i % 64 != 0) ofs.write(reinterpret_cast<const char*>(&word), sizeof(word));
+        endSection();
+    }
+
+    if (options.eytzinger_directory) {
+        std::vector<uint32_t> keys, entries;
+        Eytzinger::build(eytzinger_hashes.data(), (uint32_t)eytzinger_hashes.size(), keys, entries);
+
+        beginSection(BinaryFormat::SectionId::EytzingerHashes, 64);
+        ofs.write(reinterpret_cast<const char*>(keys.data()), keys.size() * sizeof(uint32_t));
+        ofs.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(uint32_t));
+        endSection();
     }
+
+    if (options.front_coded_terms) {
+        std::vector<std::string_view> sorted_views;
+        sorted_views.reserve(num_terms);
+        for (uint32_t i : sorted_order) sorted_views.push_back(sorted_terms[i]);
+
+        beginSection(BinaryFormat::SectionId::SortedTerms);
+        std::string section = FrontCoding::encode(sorted_views, sorted_order);
+        ofs.write(section.data(), section.size());
+        endSection();
+    }
+
+    if (!sections.empty()) {
+        // The table is 8-aligned so it can be read in place; the footer right after it is then aligned too
+        ofs.write(zeros, (8 - ofs.tellp() % 8) % 8);
+        BinaryFormat::Footer footer = {(uint64_t)ofs.tellp(), (uint32_t)sections.size(), BinaryFormat::FOOTER_MAGIC};
+        ofs.write(reinterpret_cast<const char*>(sections.data()), sections.size() * sizeof(BinaryFormat::SectionEntry));
+        ofs.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+    }
+
+    BinaryFormat::DumpStats stats;
+    stats.bytes = (uint64_t)ofs.tellp();
+    ofs.close();
+    if (!ofs) throw std::runtime_error("Failed to write index file");
+    stats.terms = num_terms;
+    return stats;
 }
 
-MappedIndexSource::~MappedIndexSource() {
-    if (map_addr && map_addr != MAP_FAILED) {
-        munmap((void*)map_addr, file_size);
-        map_addr = nullptr;
+MappedIndexSource::Mapping::Mapping(Mapping&& other) noexcept
+    : fd(std::exchange(other.fd, -1)), size(other.size), addr(std::exchange(other.addr, nullptr)) {}
+
+MappedIndexSource::Mapping::~Mapping() { release(); }
+
+void MappedIndexSource::Mapping::release() {
+    if (addr && addr != MAP_FAILED) {
+        munmap((void*)addr, size);
+        addr = nullptr;
     }
     if (fd != -1) {
         close(fd);
         fd = -1;
     }
+    size = 0;
+}
+
+void MappedIndexSource::unload() {
+    file.release();
+    postings_begin = postings_end = 0;
+    locked_bytes = 0;
+    lock_failures = 0;
     term_directory = nullptr;
-    num_terms = 0;
+    num_terms = num_docs = file_version = 0;
+    url_offsets = nullptr;
+    legacy_url_offsets.clear();
+    sections = {};
+    perfect_hash = nullptr;
+    perfect_hash_pilots = perfect_hash_entries = nullptr;
+    eytzinger_hashes = eytzinger_entries = nullptr;
+    block_max_first = nullptr;
+    block_max_blocks = nullptr;
+    bitmap_terms = nullptr;
+    impacts_header = nullptr;
+    impact_terms = nullptr;
+    impact_values = nullptr;
+    impact_first_segment = nullptr;
+    impact_segments = nullptr;
+    impact_docs = nullptr;
+    doc_lengths = {};
+    stats = {};
+    sorted_terms = {};
+    posting_cache.reset();
+}
+
+// URLs are packed back to back, so their length prefixes sit at any offset
+static uint32_t urlLength(const char* prefix) {
+    uint32_t len;
+    std::memcpy(&len, prefix, sizeof(len));
+    return len;
 }
 
-void MappedIndexSource::load(const std::string& filename) {
-    fd = open(filename.c_str(), O_RDONLY);
-    if (fd == -1) throw std::runtime_error("Cannot open index file");
+void MappedIndexSource::load(const std::string& filename, const LoadOptions& options) {
+    // Reloading replaces the whole mapping; cursors and views into the old one become invalid
+    unload();
+    ++data_generation;
+    file.fd = open(filename.c_str(), O_RDONLY);
+    if (file.fd == -1) throw std::runtime_error("Cannot open index file");
 
     struct stat sb;
-    if (fstat(fd, &sb) == -1) {
-        close(fd);
-        fd = -1;
+    if (fstat(file.fd, &sb) == -1) {
+        close(file.fd);
+        file.fd = -1;
         throw std::runtime_error("Cannot stat file");
     }
-    file_size = sb.st_size;
+    file.size = sb.st_size;
 
-    map_addr = (const char*)mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (map_addr == MAP_FAILED) {
-        close(fd);
-        fd = -1;
-        map_addr = nullptr;
+    int flags = MAP_PRIVATE;
+    if (options.populate) flags |= MAP_POPULATE;
+    file.addr = (const char*)mmap(nullptr, file.size, PROT_READ, flags, file.fd, 0);
+    if (file.addr == MAP_FAILED) {
+        close(file.fd);
+        file.fd = -1;
+        file.addr = nullptr;
         throw std::runtime_error("mmap failed");
     }
 
-    auto* header = reinterpret_cast<const BinaryFormat::Header*>(map_addr);
+    auto* header = reinterpret_cast<const BinaryFormat::Header*>(file.addr);
     if (header->magic != BinaryFormat::MAGIC) throw std::runtime_error("Invalid magic");
 
-    if (header->version == 2) {
+    if (header->version == 4) {
+        std::cout << "Loading stream vbyte version\n";
+    } else if (header->version == 3) {
+        std::cout << "Loading blocked version\n";
+    } else if (header->version == 2) {
         std::cout << "Loading zipped version\n";
     } else if (header->version == 1) {
         std::cout << "Loading not zipped version\n";
+    } else {
+        throw std::runtime_error("Unsupported index version");
     }
 
     file_version = header->version;
     num_terms = header->num_terms;
+    num_docs = header->num_docs;
 
-    const char* ptr = map_addr + sizeof(BinaryFormat::Header);
+    if (file.size >= sizeof(BinaryFormat::Header) + sizeof(BinaryFormat::Footer)) {
+        // Files without sections end anywhere, so the candidate footer is copied out rather than read in place
+        BinaryFormat::Footer footer;
+        std::memcpy(&footer, file.addr + file.size - sizeof(footer), sizeof(footer));
+        uint64_t table_size = (uint64_t)footer.num_sections * sizeof(BinaryFormat::SectionEntry);
+        if (footer.magic == BinaryFormat::FOOTER_MAGIC && footer.table_offset + table_size + sizeof(footer) == file.size) {
+            sections = {reinterpret_cast<const BinaryFormat::SectionEntry*>(file.addr + footer.table_offset),
+                        footer.num_sections};
+        }
+    }
 
-    urls.reserve(header->num_docs);
-    for (uint32_t i = 0; i < header->num_docs; ++i) {
-        uint32_t len = *reinterpret_cast<const uint32_t*>(ptr);
-        ptr += sizeof(uint32_t);
-        urls.emplace_back(ptr, len);
-        ptr += len;
+    if (const auto* section = findSection(BinaryFormat::SectionId::UrlOffsets)) {
+        url_offsets = reinterpret_cast<const uint64_t*>(file.addr + section->offset);
+    } else {
+        // Files written before the offsets section: walk the URLs once
+        legacy_url_offsets.resize(num_docs);
+        uint64_t offset = sizeof(BinaryFormat::Header);
+        for (uint32_t i = 0; i < num_docs; ++i) {
+            legacy_url_offsets[i] = offset;
+            offset += sizeof(uint32_t) + urlLength(file.addr + offset);
+        }
+        url_offsets = legacy_url_offsets.data();
     }
 
+    const char* ptr = file.addr + sizeof(BinaryFormat::Header);
+    if (num_docs > 0) {
+        const char* last_url = file.addr + url_offsets[num_docs - 1];
+        ptr = last_url + sizeof(uint32_t) + urlLength(last_url);
+    }
     term_directory = reinterpret_cast<const BinaryFormat::TermEntry*>(ptr);
+
+    if (const auto* section = findSection(BinaryFormat::SectionId::PerfectHash)) {
+        const char* base = file.addr + section->offset;
+        perfect_hash = reinterpret_cast<const PerfectHash::Header*>(base);
+        perfect_hash_pilots = reinterpret_cast<const uint32_t*>(base + sizeof(PerfectHash::Header));
+        perfect_hash_entries = perfect_hash_pilots + perfect_hash->num_buckets;
+    }
+
+    if (const auto* section = findSection(BinaryFormat::SectionId::EytzingerHashes)) {
+        eytzinger_hashes = reinterpret_cast<const uint32_t*>(file.addr + section->offset);
+        eytzinger_entries = eytzinger_hashes + num_terms + 1;
+    }
+
+    if (const auto* section = findSection(BinaryFormat::SectionId::SortedTerms)) {
+        sorted_terms = FrontCoding::Reader(file.addr + section->offset);
+    }
+
+    if (const auto* section = findSection(BinaryFormat::SectionId::BlockMax)) {
+        block_max_first = reinterpret_cast<const uint32_t*>(file.addr + section->offset);
+        block_max_blocks = reinterpret_cast<const BinaryFormat::BlockMax*>(block_max_first + num_terms + 1);
+    }
+
+    if (const auto* section = findSection(BinaryFormat::SectionId::BitmapTerms)) {
+        bitmap_terms = reinterpret_cast<const uint64_t*>(file.addr + section->offset);
+    }
+
+    if (const auto* section = findSection(BinaryFormat::SectionId::Impacts)) {
+        impacts_header = reinterpret_cast<const BinaryFormat::ImpactsHeader*>(file.addr + section->offset);
+        impact_terms = reinterpret_cast<const BinaryFormat::ImpactTerm*>(impacts_header + 1);
+        impact_values = reinterpret_cast<const uint8_t*>(impact_terms + num_terms + 1);
+        if (const auto* ordered = findSection(BinaryFormat::SectionId::ImpactOrdered)) {
+            impact_first_segment = reinterpret_cast<const uint32_t*>(file.addr + ordered->offset);
+            impact_segments = reinterpret_cast<const BinaryFormat::ImpactSegment*>(impact_first_segment + num_terms + 1);
+            impact_docs = reinterpret_cast<const uint32_t*>(impact_segments + impact_first_segment[num_terms]);
+        }
+    }
+
+    stats = {num_docs, 0};
+    if (const auto* section = findSection(BinaryFormat::SectionId::DocLengths)) {
+        const char* base = file.addr + section->offset;
+        auto* lengths_header = reinterpret_cast<const BinaryFormat::DocLengthsHeader*>(base);
+        base += sizeof(*lengths_header);
+        stats.total_tokens = lengths_header->total_tokens;
+        doc_lengths.size = lengths_header->num_docs;
+        if (lengths_header->quantized) {
+            doc_lengths.table = reinterpret_cast<const uint32_t*>(base);
+            doc_lengths.codes = reinterpret_cast<const uint8_t*>(base + 256 * sizeof(uint32_t));
+        } else {
+            doc_lengths.exact = reinterpret_cast<const uint32_t*>(base);
+        }
+    }
+
+    // Postings are written in directory order right after the term strings, sections follow them
+    postings_begin = num_terms ? term_directory[0].data_offset : (uint64_t)(ptr - file.addr);
+    postings_end = file.size;
+    for (const auto& section : sections) postings_end = std::min(postings_end, section.offset);
+
+    applyResidency(options);
+    if (options.posting_cache_bytes && file_version != 1) {
+        posting_cache = std::make_unique<PostingCache>(options.posting_cache_bytes, num_terms);
+    }
+}
+
+static int toMadvise(LoadOptions::Advice advice) {
+    switch (advice) {
+        case LoadOptions::Advice::Random:
+            return MADV_RANDOM;
+        case LoadOptions::Advice::Sequential:
+            return MADV_SEQUENTIAL;
+        case LoadOptions::Advice::WillNeed:
+            return MADV_WILLNEED;
+        default:
+            return MADV_NORMAL;
+    }
+}
+
+static size_t pageSize() {
+    static const size_t size = (size_t)sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+// Page-aligned [begin, end) range of the mapping that covers the given byte range
+static std::pair<uint64_t, uint64_t> pageRange(uint64_t begin, uint64_t end) {
+    uint64_t page = pageSize();
+    return {begin / page * page, (end + page - 1) / page * page};
+}
+
+bool MappedIndexSource::lockRange(uint64_t begin, uint64_t end) {
+    if (begin >= end) return true;
+    auto [from, to] = pageRange(begin, end);
+    if (mlock(file.addr + from, to - from) != 0) {
+        ++lock_failures;
+        return false;
+    }
+    locked_bytes += to - from;
+    return true;
+}
+
+void MappedIndexSource::applyResidency(const LoadOptions& options) {
+    if (file.size == 0) return;
+    auto advise = [&](uint64_t begin, uint64_t end, int advice) {
+        if (begin >= end) return;
+        auto [from, to] = pageRange(begin, end);
+        madvise((void*)(file.addr + from), to - from, advice);
+    };
+
+#ifdef MADV_HUGEPAGE
+    if (options.huge_pages) advise(0, file.size, MADV_HUGEPAGE);
+#endif
+    if (options.postings_advice != LoadOptions::Advice::Normal) {
+        advise(postings_begin, postings_end, toMadvise(options.postings_advice));
+    }
+    if (options.dictionary_advice != LoadOptions::Advice::Normal) {
+        advise(0, postings_begin, toMadvise(options.dictionary_advice));
+        advise(postings_end, file.size, toMadvise(options.dictionary_advice));
+    }
+
+    if (options.lock_dictionary) {
+        lockRange(0, postings_begin);
+        lockRange(postings_end, file.size);
+    }
+
+    if (options.lock_top_postings > 0 && num_terms > 0) {
+        std::vector<uint32_t> order(num_terms);
+        std::iota(order.begin(), order.end(), 0);
+        uint32_t top = std::min(options.lock_top_postings, num_terms);
+        std::partial_sort(order.begin(), order.begin() + top, order.end(),
+                          [&](uint32_t a, uint32_t b) { return term_directory[a].doc_count > term_directory[b].doc_count; });
+        for (uint32_t i = 0; i < top; ++i) {
+            uint32_t t = order[i];
+            uint64_t end = t + 1 < num_terms ? term_directory[t + 1].data_offset : postings_end;
+            lockRange(term_directory[t].data_offset, end);
+        }
+    }
+}
+
+ResidencyReport MappedIndexSource::residency() const {
+    ResidencyReport report;
+    report.locked_bytes = locked_bytes;
+    report.lock_failures = lock_failures;
+    if (!file.addr || file.size == 0) return report;
+
+    size_t page = pageSize();
+    std::vector<unsigned char> pages((file.size + page - 1) / page);
+    if (mincore((void*)file.addr, file.size, pages.data()) != 0) throw std::runtime_error("mincore failed");
+
+    uint64_t postings_first = postings_begin / page;
+    uint64_t postings_last = (postings_end + page - 1) / page;
+    for (size_t i = 0; i < pages.size(); ++i) {
+        bool resident = pages[i] & 1;
+        auto& region = (i >= postings_first && i < postings_last) ? report.postings : report.dictionary;
+        ++region.pages;
+        region.resident += resident;
+        ++report.total.pages;
+        report.total.resident += resident;
+    }
+    return report;
+}
+
+const BinaryFormat::SectionEntry* MappedIndexSource::findSection(BinaryFormat::SectionId id) const {
+    for (const auto& section : sections) {
+        if (section.id == (uint32_t)id) return &section;
+    }
+    return nullptr;
 }
 
 const BinaryFormat::TermEntry* MappedIndexSource::findTermEntry(std::string_view term) const {
-    if (!term_directory || num_terms == 0 || !map_addr) return nullptr;
+    if (!term_directory || num_terms == 0 || !file.addr) return nullptr;
+
+    if (perfect_hash) {
+        uint32_t slot = PerfectHash::slot(PerfectHash::hash(term), *perfect_hash, perfect_hash_pilots);
+        const BinaryFormat::TermEntry* entry = term_directory + perfect_hash_entries[slot];
+        return termEquals(*entry, term) ? entry : nullptr;
+    }
 
     size_t h = stringHash(term);
 
-    auto it = std::lower_bound(term_directory, term_directory + num_terms, h,
-                               [](const BinaryFormat::TermEntry& entry, size_t val) { return entry.term_hash < val; });
+    const BinaryFormat::TermEntry* it;
+    if (eytzinger_hashes) {
+        it = term_directory + Eytzinger::lowerBound(eytzinger_hashes, eytzinger_entries, num_terms, (uint32_t)h);
+    } else {
+        it = std::lower_bound(term_directory, term_directory + num_terms, h,
+                              [](const BinaryFormat::TermEntry& entry, size_t val) { return entry.term_hash < val; });
+    }
 
     while (it != term_directory + num_terms && it->term_hash == h) {
-        const char* stored_term_ptr = map_addr + it->term_offset;
-        std::string_view stored_view(stored_term_ptr);
-
-        if (stored_view == term) {
+        if (termEquals(*it, term)) {
             return it;
         }
         it++;
@@ -209,44 +1268,102 @@ const BinaryFormat::TermEntry* MappedIndexSource::findTermEntry(std::string_view
     return nullptr;
 }
 
-std::vector<TermInfo> MappedIndexSource::getPostings(const std::string& term) {
+bool MappedIndexSource::termEquals(const BinaryFormat::TermEntry& entry, std::string_view term) const {
+    if (sorted_terms.valid()) return sorted_terms.equals((uint32_t)entry.term_offset, term);
+    return std::string_view(file.addr + entry.term_offset) == term;
+}
+
+std::vector<std::string> MappedIndexSource::expandPrefix(std::string_view prefix, size_t limit) const {
+    std::vector<std::string> result;
+    if (sorted_terms.valid()) {
+        for (auto& [term, entry] : sorted_terms.prefixRange(prefix, limit)) result.push_back(std::move(term));
+        return result;
+    }
+
+    // No sorted dictionary: fall back to walking the whole directory
+    for (uint32_t i = 0; i < num_terms; ++i) {
+        std::string_view term(file.addr + term_directory[i].term_offset);
+        if (term.starts_with(prefix)) result.emplace_back(term);
+    }
+    std::sort(result.begin(), result.end());
+    if (result.size() > limit) result.resize(limit);
+    return result;
+}
+
+PostingCursor MappedIndexSource::openCursor(const std::string& term) const {
     const auto* entry = findTermEntry(std::string_view(term));
     if (!entry) return {};
 
-    const char* data_ptr = map_addr + entry->data_offset;
+    const char* data_ptr = file.addr + entry->data_offset;
 
+    size_t index = entry - term_directory;
+    if (bitmap_terms && (bitmap_terms[index / 64] >> (index % 64)) & 1) return PostingCursor::fromRoaring(data_ptr);
     if (file_version == 1) {
-        std::vector<TermInfo> results;
-        results.reserve(entry->doc_count);
-
         auto* raw_data = reinterpret_cast<const TermInfo*>(data_ptr);
+        return PostingCursor(std::span<const TermInfo>(raw_data, entry->doc_count));
+    }
 
-        std::span<const TermInfo> disk_span(raw_data, entry->doc_count);
+    auto open = [&] {
+        if (file_version == 3) return PostingCursor::fromBlocks(data_ptr, entry->doc_count);
+        if (file_version == 4) return PostingCursor::fromBlocks(data_ptr, entry->doc_count, true);
+        return PostingCursor::fromVarInt(data_ptr, entry->doc_count);
+    };
+    if (!posting_cache) return open();
 
-        for (const auto& disk_entry : disk_span) {
-            results.push_back({disk_entry.doc_id, disk_entry.tf});
-        }
-        return results;
-    } else {
-        std::vector<TermInfo> results;
-        results.reserve(entry->doc_count);
+    if (auto cached = posting_cache->find((uint32_t)index)) return PostingCursor::fromShared(std::move(cached));
+    if (!posting_cache->shouldAdmit((uint32_t)index, entry->doc_count * sizeof(TermInfo))) return open();
 
-        uint32_t last_doc_id = 0;
-        const char* ptr = data_ptr;
+    auto decoded = std::make_shared<std::vector<TermInfo>>();
+    decoded->reserve(entry->doc_count);
+    for (PostingCursor cursor = open(); cursor.valid();) {
+        auto window = cursor.buffered();
+        decoded->insert(decoded->end(), window.begin(), window.end());
+        cursor.advance((uint32_t)window.size());
+    }
+    PostingCache::List list = std::move(decoded);
+    posting_cache->insert((uint32_t)index, list);
+    return PostingCursor::fromShared(std::move(list));
+}
 
-        for (uint32_t i = 0; i < entry->doc_count; ++i) {
-            uint32_t delta = readVarInt(ptr);
-            uint32_t current_doc_id = last_doc_id + delta;
-            uint32_t tf = readVarInt(ptr);
+uint64_t MappedIndexSource::getCollectionFrequency(const std::string& term) const {
+    const auto* entry = findTermEntry(term);
+    if (!entry) return 0;
+    if (findSection(BinaryFormat::SectionId::DocLengths)) return entry->collection_freq;
 
-            results.push_back({current_doc_id, tf});
-            last_doc_id = current_doc_id;
-        }
-        return results;
+    // Older files: the field is padding there, sum the tfs instead
+    uint64_t total = 0;
+    for (PostingCursor cursor = openCursor(term); cursor.valid(); cursor.next()) total += cursor.tf();
+    return total;
+}
+
+std::span<const BinaryFormat::BlockMax> MappedIndexSource::getBlockMaxes(const std::string& term) const {
+    if (!block_max_first) return {};
+    const auto* entry = findTermEntry(term);
+    if (!entry) return {};
+    size_t t = entry - term_directory;
+    return {block_max_blocks + block_max_first[t], block_max_blocks + block_max_first[t + 1]};
+}
+
+TermImpacts MappedIndexSource::getImpacts(const std::string& term) const {
+    if (!impacts_header) return {};
+    const auto* entry = findTermEntry(term);
+    if (!entry) return {};
+    size_t t = entry - term_directory;
+    const auto& info = impact_terms[t];
+    TermImpacts result;
+    result.scale = impacts_header->scale;
+    result.idf = info.idf;
+    result.max_impact = info.max_impact;
+    result.impacts = {impact_values + info.first, impact_terms[t + 1].first - info.first};
+    if (impact_first_segment) {
+        result.segments = {impact_segments + impact_first_segment[t], impact_segments + impact_first_segment[t + 1]};
+        result.docs = impact_docs + info.first;
     }
+    return result;
 }
 
-std::string MappedIndexSource::getUrl(int doc_id) const {
-    if (doc_id >= 0 && doc_id < (int)urls.size()) return urls[doc_id];
-    return "";
+std::string_view MappedIndexSource::getUrl(int doc_id) const {
+    if (doc_id < 0 || doc_id >= (int)num_docs) return "";
+    const char* ptr = file.addr + url_offsets[doc_id];
+    return {ptr + sizeof(uint32_t), urlLength(ptr)};
 }
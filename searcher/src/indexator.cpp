@@ -4,12 +4,14 @@ TFIDFIndexator::TFIDFIndexator(std::shared_ptr<RamIndexSource> src, std::shared_
     : IIndexator(src, std::move(tok)) {}
 
 void IIndexator::addDocument(const std::string_view& url_view, const std::string_view& doc_view) {
-    uint32_t doc_id = source->getTotalDocs();
+    tokenizer->tokenize(doc_view);
+    addTokens(url_view, tokenizer->getTokens());
+}
 
-    source->addUrl(url_view);
+void IIndexator::addTokens(const std::string_view& url_view, const std::vector<std::string>& tokens) {
+    uint32_t doc_id = source->getTotalDocs();
 
-    tokenizer->tokenize(doc_view);
-    const std::vector<std::string>& tokens = tokenizer->getTokens();
+    source->addUrl(url_view, (uint32_t)tokens.size());
 
     processTokens(tokens, doc_id);
 }
@@ -0,0 +1,174 @@
+#include "indexing_pipeline.h"
+
+#include <algorithm>
+#include <map>
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(Clock::time_point start) { return std::chrono::duration<double>(Clock::now() - start).count(); }
+
+IndexingPipeline::IndexingPipeline(std::shared_ptr<IIndexator> idxator, Extractor extractor)
+    : IndexingPipeline(std::move(idxator), std::move(extractor), Options{}) {}
+
+IndexingPipeline::IndexingPipeline(std::shared_ptr<IIndexator> idxator, Extractor extractor, Options options)
+    : indexator(std::move(idxator)),
+      extract(std::move(extractor)),
+      reorder_window(std::max<size_t>(1, options.reorder_window)),
+      raw_queue(options.queue_capacity) {
+    indexers.push_back(std::make_unique<Indexer>(options.queue_capacity));
+    start(options.workers, 1);
+}
+
+IndexingPipeline::IndexingPipeline(IndexatorFactory factory, Extractor extractor, Options options)
+    : first_shard(std::make_shared<RamIndexSource>()),
+      make_indexator(std::move(factory)),
+      extract(std::move(extractor)),
+      shard_docs(std::max<size_t>(1, options.shard_docs)),
+      reorder_window(std::max<size_t>(1, options.reorder_window)),
+      raw_queue(options.queue_capacity) {
+    indexator = make_indexator(first_shard);
+    unsigned count = std::max(1u, options.indexers);
+    for (unsigned i = 0; i < count; ++i) indexers.push_back(std::make_unique<Indexer>(options.queue_capacity));
+    start(options.workers, count);
+}
+
+void IndexingPipeline::start(unsigned count, unsigned indexer_count) {
+    if (count == 0) {
+        unsigned hardware = std::thread::hardware_concurrency();
+        count = hardware > indexer_count + 1 ? hardware - indexer_count - 1 : 1;
+    }
+    parse_stats.resize(count);
+    started = last_push = Clock::now();
+    for (unsigned i = 0; i < count; ++i) parsers.emplace_back(&IndexingPipeline::parse, this, i);
+    for (unsigned i = 0; i < indexer_count; ++i) indexers[i]->next = i * shard_docs;
+    for (unsigned i = 0; i < indexer_count; ++i) indexers[i]->thread = std::thread(&IndexingPipeline::index, this, i);
+}
+
+IndexingPipeline::~IndexingPipeline() {
+    if (!finished) finish();
+}
+
+void IndexingPipeline::push(std::string url, std::string raw) {
+    read_stats.busy_seconds += seconds_since(last_push);
+    read_stats.bytes += raw.size();
+
+    size_t depth = raw_queue.size();
+    raw_depth_sum += depth;
+    raw_max_depth = std::max(raw_max_depth, depth);
+
+    // The indexer has not reached seq yet, so its position is never behind next's
+    uint64_t seq = read_stats.items++;
+    Indexer& target = indexerOf(seq);
+    auto in_window = [&] { return position(seq) - position(target.next.load()) < reorder_window; };
+    if (!in_window()) {
+        std::unique_lock lock(window_mutex);
+        reader_waiting = true;
+        window_moved.wait(lock, in_window);
+        reader_waiting = false;
+    }
+    raw_queue.push({seq, std::move(url), std::move(raw)});
+    last_push = Clock::now();
+}
+
+void IndexingPipeline::parse(unsigned worker) {
+    StageStats& stats = parse_stats[worker];
+    const Tokenizer& tokenizer = indexator->getTokenizer();
+    std::string text;
+
+    while (auto doc = raw_queue.pop()) {
+        auto start = Clock::now();
+        text.clear();
+        extract(doc->raw, text);
+        ParsedDocument parsed{doc->seq, std::move(doc->url), {}};
+        tokenizer.tokenize(text, parsed.tokens);
+        stats.items++;
+        stats.bytes += doc->raw.size();
+        stats.busy_seconds += seconds_since(start);
+
+        Indexer& target = indexerOf(doc->seq);
+        size_t depth = target.queue.size();
+        target.depth_sum.fetch_add(depth, std::memory_order_relaxed);
+        size_t seen = target.max_depth.load(std::memory_order_relaxed);
+        while (depth > seen && !target.max_depth.compare_exchange_weak(seen, depth, std::memory_order_relaxed)) {
+        }
+        target.queue.push(std::move(parsed));
+    }
+}
+
+void IndexingPipeline::index(unsigned number) {
+    Indexer& self = *indexers[number];
+    const uint64_t stride = (indexers.size() - 1) * shard_docs;
+    std::shared_ptr<IIndexator> current = indexator;
+
+    // Workers finish out of order; hold documents back until every earlier one of this indexer is indexed
+    std::map<uint64_t, ParsedDocument> pending;
+    uint64_t next = number * shard_docs;
+
+    while (auto doc = self.queue.pop()) {
+        pending.emplace(doc->seq, std::move(*doc));
+        self.max_reorder = std::max(self.max_reorder, pending.size() - 1);
+        for (auto it = pending.begin(); it != pending.end() && it->first == next; it = pending.erase(it)) {
+            auto start = Clock::now();
+            if (make_indexator && next % shard_docs == 0) {
+                uint64_t shard = next / shard_docs;
+                auto source = shard == 0 ? first_shard : std::make_shared<RamIndexSource>();
+                current = shard == 0 ? indexator : make_indexator(source);
+                self.shards.emplace_back(shard, std::move(source));
+            }
+            current->addTokens(it->second.url, it->second.tokens);
+            self.stats.items++;
+            self.stats.bytes += it->second.tokens.size();
+            self.stats.busy_seconds += seconds_since(start);
+            // The following shard_docs documents belong to the other indexers
+            if (++next % shard_docs == 0) next += stride;
+        }
+        if (self.next.load(std::memory_order_relaxed) != next) {
+            self.next = next;
+            // The reader sets the flag before its last check under the lock, so this wakeup is never lost
+            if (reader_waiting) {
+                std::lock_guard lock(window_mutex);
+                window_moved.notify_one();
+            }
+        }
+    }
+}
+
+PipelineStats IndexingPipeline::finish() {
+    PipelineStats stats;
+    if (finished) return stats;
+    finished = true;
+
+    raw_queue.close();
+    for (auto& parser : parsers) parser.join();
+    for (auto& indexer : indexers) indexer->queue.close();
+    for (auto& indexer : indexers) indexer->thread.join();
+
+    stats.read = read_stats;
+
+    stats.parse.threads = workers();
+    for (const auto& worker : parse_stats) {
+        stats.parse.items += worker.items;
+        stats.parse.bytes += worker.bytes;
+        stats.parse.busy_seconds += worker.busy_seconds;
+    }
+    stats.parse.max_depth = raw_max_depth;
+    stats.parse.avg_depth = read_stats.items ? (double)raw_depth_sum / read_stats.items : 0.;
+
+    stats.index.threads = (unsigned)indexers.size();
+    uint64_t depth_sum = 0;
+    std::vector<std::pair<uint64_t, std::shared_ptr<RamIndexSource>>> numbered;
+    for (const auto& indexer : indexers) {
+        stats.index.items += indexer->stats.items;
+        stats.index.bytes += indexer->stats.bytes;
+        stats.index.busy_seconds += indexer->stats.busy_seconds;
+        stats.index.max_depth = std::max(stats.index.max_depth, indexer->max_depth.load());
+        stats.max_reorder = std::max(stats.max_reorder, indexer->max_reorder);
+        depth_sum += indexer->depth_sum.load();
+        numbered.insert(numbered.end(), indexer->shards.begin(), indexer->shards.end());
+    }
+    stats.index.avg_depth = stats.index.items ? (double)depth_sum / stats.index.items : 0.;
+    std::sort(numbered.begin(), numbered.end());
+    for (auto& [shard, source] : numbered) finished_shards.push_back(std::move(source));
+    stats.seconds = seconds_since(started);
+    return stats;
+}
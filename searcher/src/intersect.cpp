@@ -0,0 +1,152 @@
+#include "intersect.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define INTERSECT_X86 1
+#endif
+
+namespace Intersect {
+
+namespace {
+
+// Plain merge over what is left, stops when either side runs out
+std::pair<size_t, size_t> mergeTail(std::span<const TermInfo> a, std::span<const TermInfo> b, size_t i, size_t j,
+                                    std::vector<TermInfo>& out) {
+    while (i < a.size() && j < b.size()) {
+        uint32_t x = a[i].doc_id, y = b[j].doc_id;
+        if (x == y) out.push_back(a[i]);
+        i += x <= y;
+        j += y <= x;
+    }
+    return {i, j};
+}
+
+// First position at or after `from` whose doc is >= target: exponential steps, then binary search
+size_t gallop(std::span<const TermInfo> list, size_t from, uint32_t target) {
+    size_t bound = 1;
+    while (from + bound < list.size() && list[from + bound].doc_id < target) bound *= 2;
+    auto first = list.begin() + from + bound / 2;
+    auto last = list.begin() + std::min(from + bound + 1, list.size());
+    return std::lower_bound(first, last, target, [](const TermInfo& t, uint32_t v) { return t.doc_id < v; }) - list.begin();
+}
+
+void intersectGallop(std::span<const TermInfo> a, std::span<const TermInfo> b, std::vector<TermInfo>& out) {
+    if (a.size() <= b.size()) {
+        size_t j = 0;
+        for (size_t i = 0; i < a.size() && j < b.size(); ++i) {
+            j = gallop(b, j, a[i].doc_id);
+            if (j < b.size() && b[j].doc_id == a[i].doc_id) out.push_back(a[i]);
+        }
+    } else {
+        size_t i = 0;
+        for (size_t j = 0; j < b.size() && i < a.size(); ++j) {
+            i = gallop(a, i, b[j].doc_id);
+            if (i < a.size() && a[i].doc_id == b[j].doc_id) out.push_back(a[i]);
+        }
+    }
+}
+
+#ifdef INTERSECT_X86
+// Doc ids of four consecutive TermInfo entries
+inline __m128i docs4(const TermInfo* p) {
+    __m128 lo = _mm_loadu_ps(reinterpret_cast<const float*>(p));
+    __m128 hi = _mm_loadu_ps(reinterpret_cast<const float*>(p + 2));
+    return _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+inline void emitMatches(const TermInfo* a, unsigned mask, std::vector<TermInfo>& out) {
+    while (mask) {
+        out.push_back(a[__builtin_ctz(mask)]);
+        mask &= mask - 1;
+    }
+}
+
+std::pair<size_t, size_t> prefixSse(std::span<const TermInfo> a, std::span<const TermInfo> b, std::vector<TermInfo>& out) {
+    size_t i = 0, j = 0;
+    while (i + 4 <= a.size() && j + 4 <= b.size()) {
+        __m128i va = docs4(&a[i]);
+        __m128i vb = docs4(&b[j]);
+        // Every rotation of b against a covers all 16 pairs
+        __m128i eq = _mm_cmpeq_epi32(va, vb);
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1))));
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))));
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3))));
+        emitMatches(&a[i], (unsigned)_mm_movemask_ps(_mm_castsi128_ps(eq)), out);
+
+        uint32_t a_last = a[i + 3].doc_id, b_last = b[j + 3].doc_id;
+        i += a_last <= b_last ? 4 : 0;
+        j += b_last <= a_last ? 4 : 0;
+    }
+    return mergeTail(a, b, i, j, out);
+}
+
+__attribute__((target("avx2"))) inline __m256i docs8(const TermInfo* p) {
+    __m256 lo = _mm256_loadu_ps(reinterpret_cast<const float*>(p));
+    __m256 hi = _mm256_loadu_ps(reinterpret_cast<const float*>(p + 4));
+    // In-lane shuffle gives docs 0 1 4 5 | 2 3 6 7, the 64-bit permute restores the order
+    __m256 mixed = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+    return _mm256_permute4x64_epi64(_mm256_castps_si256(mixed), _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+__attribute__((target("avx2"))) std::pair<size_t, size_t> prefixAvx2(std::span<const TermInfo> a, std::span<const TermInfo> b,
+                                                                     std::vector<TermInfo>& out) {
+    const __m256i rotate = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+    size_t i = 0, j = 0;
+    while (i + 8 <= a.size() && j + 8 <= b.size()) {
+        __m256i va = docs8(&a[i]);
+        __m256i vb = docs8(&b[j]);
+        __m256i eq = _mm256_cmpeq_epi32(va, vb);
+        for (int r = 1; r < 8; ++r) {
+            vb = _mm256_permutevar8x32_epi32(vb, rotate);
+            eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(va, vb));
+        }
+        emitMatches(&a[i], (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(eq)), out);
+
+        uint32_t a_last = a[i + 7].doc_id, b_last = b[j + 7].doc_id;
+        i += a_last <= b_last ? 8 : 0;
+        j += b_last <= a_last ? 8 : 0;
+    }
+    return mergeTail(a, b, i, j, out);
+}
+#endif
+
+std::pair<size_t, size_t> prefix(std::span<const TermInfo> a, std::span<const TermInfo> b, std::vector<TermInfo>& out,
+                                 Kernel kernel) {
+#ifdef INTERSECT_X86
+    if (kernel == Kernel::Avx2 && avx2Available()) return prefixAvx2(a, b, out);
+    if (kernel == Kernel::Avx2 || kernel == Kernel::Sse) return prefixSse(a, b, out);
+#endif
+    return mergeTail(a, b, 0, 0, out);
+}
+
+}  // namespace
+
+bool avx2Available() {
+#ifdef INTERSECT_X86
+    static const bool available = __builtin_cpu_supports("avx2");
+    return available;
+#else
+    return false;
+#endif
+}
+
+std::pair<size_t, size_t> intersectPrefix(std::span<const TermInfo> a, std::span<const TermInfo> b, std::vector<TermInfo>& out) {
+    return prefix(a, b, out, Kernel::Avx2);
+}
+
+void intersect(std::span<const TermInfo> a, std::span<const TermInfo> b, std::vector<TermInfo>& out, Kernel kernel) {
+    if (a.empty() || b.empty()) return;
+    if (kernel == Kernel::Auto) {
+        size_t shorter = std::min(a.size(), b.size()), longer = std::max(a.size(), b.size());
+        kernel = longer / shorter >= GALLOP_RATIO ? Kernel::Gallop : Kernel::Avx2;
+    }
+    if (kernel == Kernel::Gallop) {
+        intersectGallop(a, b, out);
+    } else {
+        prefix(a, b, out, kernel);
+    }
+}
+
+}  // namespace Intersect
@@ -0,0 +1,107 @@
+#include "perfect_hash.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+namespace PerfectHash {
+
+namespace {
+
+const uint32_t AVG_BUCKET_SIZE = 4;
+const uint32_t MAX_PILOT = 1u << 24;
+const int MAX_ATTEMPTS = 16;
+
+inline uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+inline uint32_t bucketOf(uint64_t key_hash, const Header& header) {
+    return (uint32_t)(mix(key_hash ^ header.seed) % header.num_buckets);
+}
+
+inline uint32_t slotOf(uint64_t key_hash, uint32_t pilot, const Header& header) {
+    return (uint32_t)(mix(key_hash ^ header.seed ^ (pilot * 0x9E3779B97F4A7C15ULL)) % header.num_keys);
+}
+
+bool tryBuild(const std::vector<uint64_t>& hashes, Table& table) {
+    const Header& header = table.header;
+    std::vector<std::vector<uint32_t>> buckets(header.num_buckets);
+    for (uint32_t i = 0; i < hashes.size(); ++i) buckets[bucketOf(hashes[i], header)].push_back(i);
+
+    // Big buckets first, while the table is still mostly empty
+    std::vector<uint32_t> order(header.num_buckets);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return buckets[a].size() > buckets[b].size(); });
+
+    std::vector<bool> taken(header.num_keys, false);
+    std::vector<uint32_t> slots;
+    table.pilots.assign(header.num_buckets, 0);
+
+    for (uint32_t b : order) {
+        const auto& keys = buckets[b];
+        if (keys.empty()) break;
+
+        bool placed = false;
+        for (uint32_t pilot = 0; pilot < MAX_PILOT && !placed; ++pilot) {
+            slots.clear();
+            placed = true;
+            for (uint32_t k : keys) {
+                uint32_t s = slotOf(hashes[k], pilot, header);
+                if (taken[s] || std::find(slots.begin(), slots.end(), s) != slots.end()) {
+                    placed = false;
+                    break;
+                }
+                slots.push_back(s);
+            }
+            if (placed) {
+                for (uint32_t s : slots) taken[s] = true;
+                table.pilots[b] = pilot;
+            }
+        }
+        if (!placed) return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+uint64_t hash(std::string_view key) {
+    uint64_t h = 14695981039346656037ULL;
+    for (char c : key) {
+        h ^= (uint8_t)c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+Table build(const std::vector<uint64_t>& hashes) {
+    Table table;
+    table.header.num_keys = (uint32_t)hashes.size();
+    table.header.num_buckets = std::max<uint32_t>(1, (table.header.num_keys + AVG_BUCKET_SIZE - 1) / AVG_BUCKET_SIZE);
+    if (hashes.empty()) {
+        table.pilots.assign(table.header.num_buckets, 0);
+        return table;
+    }
+
+    std::vector<uint64_t> sorted(hashes);
+    std::sort(sorted.begin(), sorted.end());
+    if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) throw std::runtime_error("Duplicate key hashes");
+
+    for (int attempt = 0; attempt < MAX_ATTEMPTS; ++attempt) {
+        table.header.seed = mix(0x5EED + attempt);
+        if (tryBuild(hashes, table)) return table;
+    }
+    throw std::runtime_error("Cannot build perfect hash");
+}
+
+uint32_t slot(uint64_t key_hash, const Header& header, const uint32_t* pilots) {
+    return slotOf(key_hash, pilots[bucketOf(key_hash, header)], header);
+}
+
+}  // namespace PerfectHash
@@ -0,0 +1,89 @@
+#include "posting_cache.h"
+
+#include <algorithm>
+
+#include "index.h"
+
+FrequencySketch::FrequencySketch(size_t expected_keys) {
+    width = 64;
+    while (width < expected_keys && width < (1u << 20)) width *= 2;
+    counters.assign(ROWS * width, 0);
+    sample_size = 10 * width;
+}
+
+size_t FrequencySketch::slot(uint32_t key, int row) const {
+    static const uint64_t SEEDS[ROWS] = {0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL,
+                                         0xD6E8FEB86659FD93ULL};
+    uint64_t h = (key + 1) * SEEDS[row];
+    h ^= h >> 29;
+    return row * width + (h & (width - 1));
+}
+
+void FrequencySketch::record(uint32_t key) {
+    for (int row = 0; row < ROWS; ++row) {
+        uint8_t& counter = counters[slot(key, row)];
+        if (counter < MAX_COUNT) ++counter;
+    }
+    if (++additions >= sample_size) {
+        for (auto& counter : counters) counter >>= 1;
+        additions /= 2;
+    }
+}
+
+uint32_t FrequencySketch::estimate(uint32_t key) const {
+    uint32_t count = MAX_COUNT;
+    for (int row = 0; row < ROWS; ++row) count = std::min<uint32_t>(count, counters[slot(key, row)]);
+    return count;
+}
+
+PostingCache::PostingCache(size_t budget_bytes, size_t expected_terms) : budget(budget_bytes), sketch(expected_terms) {}
+
+PostingCache::List PostingCache::find(uint32_t term) {
+    std::lock_guard<std::mutex> lock(mutex);
+    sketch.record(term);
+    auto it = entries.find(term);
+    if (it == entries.end()) {
+        ++counters.misses;
+        return nullptr;
+    }
+    lru.splice(lru.begin(), lru, it->second.position);
+    ++counters.hits;
+    return it->second.list;
+}
+
+bool PostingCache::shouldAdmit(uint32_t term, size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t frequency = sketch.estimate(term);
+    // First sight only warms the sketch: one-off terms are never decoded
+    bool admit = bytes <= budget && frequency >= 2;
+    size_t freed = 0;
+    for (auto it = lru.rbegin(); admit && it != lru.rend() && used - freed + bytes > budget; ++it) {
+        admit = sketch.estimate(*it) < frequency;
+        freed += entries.at(*it).bytes;
+    }
+    if (!admit) ++counters.rejected;
+    return admit;
+}
+
+void PostingCache::insert(uint32_t term, List list) {
+    size_t bytes = list->size() * sizeof(TermInfo);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entries.count(term) || bytes > budget) return;
+    while (used + bytes > budget) {
+        auto victim = entries.find(lru.back());
+        used -= victim->second.bytes;
+        entries.erase(victim);
+        lru.pop_back();
+    }
+    lru.push_front(term);
+    entries.emplace(term, Entry{std::move(list), bytes, lru.begin()});
+    used += bytes;
+    ++counters.admitted;
+}
+
+PostingCache::Stats PostingCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats result = counters;
+    result.bytes = used;
+    return result;
+}
@@ -0,0 +1,47 @@
+#include "query_executor.h"
+
+#include <algorithm>
+
+QueryExecutor::QueryExecutor(std::shared_ptr<const ISearcher> s, unsigned threads) : searcher(std::move(s)) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    workers.reserve(threads);
+    for (unsigned t = 0; t < threads; ++t) workers.emplace_back(&QueryExecutor::work, this);
+}
+
+QueryExecutor::~QueryExecutor() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    ready.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+std::future<std::vector<SearchHit>> QueryExecutor::submit(std::string query, size_t k, size_t offset) {
+    Task task{std::move(query), k, offset, {}};
+    auto result = task.result.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(task));
+    }
+    ready.notify_one();
+    return result;
+}
+
+void QueryExecutor::work() {
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+        try {
+            task.result.set_value(searcher->findDocument(task.query, task.k, task.offset));
+        } catch (...) {
+            task.result.set_exception(std::current_exception());
+        }
+    }
+}
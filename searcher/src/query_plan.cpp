@@ -0,0 +1,243 @@
+#include "query_plan.h"
+
+#include <algorithm>
+
+#include "roaring.h"
+#include "searcher.h"
+
+QueryPlan::QueryPlan(int total_docs) : total_docs((uint64_t)std::max(total_docs, 0)) {}
+
+uint32_t QueryPlan::addNode(Node node) {
+    auto it = by_key.find(node.key);
+    if (it != by_key.end()) return it->second;
+    uint32_t id = (uint32_t)nodes.size();
+    by_key.emplace(node.key, id);
+    nodes.push_back(std::move(node));
+    return id;
+}
+
+void QueryPlan::pushTerm(const std::string& term, PostingCursor cursor) {
+    Node node{Kind::Term, term};
+    node.cost = cursor.size();
+    node.cursors.push_back(std::move(cursor));
+    stack.push_back(addNode(std::move(node)));
+}
+
+void QueryPlan::pushPrefix(const std::string& prefix, std::vector<PostingCursor> expansions) {
+    Node node{Kind::Prefix, prefix + "*"};
+    for (const auto& cursor : expansions) node.cost += cursor.size();
+    node.cost = std::min(node.cost, total_docs);
+    node.cursors = std::move(expansions);
+    stack.push_back(addNode(std::move(node)));
+}
+
+void QueryPlan::applyNot() {
+    if (stack.empty()) return;
+    const Node& child = nodes[stack.back()];
+    Node node{Kind::Not, "!(" + child.key + ")"};
+    // Only a term's cost is exact; complementing any other upper bound would not be one
+    node.cost = child.kind == Kind::Term ? total_docs - std::min(child.cost, total_docs) : total_docs;
+    node.children.push_back(stack.back());
+    stack.back() = addNode(std::move(node));
+}
+
+void QueryPlan::applyAnd() { applyNary(Kind::And); }
+
+void QueryPlan::applyOr() { applyNary(Kind::Or); }
+
+void QueryPlan::applyNary(Kind kind) {
+    if (stack.size() < 2) return;
+    std::vector<uint32_t> operands(stack.end() - 2, stack.end());
+    stack.resize(stack.size() - 2);
+
+    // Flatten (a & b) & c into &(a, b, c)
+    Node node{kind};
+    for (uint32_t id : operands) {
+        const Node& operand = nodes[id];
+        if (operand.kind == kind) {
+            node.children.insert(node.children.end(), operand.children.begin(), operand.children.end());
+        } else {
+            node.children.push_back(id);
+        }
+    }
+    // Shared subexpressions have one id, so duplicates are equal ids
+    std::sort(node.children.begin(), node.children.end());
+    node.children.erase(std::unique(node.children.begin(), node.children.end()), node.children.end());
+    if (node.children.size() == 1) {
+        stack.push_back(node.children[0]);
+        return;
+    }
+
+    // Cheapest first; the key uses the same order, ties broken by key so it stays canonical
+    std::sort(node.children.begin(), node.children.end(), [&](uint32_t a, uint32_t b) {
+        return nodes[a].cost != nodes[b].cost ? nodes[a].cost < nodes[b].cost : nodes[a].key < nodes[b].key;
+    });
+    node.key = kind == Kind::And ? "&(" : "|(";
+    for (size_t i = 0; i < node.children.size(); ++i) {
+        const Node& child = nodes[node.children[i]];
+        if (i > 0) node.key += ",";
+        node.key += child.key;
+        if (kind == Kind::And) {
+            node.cost = i == 0 ? child.cost : std::min(node.cost, child.cost);
+        } else {
+            node.cost = std::min(node.cost + child.cost, total_docs);
+        }
+    }
+    node.key += ")";
+    stack.push_back(addNode(std::move(node)));
+}
+
+PostingCursor QueryPlan::resultCursor(const Node& node) {
+    if (!node.bits.empty()) return PostingCursor::fromRoaring(node.bits.data());
+    return PostingCursor(std::span<const TermInfo>(node.result));
+}
+
+PostingCursor QueryPlan::run(uint32_t id) {
+    Node& node = nodes[id];
+    if (node.kind == Kind::Term) return node.cursors[0];
+    if (node.evaluated) return resultCursor(node);
+
+    // The result is either a list or, when every operand so far was a Roaring set, a set in bits
+    std::vector<TermInfo> result;
+    std::string bits;
+    switch (node.kind) {
+        case Kind::Prefix: {
+            std::vector<PostingCursor> cursors(node.cursors);
+            result = union_many(cursors);
+            break;
+        }
+        case Kind::Not: {
+            PostingCursor child = run(node.children[0]);
+            result = not_list(child, (int)total_docs);
+            break;
+        }
+        case Kind::And: {
+            // Nothing to do when the rarest operand is already empty; costs are upper bounds, so 0 is exact
+            if (node.cost == 0) break;
+            std::vector<uint32_t> positive, negated;
+            for (uint32_t child : node.children) (nodes[child].kind == Kind::Not ? negated : positive).push_back(child);
+
+            if (positive.empty()) {
+                // !a & !b is the complement of a | b
+                std::vector<PostingCursor> cursors;
+                for (uint32_t child : negated) cursors.push_back(run(nodes[child].children[0]));
+                std::vector<TermInfo> excluded = union_many(cursors);
+                PostingCursor excluded_cursor{std::span<const TermInfo>(excluded)};
+                result = not_list(excluded_cursor, (int)total_docs);
+                break;
+            }
+
+            PostingCursor acc = run(positive[0]);
+            bool in_bits = false;
+            for (size_t i = 1; i < positive.size() && acc.valid(); ++i) {
+                PostingCursor next = run(positive[i]);
+                in_bits = acc.roaring() && next.roaring();
+                if (in_bits) {
+                    bits = Roaring::intersect(Roaring::Set(acc.roaring()), Roaring::Set(next.roaring()));
+                    acc = PostingCursor::fromRoaring(bits.data());
+                } else {
+                    result = intersect_lists(acc, next);
+                    acc = PostingCursor(std::span<const TermInfo>(result));
+                }
+            }
+            // Cheapest negations exclude the most documents, so they go first
+            for (size_t i = 0; i < negated.size() && acc.valid(); ++i) {
+                PostingCursor excluded = run(nodes[negated[i]].children[0]);
+                in_bits = acc.roaring() && excluded.roaring();
+                if (in_bits) {
+                    bits = Roaring::subtract(Roaring::Set(acc.roaring()), Roaring::Set(excluded.roaring()));
+                    acc = PostingCursor::fromRoaring(bits.data());
+                } else {
+                    result = difference_lists(acc, excluded);
+                    acc = PostingCursor(std::span<const TermInfo>(result));
+                }
+            }
+            if (!in_bits) bits.clear();
+            break;
+        }
+        case Kind::Or: {
+            std::vector<PostingCursor> cursors;
+            for (uint32_t child : node.children) cursors.push_back(run(child));
+            if (std::all_of(cursors.begin(), cursors.end(), [](const PostingCursor& c) { return c.roaring() != nullptr; })) {
+                bits = Roaring::unite(Roaring::Set(cursors[0].roaring()), Roaring::Set(cursors[1].roaring()));
+                for (size_t i = 2; i < cursors.size(); ++i) {
+                    bits = Roaring::unite(Roaring::Set(bits.data()), Roaring::Set(cursors[i].roaring()));
+                }
+            } else {
+                result = union_many(cursors);
+            }
+            break;
+        }
+        case Kind::Term:
+            break;
+    }
+    node.result = std::move(result);
+    node.bits = std::move(bits);
+    node.evaluated = true;
+    return resultCursor(node);
+}
+
+std::vector<TermInfo> QueryPlan::execute(size_t limit) {
+    if (stack.empty()) return {};
+    const Node& root = nodes[stack.back()];
+    if (root.kind == Kind::Not) {
+        PostingCursor excluded = run(root.children[0]);
+        return not_list(excluded, (int)total_docs, limit);
+    }
+
+    PostingCursor top = run(stack.back());
+    std::vector<TermInfo> result;
+    result.reserve(std::min<size_t>(top.size(), limit));
+    for (; top.valid() && result.size() < limit; top.next()) result.push_back(top.current());
+    return result;
+}
+
+bool QueryPlan::unscored() const {
+    if (stack.empty() || nodes[stack.back()].kind != Kind::Not) return false;
+    auto leaf = [&](uint32_t id) { return nodes[id].kind == Kind::Term || nodes[id].kind == Kind::Prefix; };
+    const Node& negated = nodes[nodes[stack.back()].children[0]];
+    if (negated.kind == Kind::Or) return std::all_of(negated.children.begin(), negated.children.end(), leaf);
+    return negated.kind == Kind::Term || negated.kind == Kind::Prefix;
+}
+
+std::string QueryPlan::describe() const { return stack.empty() ? "" : nodes[stack.back()].key; }
+
+std::string QueryPlan::canonicalQuery(const std::vector<std::string>& rpn) {
+    struct Operand {
+        char op = 0;  // '&' or '|' for an n-ary node, 0 otherwise
+        std::vector<std::string> children = {};
+        std::string key = {};
+    };
+    std::vector<Operand> stack;
+
+    for (const auto& token : rpn) {
+        if (token == "!") {
+            if (stack.empty()) continue;
+            stack.back() = {0, {}, "!(" + stack.back().key + ")"};
+        } else if (token == "&" || token == "|") {
+            if (stack.size() < 2) continue;
+            Operand node{token[0]};
+            for (size_t i = stack.size() - 2; i < stack.size(); ++i) {
+                if (stack[i].op == node.op) {
+                    node.children.insert(node.children.end(), stack[i].children.begin(), stack[i].children.end());
+                } else {
+                    node.children.push_back(stack[i].key);
+                }
+            }
+            stack.resize(stack.size() - 2);
+            std::sort(node.children.begin(), node.children.end());
+            node.children.erase(std::unique(node.children.begin(), node.children.end()), node.children.end());
+            if (node.children.size() == 1) {
+                stack.push_back({0, {}, node.children[0]});
+                continue;
+            }
+            node.key = std::string(1, node.op) + "(";
+            for (size_t i = 0; i < node.children.size(); ++i) node.key += (i ? "," : "") + node.children[i];
+            node.key += ")";
+            stack.push_back(std::move(node));
+        } else {
+            stack.push_back({0, {}, token});
+        }
+    }
+    return stack.empty() ? "" : stack.back().key;
+}
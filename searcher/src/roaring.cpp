@@ -0,0 +1,412 @@
+#include "roaring.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "stream_vbyte.h"
+
+namespace Roaring {
+
+namespace {
+
+inline bool testBit(const uint64_t* words, uint16_t low) { return (words[low >> 6] >> (low & 63)) & 1; }
+
+inline void setBit(uint64_t* words, uint16_t low) { words[low >> 6] |= uint64_t(1) << (low & 63); }
+
+inline uint32_t popcount(const uint64_t* words) {
+    uint32_t card = 0;
+    for (uint32_t i = 0; i < BITMAP_WORDS; ++i) card += (uint32_t)__builtin_popcountll(words[i]);
+    return card;
+}
+
+// Collects containers in key order and lays the set out once they are all known
+class Writer {
+public:
+    void addArray(uint16_t key, const uint16_t* values, uint32_t n) {
+        if (n == 0) return;
+        if (n > ARRAY_MAX) {
+            uint64_t words[BITMAP_WORDS] = {};
+            for (uint32_t i = 0; i < n; ++i) setBit(words, values[i]);
+            addPayload(key, ContainerType::Bitmap, n, words, sizeof(words));
+        } else {
+            addPayload(key, ContainerType::Array, n, values, n * sizeof(uint16_t));
+        }
+    }
+
+    void addBitmap(uint16_t key, const uint64_t* words, uint32_t card) {
+        if (card == 0) return;
+        if (card <= ARRAY_MAX) {
+            std::vector<uint16_t> values;
+            values.reserve(card);
+            for (uint32_t w = 0; w < BITMAP_WORDS; ++w) {
+                for (uint64_t bits = words[w]; bits; bits &= bits - 1) {
+                    values.push_back((uint16_t)(w * 64 + __builtin_ctzll(bits)));
+                }
+            }
+            addPayload(key, ContainerType::Array, card, values.data(), card * sizeof(uint16_t));
+        } else {
+            addPayload(key, ContainerType::Bitmap, card, words, BITMAP_WORDS * sizeof(uint64_t));
+        }
+    }
+
+    void finish(const std::vector<uint32_t>& tf_offsets, const std::string& tf_data, std::string& out) {
+        size_t header_size = sizeof(Header) + containers.size() * sizeof(Container) + tf_offsets.size() * sizeof(uint32_t);
+        header_size = (header_size + 7) / 8 * 8;
+
+        Header header = {(uint32_t)containers.size(), cardinality, (uint32_t)tf_offsets.size(), 0};
+        for (auto& c : containers) c.offset += (uint32_t)header_size;
+
+        size_t base = out.size();
+        out.resize(base + header_size);
+        char* dst = out.data() + base;
+        std::memcpy(dst, &header, sizeof(header));
+        std::memcpy(dst + sizeof(header), containers.data(), containers.size() * sizeof(Container));
+        for (size_t i = 0; i < tf_offsets.size(); ++i) {
+            uint32_t offset = (uint32_t)(header_size + payload.size()) + tf_offsets[i];
+            std::memcpy(dst + sizeof(header) + containers.size() * sizeof(Container) + i * sizeof(uint32_t), &offset,
+                        sizeof(offset));
+        }
+        out += payload;
+        out += tf_data;
+    }
+
+    std::string finish() {
+        std::string out;
+        finish({}, {}, out);
+        return out;
+    }
+
+    // Copies a container unchanged, payload points at its values or words
+    void addContainer(const Container& c, const char* payload) {
+        size_t size = c.type == ContainerType::Array ? c.cardinality * sizeof(uint16_t) : BITMAP_WORDS * sizeof(uint64_t);
+        addPayload(c.key, c.type, c.cardinality, payload, size);
+    }
+
+private:
+    void addPayload(uint16_t key, ContainerType type, uint32_t card, const void* bytes, size_t size) {
+        containers.push_back({key, type, card, cardinality, (uint32_t)payload.size()});
+        cardinality += card;
+        payload.append(reinterpret_cast<const char*>(bytes), size);
+        payload.resize((payload.size() + 7) / 8 * 8, '\0');
+    }
+
+    std::vector<Container> containers;
+    std::string payload;
+    uint32_t cardinality = 0;
+};
+
+}  // namespace
+
+void append(std::span<const uint32_t> docs, std::span<const uint32_t> tfs, std::string& out) {
+    Writer writer;
+    std::vector<uint16_t> values;
+    for (size_t i = 0; i < docs.size();) {
+        uint16_t key = (uint16_t)(docs[i] >> 16);
+        values.clear();
+        for (; i < docs.size() && (docs[i] >> 16) == key; ++i) values.push_back((uint16_t)docs[i]);
+        writer.addArray(key, values.data(), (uint32_t)values.size());
+    }
+
+    std::vector<uint32_t> tf_offsets;
+    std::string tf_data;
+    for (size_t begin = 0; begin < tfs.size(); begin += TF_BLOCK_SIZE) {
+        uint32_t n = (uint32_t)std::min<size_t>(TF_BLOCK_SIZE, tfs.size() - begin);
+        tf_offsets.push_back((uint32_t)tf_data.size());
+        size_t offset = tf_data.size();
+        tf_data.resize(offset + StreamVByte::encodedSize(tfs.data() + begin, n));
+        StreamVByte::encode(tfs.data() + begin, n, reinterpret_cast<uint8_t*>(tf_data.data() + offset));
+    }
+    writer.finish(tf_offsets, tf_data, out);
+}
+
+namespace {
+
+// Regroups the tfs of the batches into TF_BLOCK_SIZE blocks, as append() cuts them
+void forEachTfBlock(const Batches& batches, const std::function<void(const uint32_t* tfs, uint32_t n)>& visit) {
+    uint32_t block[TF_BLOCK_SIZE];
+    uint32_t n = 0;
+    batches([&](const uint32_t*, const uint32_t* tfs, uint32_t count) {
+        for (uint32_t i = 0; i < count; ++i) {
+            block[n++] = tfs[i];
+            if (n == TF_BLOCK_SIZE) {
+                visit(block, n);
+                n = 0;
+            }
+        }
+    });
+    if (n > 0) visit(block, n);
+}
+
+// Every container as a bitmap of its docs, in key order
+void forEachContainer(const Batches& batches,
+                      const std::function<void(uint16_t key, const uint64_t* words, uint32_t card)>& visit) {
+    uint64_t words[BITMAP_WORDS];
+    uint16_t key = 0;
+    uint32_t card = 0;
+    batches([&](const uint32_t* docs, const uint32_t*, uint32_t count) {
+        for (uint32_t i = 0; i < count; ++i) {
+            uint16_t doc_key = (uint16_t)(docs[i] >> 16);
+            if (card > 0 && doc_key != key) {
+                visit(key, words, card);
+                card = 0;
+            }
+            if (card == 0) {
+                std::memset(words, 0, sizeof(words));
+                key = doc_key;
+            }
+            setBit(words, (uint16_t)docs[i]);
+            ++card;
+        }
+    });
+    if (card > 0) visit(key, words, card);
+}
+
+uint64_t payloadSize(uint32_t card) {
+    uint64_t size = card > ARRAY_MAX ? BITMAP_WORDS * sizeof(uint64_t) : card * sizeof(uint16_t);
+    return (size + 7) / 8 * 8;
+}
+
+}  // namespace
+
+StreamWriter::StreamWriter(Batches source) : batches(std::move(source)) {
+    forEachContainer(batches, [&](uint16_t key, const uint64_t*, uint32_t card) {
+        ContainerType type = card > ARRAY_MAX ? ContainerType::Bitmap : ContainerType::Array;
+        containers.push_back({key, type, card, cardinality, (uint32_t)payload_size});
+        cardinality += card;
+        payload_size += payloadSize(card);
+    });
+    forEachTfBlock(batches, [&](const uint32_t* tfs, uint32_t n) {
+        ++num_tf_blocks;
+        tf_size += StreamVByte::encodedSize(tfs, n);
+    });
+    header_size = sizeof(Header) + containers.size() * sizeof(Container) + num_tf_blocks * sizeof(uint32_t);
+    header_size = (header_size + 7) / 8 * 8;
+}
+
+void StreamWriter::write(std::ostream& out) const {
+    const char zeros[8] = {};
+    Header header = {(uint32_t)containers.size(), cardinality, num_tf_blocks, 0};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (Container c : containers) {
+        c.offset += (uint32_t)header_size;
+        out.write(reinterpret_cast<const char*>(&c), sizeof(c));
+    }
+    uint64_t tf_offset = header_size + payload_size;
+    forEachTfBlock(batches, [&](const uint32_t* tfs, uint32_t n) {
+        uint32_t offset = (uint32_t)tf_offset;
+        out.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+        tf_offset += StreamVByte::encodedSize(tfs, n);
+    });
+    uint64_t written = sizeof(Header) + containers.size() * sizeof(Container) + num_tf_blocks * sizeof(uint32_t);
+    out.write(zeros, header_size - written);
+
+    std::vector<uint16_t> values;
+    forEachContainer(batches, [&](uint16_t, const uint64_t* words, uint32_t card) {
+        if (card > ARRAY_MAX) {
+            out.write(reinterpret_cast<const char*>(words), BITMAP_WORDS * sizeof(uint64_t));
+            return;
+        }
+        values.clear();
+        for (uint32_t w = 0; w < BITMAP_WORDS; ++w) {
+            for (uint64_t bits = words[w]; bits; bits &= bits - 1) values.push_back((uint16_t)(w * 64 + __builtin_ctzll(bits)));
+        }
+        out.write(reinterpret_cast<const char*>(values.data()), card * sizeof(uint16_t));
+        out.write(zeros, payloadSize(card) - card * sizeof(uint16_t));
+    });
+
+    // A block of TF_BLOCK_SIZE tfs takes at most a control byte per 4 of them plus 4 bytes each
+    uint8_t encoded[TF_BLOCK_SIZE / 4 + TF_BLOCK_SIZE * sizeof(uint32_t)];
+    forEachTfBlock(batches, [&](const uint32_t* tfs, uint32_t n) {
+        out.write(reinterpret_cast<const char*>(encoded), StreamVByte::encode(tfs, n, encoded));
+    });
+}
+
+bool Set::contains(uint32_t doc) const {
+    const Container* first = containers();
+    const Container* last = first + header().num_containers;
+    uint16_t key = (uint16_t)(doc >> 16);
+    auto it = std::lower_bound(first, last, key, [](const Container& c, uint16_t k) { return c.key < k; });
+    if (it == last || it->key != key) return false;
+    if (it->type == ContainerType::Bitmap) return testBit(bitmap(*it), (uint16_t)doc);
+    return std::binary_search(array(*it), array(*it) + it->cardinality, (uint16_t)doc);
+}
+
+uint32_t Set::rank(uint32_t doc) const {
+    const Container* first = containers();
+    const Container* last = first + header().num_containers;
+    uint16_t key = (uint16_t)(doc >> 16);
+    auto it = std::lower_bound(first, last, key, [](const Container& c, uint16_t k) { return c.key < k; });
+    if (it == last) return header().cardinality;
+    if (it->key != key) return it->rank;
+
+    uint16_t low = (uint16_t)doc;
+    if (it->type == ContainerType::Array) {
+        return it->rank + (uint32_t)(std::lower_bound(array(*it), array(*it) + it->cardinality, low) - array(*it));
+    }
+    const uint64_t* words = bitmap(*it);
+    uint32_t rank = it->rank;
+    for (uint32_t w = 0; w < (uint32_t)(low >> 6); ++w) rank += (uint32_t)__builtin_popcountll(words[w]);
+    return rank + (uint32_t)__builtin_popcountll(words[low >> 6] & ((uint64_t(1) << (low & 63)) - 1));
+}
+
+void Set::decodeDocs(uint32_t from, uint32_t n, uint32_t* out) const {
+    const Container* first = containers();
+    const Container* last = first + header().num_containers;
+    const Container* c = std::upper_bound(first, last, from, [](uint32_t r, const Container& c) { return r < c.rank; }) - 1;
+
+    uint32_t skip = from - c->rank;
+    for (uint32_t done = 0; done < n; ++c, skip = 0) {
+        uint32_t high = (uint32_t)c->key << 16;
+        if (c->type == ContainerType::Array) {
+            const uint16_t* values = array(*c);
+            for (uint32_t i = skip; i < c->cardinality && done < n; ++i) out[done++] = high | values[i];
+            continue;
+        }
+        // Find the word holding the skip-th doc, then walk set bits
+        const uint64_t* words = bitmap(*c);
+        uint32_t w = 0;
+        for (uint32_t bits; skip >= (bits = (uint32_t)__builtin_popcountll(words[w])); ++w) skip -= bits;
+        uint64_t word = words[w];
+        for (; skip > 0; --skip) word &= word - 1;
+        while (done < n) {
+            for (; word && done < n; word &= word - 1) out[done++] = high | (w * 64 + __builtin_ctzll(word));
+            if (++w == BITMAP_WORDS) break;
+            word = words[w];
+        }
+    }
+}
+
+void Set::decodeTfs(uint32_t block, uint32_t n, uint32_t* out) const {
+    if (!hasTfs()) {
+        std::fill(out, out + n, 0);
+        return;
+    }
+    const auto* tf_offsets = reinterpret_cast<const uint32_t*>(containers() + header().num_containers);
+    StreamVByte::decode(reinterpret_cast<const uint8_t*>(data + tf_offsets[block]), n, out);
+}
+
+std::string intersect(Set a, Set b) {
+    Writer writer;
+    const Container *ca = a.containers(), *ea = ca + a.header().num_containers;
+    const Container *cb = b.containers(), *eb = cb + b.header().num_containers;
+    std::vector<uint16_t> values;
+    uint64_t words[BITMAP_WORDS];
+
+    while (ca != ea && cb != eb) {
+        if (ca->key != cb->key) {
+            (ca->key < cb->key ? ca : cb)++;
+            continue;
+        }
+        if (ca->type == ContainerType::Bitmap && cb->type == ContainerType::Bitmap) {
+            const uint64_t *wa = a.bitmap(*ca), *wb = b.bitmap(*cb);
+            for (uint32_t i = 0; i < BITMAP_WORDS; ++i) words[i] = wa[i] & wb[i];
+            writer.addBitmap(ca->key, words, popcount(words));
+        } else {
+            values.clear();
+            if (ca->type == ContainerType::Array && cb->type == ContainerType::Array) {
+                std::set_intersection(a.array(*ca), a.array(*ca) + ca->cardinality, b.array(*cb), b.array(*cb) + cb->cardinality,
+                                      std::back_inserter(values));
+            } else {
+                // Probe the bitmap with every array value
+                bool a_array = ca->type == ContainerType::Array;
+                const uint16_t* arr = a_array ? a.array(*ca) : b.array(*cb);
+                uint32_t n = a_array ? ca->cardinality : cb->cardinality;
+                const uint64_t* bits = a_array ? b.bitmap(*cb) : a.bitmap(*ca);
+                for (uint32_t i = 0; i < n; ++i) {
+                    if (testBit(bits, arr[i])) values.push_back(arr[i]);
+                }
+            }
+            writer.addArray(ca->key, values.data(), (uint32_t)values.size());
+        }
+        ++ca;
+        ++cb;
+    }
+    return writer.finish();
+}
+
+std::string unite(Set a, Set b) {
+    Writer writer;
+    const Container *ca = a.containers(), *ea = ca + a.header().num_containers;
+    const Container *cb = b.containers(), *eb = cb + b.header().num_containers;
+    std::vector<uint16_t> values;
+    uint64_t words[BITMAP_WORDS];
+
+    auto load = [&](const Set& s, const Container& c) {
+        if (c.type == ContainerType::Bitmap) {
+            const uint64_t* src = s.bitmap(c);
+            for (uint32_t i = 0; i < BITMAP_WORDS; ++i) words[i] |= src[i];
+        } else {
+            for (uint32_t i = 0; i < c.cardinality; ++i) setBit(words, s.array(c)[i]);
+        }
+    };
+
+    while (ca != ea || cb != eb) {
+        if (cb == eb || (ca != ea && ca->key < cb->key)) {
+            writer.addContainer(*ca, a.bytes() + ca->offset);
+            ++ca;
+        } else if (ca == ea || cb->key < ca->key) {
+            writer.addContainer(*cb, b.bytes() + cb->offset);
+            ++cb;
+        } else {
+            if (ca->type == ContainerType::Array && cb->type == ContainerType::Array) {
+                values.clear();
+                std::set_union(a.array(*ca), a.array(*ca) + ca->cardinality, b.array(*cb), b.array(*cb) + cb->cardinality,
+                               std::back_inserter(values));
+                writer.addArray(ca->key, values.data(), (uint32_t)values.size());
+            } else {
+                std::fill(words, words + BITMAP_WORDS, 0);
+                load(a, *ca);
+                load(b, *cb);
+                writer.addBitmap(ca->key, words, popcount(words));
+            }
+            ++ca;
+            ++cb;
+        }
+    }
+    return writer.finish();
+}
+
+std::string subtract(Set a, Set b) {
+    Writer writer;
+    const Container *ca = a.containers(), *ea = ca + a.header().num_containers;
+    const Container *cb = b.containers(), *eb = cb + b.header().num_containers;
+    std::vector<uint16_t> values;
+    uint64_t words[BITMAP_WORDS];
+
+    for (; ca != ea; ++ca) {
+        while (cb != eb && cb->key < ca->key) ++cb;
+        if (cb == eb || cb->key != ca->key) {
+            writer.addContainer(*ca, a.bytes() + ca->offset);
+            continue;
+        }
+        if (ca->type == ContainerType::Bitmap) {
+            std::memcpy(words, a.bitmap(*ca), sizeof(words));
+            if (cb->type == ContainerType::Bitmap) {
+                const uint64_t* wb = b.bitmap(*cb);
+                for (uint32_t i = 0; i < BITMAP_WORDS; ++i) words[i] &= ~wb[i];
+            } else {
+                for (uint32_t i = 0; i < cb->cardinality; ++i) {
+                    uint16_t low = b.array(*cb)[i];
+                    words[low >> 6] &= ~(uint64_t(1) << (low & 63));
+                }
+            }
+            writer.addBitmap(ca->key, words, popcount(words));
+        } else {
+            values.clear();
+            const uint16_t* arr = a.array(*ca);
+            if (cb->type == ContainerType::Array) {
+                std::set_difference(arr, arr + ca->cardinality, b.array(*cb), b.array(*cb) + cb->cardinality,
+                                    std::back_inserter(values));
+            } else {
+                for (uint32_t i = 0; i < ca->cardinality; ++i) {
+                    if (!testBit(b.bitmap(*cb), arr[i])) values.push_back(arr[i]);
+                }
+            }
+            writer.addArray(ca->key, values.data(), (uint32_t)values.size());
+        }
+    }
+    return writer.finish();
+}
+
+}  // namespace Roaring
@@ -6,99 +6,175 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
 #include <cstring>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <span>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
 #include "index.h"
+#include "intersect.h"
+#include "query_plan.h"
+#include "score_accumulator.h"
 #include "tokenizer.h"
 
-std::vector<TermInfo> intersect_lists(std::span<const TermInfo> l1, std::span<const TermInfo> l2) {
+std::vector<TermInfo> intersect_lists(PostingCursor& c1, PostingCursor& c2) {
     std::vector<TermInfo> res;
-    res.reserve(std::min(l1.size(), l2.size()));
-    auto i1 = l1.begin(), i2 = l2.begin();
-
-    while (i1 != l1.end() && i2 != l2.end()) {
-        if (i1->doc_id < i2->doc_id)
-            i1++;
-        else if (i2->doc_id < i1->doc_id)
-            i2++;
-        else {
-            res.push_back(*i1);
-            i1++;
-            i2++;
+    res.reserve(std::min(c1.size(), c2.size()));
+
+    uint32_t shorter = std::min(c1.size(), c2.size()), longer = std::max(c1.size(), c2.size());
+    bool skewed = shorter > 0 && longer / shorter >= Intersect::GALLOP_RATIO;
+    while (c1.valid() && c2.valid()) {
+        uint32_t d1 = c1.doc(), d2 = c2.doc();
+        if (d1 < d2) {
+            c1.skipTo(d2);
+        } else if (d2 < d1) {
+            c2.skipTo(d1);
+        } else if (skewed) {
+            res.push_back(c1.current());
+            c1.next();
+            c2.next();
+        } else {
+            // Lists of similar length: run the block kernel over the decoded windows
+            auto [n1, n2] = Intersect::intersectPrefix(c1.buffered(), c2.buffered(), res);
+            c1.advance((uint32_t)n1);
+            c2.advance((uint32_t)n2);
         }
     }
     return res;
 }
 
-std::vector<TermInfo> union_lists(std::span<const TermInfo> l1, std::span<const TermInfo> l2) {
+std::vector<TermInfo> union_lists(PostingCursor& c1, PostingCursor& c2) {
     std::vector<TermInfo> res;
-    res.reserve(l1.size() + l2.size());
-    auto i1 = l1.begin(), i2 = l2.begin();
-
-    while (i1 != l1.end() || i2 != l2.end()) {
-        if (i1 == l1.end()) {
-            res.push_back(*i2++);
-            continue;
-        }
-        if (i2 == l2.end()) {
-            res.push_back(*i1++);
-            continue;
+    res.reserve(c1.size() + c2.size());
+
+    while (c1.valid() || c2.valid()) {
+        uint32_t d1 = c1.doc(), d2 = c2.doc();
+        if (d1 < d2) {
+            res.push_back(c1.current());
+            c1.next();
+        } else if (d2 < d1) {
+            res.push_back(c2.current());
+            c2.next();
+        } else {
+            res.push_back(c1.current());
+            c1.next();
+            c2.next();
         }
+    }
+    return res;
+}
 
-        if (i1->doc_id < i2->doc_id)
-            res.push_back(*i1++);
-        else if (i2->doc_id < i1->doc_id)
-            res.push_back(*i2++);
-        else {
-            res.push_back(*i1);
-            i1++;
-            i2++;
+std::vector<TermInfo> not_list(PostingCursor& c, int total_docs, size_t limit) {
+    std::vector<TermInfo> res;
+    res.reserve(std::min(limit, (size_t)std::max(0, total_docs - (int)c.size())));
+
+    for (int current_doc = 0; current_doc < total_docs && res.size() < limit; ++current_doc) {
+        if (c.doc() == (uint32_t)current_doc) {
+            c.next();
+        } else {
+            res.push_back({(uint32_t)current_doc, 0});
         }
     }
     return res;
 }
 
-std::vector<TermInfo> not_list(std::span<const TermInfo> l, int total_docs) {
+std::vector<TermInfo> difference_lists(PostingCursor& c1, PostingCursor& c2) {
+    std::vector<TermInfo> res;
+    res.reserve(c1.size());
+
+    for (; c1.valid(); c1.next()) {
+        c2.skipTo(c1.doc());
+        if (c2.doc() != c1.doc()) res.push_back(c1.current());
+    }
+    return res;
+}
+
+std::vector<TermInfo> union_many(std::vector<PostingCursor>& cursors) {
     std::vector<TermInfo> res;
-    res.reserve(std::max(0, total_docs - (int)l.size()));
-    int current_doc = 0;
-    auto it = l.begin();
+    auto later = [&](size_t a, size_t b) { return cursors[a].doc() > cursors[b].doc(); };
+    std::vector<size_t> heap;
+    for (size_t i = 0; i < cursors.size(); ++i) {
+        if (cursors[i].valid()) heap.push_back(i);
+    }
+    std::make_heap(heap.begin(), heap.end(), later);
 
-    while (current_doc < total_docs) {
-        if (it != l.end() && it->doc_id == (uint32_t)current_doc) {
-            it++;
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        PostingCursor& c = cursors[heap.back()];
+        if (!res.empty() && res.back().doc_id == c.doc()) {
+            res.back().tf += c.tf();
         } else {
-            res.push_back({(uint32_t)current_doc, 0});
+            res.push_back(c.current());
+        }
+        c.next();
+        if (c.valid()) {
+            std::push_heap(heap.begin(), heap.end(), later);
+        } else {
+            heap.pop_back();
         }
-        current_doc++;
     }
     return res;
 }
 
-int ISearcher::getPriority(const std::string& op) {
+std::vector<TermInfo> intersect_lists(std::span<const TermInfo> l1, std::span<const TermInfo> l2) {
+    std::vector<TermInfo> res;
+    res.reserve(std::min(l1.size(), l2.size()));
+    Intersect::intersect(l1, l2, res);
+    return res;
+}
+
+std::vector<TermInfo> union_lists(std::span<const TermInfo> l1, std::span<const TermInfo> l2) {
+    PostingCursor c1(l1), c2(l2);
+    return union_lists(c1, c2);
+}
+
+std::vector<TermInfo> not_list(std::span<const TermInfo> l, int total_docs) {
+    PostingCursor c(l);
+    return not_list(c, total_docs);
+}
+
+std::vector<TermInfo> difference_lists(std::span<const TermInfo> l1, std::span<const TermInfo> l2) {
+    PostingCursor c1(l1), c2(l2);
+    return difference_lists(c1, c2);
+}
+
+int ISearcher::getPriority(const std::string& op) const {
     if (op == "!") return 3;
     if (op == "&") return 2;
     if (op == "|") return 1;
     return 0;
 }
 
-bool ISearcher::isOperator(const std::string& token) {
+bool ISearcher::isOperator(const std::string& token) const {
     return token == "!" || token == "&" || token == "|" || token == "(" || token == ")";
 }
 
-std::vector<std::pair<std::string, double>> ISearcher::findDocument(const std::string& query) {
-    auto tokens = parseQuery(query);
+bool ISearcher::isPrefixTerm(const std::string& token) const { return token.size() > 1 && token.back() == '*'; }
 
+std::vector<std::string> ISearcher::collectQueryTerms(const std::vector<std::string>& tokens) const {
     std::vector<std::string> queryTerms;
     for (const auto& token : tokens) {
-        if (!isOperator(token)) {
+        if (isPrefixTerm(token)) {
+            auto expanded = source->expandPrefix(std::string_view(token).substr(0, token.size() - 1), MAX_PREFIX_TERMS);
+            queryTerms.insert(queryTerms.end(), expanded.begin(), expanded.end());
+        } else if (!isOperator(token)) {
             queryTerms.push_back(token);
         }
     }
+    return queryTerms;
+}
+
+std::vector<std::pair<std::string, double>> ISearcher::findDocument(const std::string& query) const {
+    auto tokens = parseQuery(query);
+    auto queryTerms = collectQueryTerms(tokens);
 
     std::cout << "Tokens searching: [";
     for (const auto& token : queryTerms) {
@@ -115,34 +191,84 @@ std::vector<std::pair<std::string, double>> ISearcher::findDocument(const std::s
     return processResults(terms_info, queryTerms);
 }
 
-std::vector<TermInfo> ISearcher::evaluate(const std::vector<std::string>& rpn, int total_docs) {
-    std::vector<std::vector<TermInfo>> stack;
-    for (const auto& token : rpn) {
-        if (!isOperator(token)) {
-            stack.push_back(source->getPostings(token));
+std::vector<SearchHit> ISearcher::findDocument(const std::string& query, size_t k, size_t offset) const {
+    size_t limit = k > std::numeric_limits<size_t>::max() - offset ? std::numeric_limits<size_t>::max() : offset + k;
+    if (k == 0) return {};
+    auto tokens = parseQuery(query);
+    auto rpn = sortingStation(tokens);
+
+    std::vector<SearchHit> hits;
+    if (result_cache) {
+        // The plan dedupes operands but scoring counts every occurrence, so the key carries the term multiset
+        std::vector<std::string> scored(rpn.begin(), rpn.end());
+        scored.erase(std::remove_if(scored.begin(), scored.end(), [&](const std::string& t) { return isOperator(t); }),
+                     scored.end());
+        std::sort(scored.begin(), scored.end());
+        std::string key = QueryPlan::canonicalQuery(rpn);
+        for (const auto& term : scored) key += " " + term;
+        uint64_t generation = source->generation();
+        auto covers_page = [&](const CachedHits& c) { return c.complete || c.hits.size() >= limit; };
+        auto cached = result_cache->get(key, generation, covers_page);
+        if (cached) {
+            hits = std::move(cached->hits);
+            if (hits.size() > limit) hits.resize(limit);
         } else {
-            if (token == "!") {
-                if (stack.empty()) continue;
-                auto op1 = stack.back();
-                stack.pop_back();
-                stack.push_back(not_list(op1, total_docs));
-            } else {
-                if (stack.size() < 2) continue;
-                auto right = stack.back();
-                stack.pop_back();
-                auto left = stack.back();
-                stack.pop_back();
-                if (token == "&")
-                    stack.push_back(intersect_lists(left, right));
-                else if (token == "|")
-                    stack.push_back(union_lists(left, right));
+            hits = searchHits(tokens, rpn, limit);
+            result_cache->put(key, generation, {hits, hits.size() < limit});
+        }
+    } else {
+        hits = searchHits(tokens, rpn, limit);
+    }
+    hits.erase(hits.begin(), hits.begin() + std::min(offset, hits.size()));
+    return hits;
+}
+
+std::vector<SearchHit> ISearcher::searchHits(const std::vector<std::string>& tokens, const std::vector<std::string>& rpn,
+                                             size_t limit) const {
+    auto queryTerms = collectQueryTerms(tokens);
+    QueryPlan plan = buildPlan(rpn, source->getTotalDocs());
+    // Only the page prefix is generated when the ranking is doc order anyway, e.g. for a bare !term
+    bool doc_order = ranksInDocOrder() || plan.unscored();
+    auto terms_info = plan.execute(doc_order ? limit : std::numeric_limits<size_t>::max());
+    return rankHits(terms_info, queryTerms, limit);
+}
+
+void ISearcher::setResultCacheCapacity(size_t entries) {
+    result_cache = entries ? std::make_unique<ShardedLruCache<CachedHits>>(entries) : nullptr;
+}
+
+ISearcher::CacheStats ISearcher::resultCacheStats() const { return result_cache ? result_cache->stats() : CacheStats{}; }
+
+std::vector<TermInfo> ISearcher::evaluate(const std::vector<std::string>& rpn, int total_docs) const {
+    QueryPlan plan = buildPlan(rpn, total_docs);
+    return plan.execute();
+}
+
+QueryPlan ISearcher::buildPlan(const std::vector<std::string>& rpn, int total_docs) const {
+    // Terms open their cursors here: the posting list lengths are the planner's costs
+    QueryPlan plan(total_docs);
+    for (const auto& token : rpn) {
+        if (isPrefixTerm(token)) {
+            std::string_view prefix = std::string_view(token).substr(0, token.size() - 1);
+            std::vector<PostingCursor> expansions;
+            for (const auto& term : source->expandPrefix(prefix, MAX_PREFIX_TERMS)) {
+                expansions.push_back(source->openCursor(term));
             }
+            plan.pushPrefix(std::string(prefix), std::move(expansions));
+        } else if (token == "!") {
+            plan.applyNot();
+        } else if (token == "&") {
+            plan.applyAnd();
+        } else if (token == "|") {
+            plan.applyOr();
+        } else if (!isOperator(token)) {
+            plan.pushTerm(token, source->openCursor(token));
         }
     }
-    return stack.empty() ? std::vector<TermInfo>{} : stack.back();
+    return plan;
 }
 
-std::vector<std::string> ISearcher::parseQuery(const std::string& query) {
+std::vector<std::string> ISearcher::parseQuery(const std::string& query) const {
     std::vector<std::string> rawTokens = tokenizer->getRawTokens(query);
 
     std::vector<std::string> processedTokens;
@@ -160,9 +286,14 @@ std::vector<std::string> ISearcher::parseQuery(const std::string& query) {
     for (const auto& t : rawTokens) {
         if (isOperator(t)) {
             addTokenWithImplicitAnd(t);
+        } else if (isPrefixTerm(t)) {
+            // Prefixes are only lowercased: stemming a partial word would change what it matches
+            std::string prefix;
+            for (char c : t) prefix += (char)std::tolower(static_cast<unsigned char>(c));
+            addTokenWithImplicitAnd(prefix);
         } else {
-            tokenizer->tokenize(t);
-            auto subtokens = tokenizer->getTokens();
+            std::vector<std::string> subtokens;
+            tokenizer->tokenize(t, subtokens);
             for (const std::string& sub : subtokens) {
                 addTokenWithImplicitAnd(sub);
             }
@@ -174,7 +305,7 @@ std::vector<std::string> ISearcher::parseQuery(const std::string& query) {
 ISearcher::ISearcher(std::shared_ptr<IIndexSource> src, std::shared_ptr<Tokenizer> tok)
     : source(std::move(src)), tokenizer(std::move(tok)) {}
 
-std::vector<std::string> ISearcher::sortingStation(const std::vector<std::string>& tokens) {
+std::vector<std::string> ISearcher::sortingStation(const std::vector<std::string>& tokens) const {
     std::vector<std::string> outputQueue;
     std::vector<std::string> operatorStack;
 
@@ -206,15 +337,128 @@ std::vector<std::string> ISearcher::sortingStation(const std::vector<std::string
     return outputQueue;
 }
 
+namespace {
+
+// Serves the posting lists decoded for a batch from memory and everything else from the real source
+class SharedPostingsSource : public IIndexSource {
+public:
+    using Lists = std::unordered_map<std::string, std::shared_ptr<const std::vector<TermInfo>>>;
+
+    SharedPostingsSource(std::shared_ptr<IIndexSource> base, Lists lists) : base(std::move(base)), lists(std::move(lists)) {}
+
+    PostingCursor openCursor(const std::string& term) const override {
+        auto it = lists.find(term);
+        return it != lists.end() ? PostingCursor::fromShared(it->second) : base->openCursor(term);
+    }
+    std::string_view getUrl(int doc_id) const override { return base->getUrl(doc_id); }
+    uint32_t getTotalDocs() const override { return base->getTotalDocs(); }
+    DocLengths getDocLengths() const override { return base->getDocLengths(); }
+    CollectionStats getCollectionStats() const override { return base->getCollectionStats(); }
+    uint64_t getCollectionFrequency(const std::string& term) const override { return base->getCollectionFrequency(term); }
+    std::vector<std::string> expandPrefix(std::string_view prefix, size_t limit) const override {
+        return base->expandPrefix(prefix, limit);
+    }
+    std::span<const BinaryFormat::BlockMax> getBlockMaxes(const std::string& term) const override {
+        return base->getBlockMaxes(term);
+    }
+    bool hasImpacts() const override { return base->hasImpacts(); }
+    TermImpacts getImpacts(const std::string& term) const override { return base->getImpacts(term); }
+
+private:
+    std::shared_ptr<IIndexSource> base;
+    Lists lists;
+};
+
+// Runs job(i) for i in [0, count) on up to `threads` threads, the calling one included
+template <typename Job>
+void parallelFor(size_t count, unsigned threads, Job&& job) {
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) job(i);
+    };
+    threads = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = (unsigned)std::min<size_t>(threads, std::max<size_t>(1, count));
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto& thread : pool) thread.join();
+}
+
+}  // namespace
+
+BatchResult ISearcher::findDocuments(const std::vector<std::string>& queries, size_t k, unsigned threads) const {
+    auto start_time = std::chrono::steady_clock::now();
+    BatchResult result;
+    result.stats.queries = queries.size();
+    result.hits.resize(queries.size());
+
+    struct Parsed {
+        std::vector<std::string> tokens;
+        std::vector<std::string> rpn;
+    };
+    std::vector<Parsed> parsed(queries.size());
+    std::unordered_map<std::string, uint32_t> uses;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        parsed[i].tokens = parseQuery(queries[i]);
+        parsed[i].rpn = sortingStation(parsed[i].tokens);
+        auto terms = collectQueryTerms(parsed[i].tokens);
+        std::sort(terms.begin(), terms.end());
+        terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+        for (auto& term : terms) ++uses[std::move(term)];
+    }
+    result.stats.distinct_terms = uses.size();
+
+    // Lists of a single query stream as usual. So do lists that are already one decoded window
+    // (raw files, short lists) and Roaring sets, whose set operations beat a decoded copy.
+    std::vector<std::string> shared;
+    for (const auto& [term, count] : uses) {
+        if (count > 1) shared.push_back(term);
+    }
+    std::vector<std::shared_ptr<const std::vector<TermInfo>>> decoded(shared.size());
+    auto decode_start = std::chrono::steady_clock::now();
+    parallelFor(shared.size(), threads, [&](size_t i) {
+        PostingCursor cursor = source->openCursor(shared[i]);
+        if (cursor.roaring() || cursor.buffered().size() == cursor.size()) return;
+        auto list = std::make_shared<std::vector<TermInfo>>();
+        list->reserve(cursor.size());
+        for (; cursor.valid();) {
+            auto window = cursor.buffered();
+            list->insert(list->end(), window.begin(), window.end());
+            cursor.advance((uint32_t)window.size());
+        }
+        decoded[i] = std::move(list);
+    });
+    SharedPostingsSource::Lists lists;
+    for (size_t i = 0; i < shared.size(); ++i) {
+        if (!decoded[i]) continue;
+        result.stats.decoded_postings += decoded[i]->size();
+        lists.emplace(std::move(shared[i]), std::move(decoded[i]));
+    }
+    result.stats.decoded_terms = lists.size();
+    result.stats.decode_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - decode_start).count();
+
+    auto bound = withSource(std::make_shared<SharedPostingsSource>(source, std::move(lists)));
+    parallelFor(queries.size(), threads, [&](size_t i) {
+        if (k > 0) result.hits[i] = bound->searchHits(parsed[i].tokens, parsed[i].rpn, k);
+    });
+    result.stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    return result;
+}
+
 BinarySearcher::BinarySearcher(std::shared_ptr<IIndexSource> src, std::shared_ptr<Tokenizer> tok) : ISearcher(src, tok) {}
 
+std::unique_ptr<ISearcher> BinarySearcher::withSource(std::shared_ptr<IIndexSource> src) const {
+    auto searcher = std::make_unique<BinarySearcher>(std::move(src), tokenizer);
+    return searcher;
+}
+
 std::vector<std::pair<std::string, double>> BinarySearcher::processResults(const std::vector<TermInfo>& terms_info,
-                                                                           const std::vector<std::string>& terms) {
+                                                                           const std::vector<std::string>&) const {
     std::vector<std::pair<std::string, double>> result_urls;
     result_urls.reserve(terms_info.size());
 
     for (const auto& term_info : terms_info) {
-        std::string url = source->getUrl(term_info.doc_id);
+        std::string url(source->getUrl(term_info.doc_id));
         if (!url.empty()) {
             result_urls.push_back({url, 0.});
         }
@@ -222,44 +466,483 @@ std::vector<std::pair<std::string, double>> BinarySearcher::processResults(const
     return result_urls;
 }
 
+std::vector<SearchHit> BinarySearcher::rankHits(const std::vector<TermInfo>& docIds, const std::vector<std::string>&,
+                                                size_t limit) const {
+    // Unranked: matches come in doc order, the page is a prefix of them
+    std::vector<SearchHit> hits;
+    hits.reserve(std::min(limit, docIds.size()));
+    for (size_t i = 0; i < docIds.size() && i < limit; ++i) hits.push_back({docIds[i].doc_id, 0.});
+    return hits;
+}
+
 TFIDFSearcher::TFIDFSearcher(std::shared_ptr<IIndexSource> src, std::shared_ptr<Tokenizer> tok) : ISearcher(src, tok) {}
 
-std::vector<std::pair<int, double>> TFIDFSearcher::rankResults(const std::vector<TermInfo>& terms_info,
-                                                               const std::vector<std::string>& terms) {
-    int N = source->getTotalDocs();
-    HashMap<uint32_t, double> scores;
+std::unique_ptr<ISearcher> TFIDFSearcher::withSource(std::shared_ptr<IIndexSource> src) const {
+    auto searcher = std::make_unique<TFIDFSearcher>(std::move(src), tokenizer);
+    searcher->impact_scoring = impact_scoring;
+    return searcher;
+}
+
+namespace {
 
-    std::vector<bool> isRelevant(N, false);
-    for (const auto& term_info : terms_info) isRelevant[term_info.doc_id] = true;
+bool betterHit(const SearchHit& a, const SearchHit& b) { return a.score != b.score ? a.score > b.score : a.doc_id < b.doc_id; }
+
+// The best k hits seen so far. Ranking is by score, then by doc id, so pages of the same query line up.
+// The heap is per-thread scratch like ScoreAccumulator, so a thread keeps one TopK alive at a time.
+class TopK {
+    size_t k;
+    std::vector<SearchHit>& heap;
+
+    static std::vector<SearchHit>& scratch() {
+        thread_local std::vector<SearchHit> heap;
+        return heap;
+    }
+
+public:
+    explicit TopK(size_t k) : k(k), heap(scratch()) { heap.clear(); }
+    TopK(const TopK&) = delete;
+    TopK& operator=(const TopK&) = delete;
+
+    // A document has to beat this to get in
+    double threshold() const { return heap.size() < k ? -std::numeric_limits<double>::infinity() : heap.front().score; }
+
+    // With betterHit as the heap order the front is the worst hit kept
+    void push(uint32_t doc, double score) {
+        if (k == 0) return;
+        if (heap.size() == k) {
+            if (!betterHit({doc, score}, heap.front())) return;
+            std::pop_heap(heap.begin(), heap.end(), betterHit);
+            heap.pop_back();
+        }
+        heap.push_back({doc, score});
+        std::push_heap(heap.begin(), heap.end(), betterHit);
+    }
+
+    // Only the returned page is allocated; the heap is sorted in place and ends the TopK
+    std::vector<SearchHit> sorted() {
+        std::sort_heap(heap.begin(), heap.end(), betterHit);
+        return {heap.begin(), heap.end()};
+    }
+};
+
+}  // namespace
+
+std::vector<SearchHit> TFIDFSearcher::rankHits(const std::vector<TermInfo>& terms_info, const std::vector<std::string>& terms,
+                                               size_t limit) const {
+    if (useImpacts()) return rankImpactHits(terms_info, terms, limit);
+    int N = source->getTotalDocs();
+    ScoreAccumulator& scores = ScoreAccumulator::local();
+    scores.reset(N);
+    for (const auto& term_info : terms_info) scores.track(term_info.doc_id);
 
     for (const auto& term : terms) {
-        auto postings = source->getPostings(term);
+        PostingCursor postings = source->openCursor(term);
 
         double idf = std::log((double)N / (1 + postings.size()));
 
-        for (const auto& entry : postings) {
-            if (isRelevant[entry.doc_id]) {
-                scores.get(entry.doc_id) += (1.0 + std::log((double)entry.tf)) * idf;
+        for (; postings.valid(); postings.next()) {
+            if (scores.tracked(postings.doc())) {
+                scores.add(postings.doc(), tfWeight(postings.tf()) * idf);
             }
         }
     }
 
-    std::vector<std::pair<int, double>> ranked;
-    for (const auto& term_info : terms_info) {
-        ranked.push_back({term_info.doc_id, scores.get(term_info.doc_id)});
+    // A page only needs a bounded heap, not a sorted copy of every match
+    if (limit < terms_info.size()) {
+        TopK top(limit);
+        for (const auto& term_info : terms_info) top.push(term_info.doc_id, scores.score(term_info.doc_id));
+        return top.sorted();
     }
 
-    std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+    std::vector<SearchHit> ranked;
+    ranked.reserve(terms_info.size());
+    for (const auto& term_info : terms_info) {
+        ranked.push_back({term_info.doc_id, scores.score(term_info.doc_id)});
+    }
+    std::sort(ranked.begin(), ranked.end(), betterHit);
     return ranked;
 }
 
+namespace {
+
+// One query term during top-k retrieval: its cursor plus a shallow pointer into the block bounds
+struct ScoredTerm {
+    PostingCursor cursor;
+    double idf = 0;
+    double max_score = 0;
+    std::vector<BinaryFormat::BlockMax> owned_blocks;
+    std::span<const BinaryFormat::BlockMax> blocks;
+    size_t block = 0;
+
+    double score(uint32_t tf) const { return tfWeight(tf) * idf; }
+    // Terms in almost every document have idf <= 0 and can only lower a score
+    double bound(uint32_t max_tf) const { return idf > 0 ? score(max_tf) : 0; }
+
+    // Moves to the block that may hold doc, false when doc is past the last block
+    bool shallowTo(uint32_t doc) {
+        while (block > 0 && block <= blocks.size() && blocks[block - 1].last_doc_id >= doc) --block;
+        if (block < blocks.size() && blocks[block].last_doc_id < doc) {
+            block = std::lower_bound(blocks.begin() + block, blocks.end(), doc,
+                                     [](const BinaryFormat::BlockMax& b, uint32_t d) { return b.last_doc_id < d; }) -
+                    blocks.begin();
+        }
+        return block < blocks.size();
+    }
+    double blockBound() const { return bound(blocks[block].max_tf); }
+    uint32_t blockLast() const { return blocks[block].last_doc_id; }
+};
+
+std::vector<ScoredTerm> openScoredTerms(const IIndexSource& source, const std::vector<std::string>& terms) {
+    const double N = source.getTotalDocs();
+    std::vector<ScoredTerm> scored(terms.size());
+    for (size_t i = 0; i < terms.size(); ++i) {
+        ScoredTerm& t = scored[i];
+        t.cursor = source.openCursor(terms[i]);
+        t.idf = std::log(N / (1 + t.cursor.size()));
+        t.blocks = source.getBlockMaxes(terms[i]);
+        if (t.blocks.empty() && t.cursor.size() > 0) {
+            // No stored bounds: derive them with one pass over a copy of the cursor
+            PostingCursor scan = t.cursor;
+            for (uint32_t n = 0; scan.valid(); scan.next(), ++n) {
+                if (n % BinaryFormat::BLOCK_SIZE == 0) t.owned_blocks.push_back({0, 0});
+                t.owned_blocks.back().last_doc_id = scan.doc();
+                t.owned_blocks.back().max_tf = std::max(t.owned_blocks.back().max_tf, scan.tf());
+            }
+            t.blocks = t.owned_blocks;
+        }
+        uint32_t max_tf = 0;
+        for (const auto& b : t.blocks) max_tf = std::max(max_tf, b.max_tf);
+        t.max_score = max_tf ? t.bound(max_tf) : 0;
+    }
+    return scored;
+}
+
+// Sums in query order, the same order rankHits accumulates in, so scores match bit for bit
+double scoreDoc(const std::vector<ScoredTerm>& terms, uint32_t doc) {
+    double score = 0;
+    for (const auto& t : terms) {
+        if (t.cursor.doc() == doc) score += t.score(t.cursor.tf());
+    }
+    return score;
+}
+
+}  // namespace
+
+std::vector<SearchHit> TFIDFSearcher::topKUnion(const std::vector<std::string>& terms, size_t k) const {
+    std::vector<ScoredTerm> scored = openScoredTerms(*source, terms);
+    TopK top(k);
+
+    std::vector<size_t> order;
+    for (size_t i = 0; i < scored.size(); ++i) {
+        if (scored[i].cursor.valid()) order.push_back(i);
+    }
+    auto byDoc = [&](size_t a, size_t b) { return scored[a].cursor.doc() < scored[b].cursor.doc(); };
+
+    while (true) {
+        std::erase_if(order, [&](size_t i) { return !scored[i].cursor.valid(); });
+        if (order.empty()) break;
+        std::sort(order.begin(), order.end(), byDoc);
+
+        // Pivot: the first term at which the bounds of the terms so far could beat the threshold
+        const double threshold = top.threshold();
+        double bound = 0;
+        size_t pivot = 0;
+        for (; pivot < order.size(); ++pivot) {
+            bound += scored[order[pivot]].max_score;
+            if (bound > threshold) break;
+        }
+        if (pivot == order.size()) break;
+        const uint32_t pivot_doc = scored[order[pivot]].cursor.doc();
+        // Terms sitting on the pivot doc as well belong to the candidate set
+        while (pivot + 1 < order.size() && scored[order[pivot + 1]].cursor.doc() == pivot_doc) ++pivot;
+
+        // Terms whose last block ends before the pivot have nothing left to add
+        double block_bound = 0;
+        for (size_t i = 0; i <= pivot; ++i) {
+            ScoredTerm& t = scored[order[i]];
+            if (t.shallowTo(pivot_doc)) block_bound += t.blockBound();
+        }
+
+        if (block_bound > threshold) {
+            if (scored[order[0]].cursor.doc() == pivot_doc) {
+                top.push(pivot_doc, scoreDoc(scored, pivot_doc));
+                for (size_t i = 0; i <= pivot; ++i) scored[order[i]].cursor.next();
+            } else {
+                for (size_t i = 0; i < pivot && scored[order[i]].cursor.doc() < pivot_doc; ++i) {
+                    scored[order[i]].cursor.skipTo(pivot_doc);
+                }
+            }
+            continue;
+        }
+
+        // Nothing before the end of the current blocks, or the next term's doc, can make it
+        uint64_t next = pivot + 1 < order.size() ? scored[order[pivot + 1]].cursor.doc() : PostingCursor::END;
+        for (size_t i = 0; i <= pivot; ++i) {
+            const ScoredTerm& t = scored[order[i]];
+            if (t.block < t.blocks.size()) next = std::min<uint64_t>(next, (uint64_t)t.blockLast() + 1);
+        }
+        for (size_t i = 0; i <= pivot; ++i) {
+            if (next >= PostingCursor::END) {
+                scored[order[i]].cursor.skipTo(PostingCursor::END);
+            } else {
+                scored[order[i]].cursor.skipTo((uint32_t)next);
+            }
+        }
+    }
+    return top.sorted();
+}
+
+std::vector<SearchHit> TFIDFSearcher::topKIntersection(const std::vector<std::string>& terms, size_t k) const {
+    std::vector<ScoredTerm> scored = openScoredTerms(*source, terms);
+    TopK top(k);
+    if (scored.empty()) return {};
+
+    // The rarest list leads, the others are only probed with skipTo
+    std::vector<size_t> order(scored.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return scored[a].cursor.size() < scored[b].cursor.size(); });
+    PostingCursor& lead = scored[order[0]].cursor;
+
+    while (lead.valid()) {
+        uint32_t doc = lead.doc();
+
+        double threshold = top.threshold();
+        if (threshold > -std::numeric_limits<double>::infinity()) {
+            double bound = 0;
+            uint64_t blocks_end = PostingCursor::END;
+            bool exhausted = false;
+            for (size_t i : order) {
+                if (!scored[i].shallowTo(doc)) {
+                    exhausted = true;
+                    break;
+                }
+                bound += scored[i].blockBound();
+                blocks_end = std::min<uint64_t>(blocks_end, scored[i].blockLast());
+            }
+            if (exhausted) break;
+            if (bound <= threshold) {
+                if (blocks_end + 1 >= PostingCursor::END) break;
+                lead.skipTo((uint32_t)blocks_end + 1);
+                continue;
+            }
+        }
+
+        bool all = true;
+        for (size_t j = 1; j < order.size(); ++j) {
+            PostingCursor& c = scored[order[j]].cursor;
+            c.skipTo(doc);
+            if (c.doc() != doc) {
+                all = false;
+                if (c.valid()) {
+                    lead.skipTo(c.doc());
+                } else {
+                    lead.skipTo(PostingCursor::END);
+                }
+                break;
+            }
+        }
+        if (!all) continue;
+
+        top.push(doc, scoreDoc(scored, doc));
+        lead.next();
+    }
+    return top.sorted();
+}
+
+void TFIDFSearcher::setImpactScoring(bool enabled) {
+    impact_scoring = enabled;
+    // Cached pages were ranked with the other scores
+    if (result_cache) setResultCacheCapacity(result_cache->capacity());
+}
+
+// Integer impact sums, scaled once at the end so every path yields the same double for a document
+std::vector<SearchHit> TFIDFSearcher::rankImpactHits(const std::vector<TermInfo>& terms_info,
+                                                     const std::vector<std::string>& terms, size_t limit) const {
+    ScoreAccumulator& scores = ScoreAccumulator::local();
+    scores.reset(source->getTotalDocs());
+    for (const auto& term_info : terms_info) scores.track(term_info.doc_id);
+
+    double scale = 0;
+    for (const auto& term : terms) {
+        TermImpacts impacts = source->getImpacts(term);
+        if (impacts.impacts.empty()) continue;
+        scale = impacts.scale;
+        PostingCursor postings = source->openCursor(term);
+        for (size_t i = 0; postings.valid(); postings.next(), ++i) {
+            if (scores.tracked(postings.doc())) scores.add(postings.doc(), impacts.impacts[i]);
+        }
+    }
+
+    TopK top(std::min(limit, terms_info.size()));
+    for (const auto& term_info : terms_info) top.push(term_info.doc_id, scores.score(term_info.doc_id) * scale);
+    return top.sorted();
+}
+
+// Score-at-a-time: segments of all terms are accumulated from the highest impact down. The page is
+// decided once its worst partial score beats every other document given all the impacts that document
+// can still get; the page then picks up its own missing impacts by binary search in the unread segments.
+std::optional<std::vector<SearchHit>> TFIDFSearcher::topKImpacts(const std::vector<std::string>& terms, size_t k) const {
+    struct ImpactList {
+        TermImpacts impacts;
+        size_t next = 0;      // first unread segment
+        size_t next_doc = 0;  // its offset in impacts.docs
+        uint32_t nextImpact() const { return next < impacts.segments.size() ? impacts.segments[next].impact : 0; }
+    };
+    std::vector<ImpactList> lists;
+    double scale = 0;
+    for (const auto& term : terms) {
+        TermImpacts impacts = source->getImpacts(term);
+        if (impacts.impacts.empty()) continue;
+        if (impacts.segments.empty()) return std::nullopt;
+        scale = impacts.scale;
+        lists.push_back({impacts});
+    }
+    // Term masks are 32 bits wide
+    if (lists.size() > 32) return std::nullopt;
+    if (k == 0 || lists.empty()) return std::vector<SearchHit>{};
+
+    // Segments of one term keep their stored order: impacts are distinct and descending within a term
+    std::vector<std::pair<uint32_t, uint32_t>> order;  // (list, segment)
+    for (uint32_t t = 0; t < lists.size(); ++t) {
+        for (uint32_t s = 0; s < lists[t].impacts.segments.size(); ++s) order.push_back({t, s});
+    }
+    std::stable_sort(order.begin(), order.end(), [&](const auto& a, const auto& b) {
+        return lists[a.first].impacts.segments[a.second].impact > lists[b.first].impacts.segments[b.second].impact;
+    });
+
+    ScoreAccumulator& scores = ScoreAccumulator::local();
+    scores.reset(source->getTotalDocs());
+    std::vector<uint32_t> touched;
+    std::vector<SearchHit> partial;
+
+    // What a document that already matched the terms in `mask` can still gain
+    auto gain = [&](uint32_t mask) {
+        double total = 0;
+        for (uint32_t t = 0; t < lists.size(); ++t) {
+            if (!(mask >> t & 1)) total += lists[t].nextImpact();
+        }
+        return total;
+    };
+    // Puts the current best k first in `partial`; true when no other document can overtake them
+    auto decided = [&]() {
+        if (touched.size() < k) return false;
+        partial.clear();
+        for (uint32_t doc : touched) partial.push_back({doc, scores.score(doc)});
+        std::nth_element(partial.begin(), partial.begin() + (k - 1), partial.end(), betterHit);
+        const SearchHit worst = partial[k - 1];
+        // Unseen documents may have any id, so they have to fall strictly short
+        if (worst.score <= gain(0)) return false;
+        for (size_t i = k; i < partial.size(); ++i) {
+            if (!betterHit(worst, {partial[i].doc_id, partial[i].score + gain(scores.terms(partial[i].doc_id))})) return false;
+        }
+        return true;
+    };
+
+    // A check costs a pass over the touched documents, so checks are spread out to cost no more than accumulating
+    size_t since_check = 0;
+    bool stopped = false;
+    for (const auto& [t, s] : order) {
+        ImpactList& list = lists[t];
+        const auto& segment = list.impacts.segments[s];
+        const uint32_t* docs = list.impacts.docs + list.next_doc;
+        for (uint32_t i = 0; i < segment.count; ++i) {
+            if (!scores.tracked(docs[i])) {
+                scores.track(docs[i]);
+                touched.push_back(docs[i]);
+            }
+            scores.add(docs[i], segment.impact, t);
+        }
+        list.next_doc += segment.count;
+        ++list.next;
+
+        since_check += segment.count;
+        if (since_check < touched.size()) continue;
+        since_check = 0;
+        if (decided()) {
+            stopped = true;
+            break;
+        }
+    }
+
+    TopK top(k);
+    if (!stopped) {
+        for (uint32_t doc : touched) top.push(doc, scores.score(doc) * scale);
+        return top.sorted();
+    }
+
+    for (size_t i = 0; i < k; ++i) {
+        uint32_t doc = partial[i].doc_id;
+        double score = scores.score(doc);
+        for (uint32_t t = 0; t < lists.size(); ++t) {
+            if (scores.terms(doc) >> t & 1) continue;
+            const ImpactList& list = lists[t];
+            size_t offset = list.next_doc;
+            for (size_t s = list.next; s < list.impacts.segments.size(); ++s) {
+                const auto& segment = list.impacts.segments[s];
+                const uint32_t* begin = list.impacts.docs + offset;
+                if (std::binary_search(begin, begin + segment.count, doc)) {
+                    score += segment.impact;
+                    break;
+                }
+                offset += segment.count;
+            }
+        }
+        top.push(doc, score * scale);
+    }
+    return top.sorted();
+}
+
+std::vector<SearchHit> TFIDFSearcher::searchHits(const std::vector<std::string>& tokens, const std::vector<std::string>& rpn,
+                                                 size_t limit) const {
+    bool has_and = false, has_or = false, has_other = false, has_prefix = false;
+    for (const auto& token : rpn) {
+        if (token == "&") {
+            has_and = true;
+        } else if (token == "|") {
+            has_or = true;
+        } else if (isOperator(token)) {
+            has_other = true;
+        } else if (isPrefixTerm(token)) {
+            has_prefix = true;
+        }
+    }
+    auto queryTerms = collectQueryTerms(tokens);
+
+    std::vector<SearchHit> hits;
+    if (useImpacts()) {
+        std::optional<std::vector<SearchHit>> saat;
+        if (!has_other && !has_and && !has_prefix) saat = topKImpacts(queryTerms, limit);
+        if (saat) return std::move(*saat);
+        // Everything else ranks its exhaustive matches through rankHits, which reads the impacts
+        QueryPlan plan = buildPlan(rpn, source->getTotalDocs());
+        auto terms_info = plan.execute(plan.unscored() ? limit : std::numeric_limits<size_t>::max());
+        return rankHits(terms_info, queryTerms, limit);
+    }
+    if (!has_other && !has_and) {
+        hits = topKUnion(queryTerms, limit);
+    } else if (!has_other && !has_or && !has_prefix) {
+        hits = topKIntersection(queryTerms, limit);
+    } else {
+        QueryPlan plan = buildPlan(rpn, source->getTotalDocs());
+        auto terms_info = plan.execute(plan.unscored() ? limit : std::numeric_limits<size_t>::max());
+        hits = rankHits(terms_info, queryTerms, limit);
+    }
+    return hits;
+}
+
+std::vector<std::pair<std::string, double>> TFIDFSearcher::findTopDocuments(const std::string& query, size_t k) const {
+    std::vector<std::pair<std::string, double>> result_urls;
+    for (const auto& hit : findDocument(query, k, 0)) result_urls.push_back({std::string(source->getUrl(hit.doc_id)), hit.score});
+    return result_urls;
+}
+
 std::vector<std::pair<std::string, double>> TFIDFSearcher::processResults(const std::vector<TermInfo>& terms_info,
-                                                                          const std::vector<std::string>& terms) {
-    auto ranked = rankResults(terms_info, terms);
+                                                                          const std::vector<std::string>& terms) const {
+    auto ranked = rankHits(terms_info, terms, terms_info.size());
 
     std::vector<std::pair<std::string, double>> result_urls;
-    for (const auto& pair : ranked) {
-        result_urls.push_back({source->getUrl(pair.first), pair.second});
+    for (const auto& hit : ranked) {
+        result_urls.push_back({std::string(source->getUrl(hit.doc_id)), hit.score});
     }
     return result_urls;
 }
\ No newline at end of file
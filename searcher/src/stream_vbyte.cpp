@@ -0,0 +1,176 @@
+#include "stream_vbyte.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STREAM_VBYTE_X86 1
+#endif
+
+namespace StreamVByte {
+
+namespace {
+
+inline uint8_t byteLength(uint32_t value) {
+    if (value < (1u << 8)) return 1;
+    if (value < (1u << 16)) return 2;
+    if (value < (1u << 24)) return 3;
+    return 4;
+}
+
+inline uint32_t controlBytes(uint32_t count) { return (count + 3) / 4; }
+
+struct Tables {
+    std::array<uint8_t, 256> lengths;
+    alignas(16) std::array<std::array<uint8_t, 16>, 256> shuffles;
+
+    Tables() {
+        for (int control = 0; control < 256; ++control) {
+            uint8_t offset = 0;
+            for (int i = 0; i < 4; ++i) {
+                uint8_t len = ((control >> (2 * i)) & 3) + 1;
+                for (int j = 0; j < 4; ++j) {
+                    shuffles[control][4 * i + j] = j < len ? offset + j : 0xFF;
+                }
+                offset += len;
+            }
+            lengths[control] = offset;
+        }
+    }
+};
+
+const Tables& tables() {
+    static const Tables t;
+    return t;
+}
+
+inline uint32_t readValue(const uint8_t*& data, uint8_t code) {
+    uint32_t value = 0;
+    std::memcpy(&value, data, code + 1);
+    data += code + 1;
+    return value;
+}
+
+#ifdef STREAM_VBYTE_X86
+template <bool Delta>
+__attribute__((target("ssse3"))) uint32_t decodeGroupsSimd(const uint8_t* control, const uint8_t*& data, uint32_t count,
+                                                           uint32_t& prev, uint32_t* out) {
+    const Tables& t = tables();
+    __m128i running = _mm_set1_epi32((int)prev);
+    uint32_t groups = count / 4;
+    uint32_t g = 0;
+
+    for (; g < groups; ++g) {
+        uint8_t c = control[g];
+        __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+        __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i*>(t.shuffles[c].data()));
+        __m128i values = _mm_shuffle_epi8(raw, mask);
+        data += t.lengths[c];
+
+        if constexpr (Delta) {
+            values = _mm_add_epi32(values, _mm_slli_si128(values, 4));
+            values = _mm_add_epi32(values, _mm_slli_si128(values, 8));
+            values = _mm_add_epi32(values, running);
+            running = _mm_shuffle_epi32(values, 0xFF);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * g), values);
+    }
+
+    if constexpr (Delta) prev = (uint32_t)_mm_cvtsi128_si32(running);
+    return g * 4;
+}
+#endif
+
+template <bool Delta>
+const uint8_t* decodeImpl(const uint8_t* in, uint32_t count, uint32_t prev, uint32_t* out, bool use_simd) {
+    const uint8_t* control = in;
+    const uint8_t* data = in + controlBytes(count);
+    uint32_t done = 0;
+
+#ifdef STREAM_VBYTE_X86
+    if (use_simd) done = decodeGroupsSimd<Delta>(control, data, count, prev, out);
+#endif
+
+    // Tail: the last partial group
+    for (uint32_t i = done; i < count; ++i) {
+        uint8_t code = (control[i / 4] >> (2 * (i % 4))) & 3;
+        uint32_t value = readValue(data, code);
+        if constexpr (Delta) {
+            prev += value;
+            value = prev;
+        }
+        out[i] = value;
+    }
+    return data;
+}
+
+template <bool Delta>
+size_t encodeImpl(const uint32_t* in, uint32_t count, uint32_t prev, uint8_t* out) {
+    uint8_t* control = out;
+    uint8_t* data = out + controlBytes(count);
+    std::memset(control, 0, controlBytes(count));
+
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t value = in[i];
+        if constexpr (Delta) {
+            value = in[i] - prev;
+            prev = in[i];
+        }
+        uint8_t len = byteLength(value);
+        control[i / 4] |= (uint8_t)((len - 1) << (2 * (i % 4)));
+        std::memcpy(data, &value, len);
+        data += len;
+    }
+    return data - out;
+}
+
+}  // namespace
+
+bool simdAvailable() {
+#ifdef STREAM_VBYTE_X86
+    static const bool available = __builtin_cpu_supports("ssse3");
+    return available;
+#else
+    return false;
+#endif
+}
+
+size_t encodedSize(const uint32_t* in, uint32_t count) {
+    size_t size = controlBytes(count);
+    for (uint32_t i = 0; i < count; ++i) size += byteLength(in[i]);
+    return size;
+}
+
+size_t encodedDeltaSize(const uint32_t* in, uint32_t count, uint32_t prev) {
+    size_t size = controlBytes(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        size += byteLength(in[i] - prev);
+        prev = in[i];
+    }
+    return size;
+}
+
+size_t encode(const uint32_t* in, uint32_t count, uint8_t* out) { return encodeImpl<false>(in, count, 0, out); }
+
+size_t encodeDelta(const uint32_t* in, uint32_t count, uint32_t prev, uint8_t* out) {
+    return encodeImpl<true>(in, count, prev, out);
+}
+
+const uint8_t* decode(const uint8_t* in, uint32_t count, uint32_t* out) {
+    return decodeImpl<false>(in, count, 0, out, simdAvailable());
+}
+
+const uint8_t* decodeDelta(const uint8_t* in, uint32_t count, uint32_t prev, uint32_t* out) {
+    return decodeImpl<true>(in, count, prev, out, simdAvailable());
+}
+
+const uint8_t* decodeScalar(const uint8_t* in, uint32_t count, uint32_t* out) {
+    return decodeImpl<false>(in, count, 0, out, false);
+}
+
+const uint8_t* decodeDeltaScalar(const uint8_t* in, uint32_t count, uint32_t prev, uint32_t* out) {
+    return decodeImpl<true>(in, count, prev, out, false);
+}
+
+}  // namespace StreamVByte
@@ -0,0 +1,121 @@
+#include "term_dictionary.h"
+
+#include <algorithm>
+
+#include "index.h"
+
+namespace FrontCoding {
+
+std::string encode(const std::vector<std::string_view>& sorted_terms, const std::vector<uint32_t>& entries) {
+    Header header = {(uint32_t)sorted_terms.size(), (uint32_t)((sorted_terms.size() + BLOCK_SIZE - 1) / BLOCK_SIZE)};
+    std::vector<uint32_t> block_offsets;
+    block_offsets.reserve(header.num_blocks);
+
+    std::string blocks;
+    std::string_view prev;
+    for (size_t i = 0; i < sorted_terms.size(); ++i) {
+        std::string_view term = sorted_terms[i];
+        size_t shared = 0;
+        if (i % BLOCK_SIZE == 0) {
+            block_offsets.push_back((uint32_t)blocks.size());
+        } else {
+            size_t max_shared = std::min(prev.size(), term.size());
+            while (shared < max_shared && prev[shared] == term[shared]) ++shared;
+        }
+        appendVarInt(blocks, (uint32_t)shared);
+        appendVarInt(blocks, (uint32_t)(term.size() - shared));
+        blocks.append(term.substr(shared));
+        appendVarInt(blocks, entries[i]);
+        prev = term;
+    }
+
+    std::string out(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.append(reinterpret_cast<const char*>(block_offsets.data()), block_offsets.size() * sizeof(uint32_t));
+    out.append(blocks);
+    return out;
+}
+
+Reader::Reader(const char* section) {
+    header = reinterpret_cast<const Header*>(section);
+    block_offsets = reinterpret_cast<const uint32_t*>(section + sizeof(Header));
+    blocks = reinterpret_cast<const char*>(block_offsets + header->num_blocks);
+}
+
+std::string_view Reader::firstTerm(uint32_t block) const {
+    const char* ptr = blocks + block_offsets[block];
+    readVarInt(ptr);
+    uint32_t len = readVarInt(ptr);
+    return {ptr, len};
+}
+
+bool Reader::equals(uint32_t ordinal, std::string_view term) const {
+    if (!header || ordinal >= header->num_terms) return false;
+
+    // Track how much of `term` the current decoded term matches instead of rebuilding it
+    const char* ptr = blocks + block_offsets[ordinal / BLOCK_SIZE];
+    size_t matched = 0;
+    size_t len = 0;
+    for (uint32_t i = 0; i <= ordinal % BLOCK_SIZE; ++i) {
+        uint32_t shared = readVarInt(ptr);
+        uint32_t suffix_len = readVarInt(ptr);
+        if (shared <= matched) {
+            matched = shared;
+            while (matched < term.size() && matched - shared < suffix_len && ptr[matched - shared] == term[matched]) ++matched;
+        }
+        len = shared + suffix_len;
+        ptr += suffix_len;
+        readVarInt(ptr);
+    }
+    return matched == term.size() && len == term.size();
+}
+
+std::string Reader::termAt(uint32_t ordinal) const {
+    std::string term;
+    if (!header || ordinal >= header->num_terms) return term;
+
+    const char* ptr = blocks + block_offsets[ordinal / BLOCK_SIZE];
+    for (uint32_t i = 0; i <= ordinal % BLOCK_SIZE; ++i) {
+        uint32_t shared = readVarInt(ptr);
+        uint32_t suffix_len = readVarInt(ptr);
+        term.resize(shared);
+        term.append(ptr, suffix_len);
+        ptr += suffix_len;
+        readVarInt(ptr);
+    }
+    return term;
+}
+
+std::vector<std::pair<std::string, uint32_t>> Reader::prefixRange(std::string_view prefix, size_t limit) const {
+    std::vector<std::pair<std::string, uint32_t>> result;
+    if (!header || header->num_terms == 0) return result;
+
+    // Last block whose first term is < prefix: matches can start inside it
+    uint32_t lo = 0, hi = header->num_blocks;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (firstTerm(mid) < prefix)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    uint32_t block = lo > 0 ? lo - 1 : 0;
+
+    std::string term;
+    const char* ptr = blocks + block_offsets[block];
+    for (uint32_t ordinal = block * BLOCK_SIZE; ordinal < header->num_terms && result.size() < limit; ++ordinal) {
+        if (ordinal % BLOCK_SIZE == 0) ptr = blocks + block_offsets[ordinal / BLOCK_SIZE];
+        uint32_t shared = readVarInt(ptr);
+        uint32_t suffix_len = readVarInt(ptr);
+        term.resize(shared);
+        term.append(ptr, suffix_len);
+        ptr += suffix_len;
+        uint32_t entry = readVarInt(ptr);
+
+        if (term.compare(0, prefix.size(), prefix) < 0) continue;
+        if (term.compare(0, prefix.size(), prefix) > 0) break;
+        result.emplace_back(term, entry);
+    }
+    return result;
+}
+
+}  // namespace FrontCoding
@@ -35,8 +35,12 @@ std::vector<std::string> Tokenizer::getRawTokens(const std::string_view& query)
 
 void Tokenizer::tokenize(const std::string_view& text) {
     tokens.clear();
-    tokens.reserve(text.size() / 6);
-    total_len = 0;
+    total_len = tokenize(text, tokens);
+}
+
+size_t Tokenizer::tokenize(std::string_view text, std::vector<std::string>& out) const {
+    out.reserve(out.size() + text.size() / 6);
+    size_t length = 0;
 
     std::string current_token;
     current_token.reserve(32);
@@ -45,7 +49,7 @@ void Tokenizer::tokenize(const std::string_view& text) {
 
     auto flush_token = [&]() {
         if (!current_token.empty()) {
-            total_len += current_token.size();
+            length += current_token.size();
 
             stemmer->stem(current_token);
 
@@ -54,7 +58,7 @@ void Tokenizer::tokenize(const std::string_view& text) {
             }
 
             if (!current_token.empty()) {
-                tokens.push_back(current_token);
+                out.push_back(current_token);
             }
 
             current_token.clear();
@@ -102,6 +106,7 @@ void Tokenizer::tokenize(const std::string_view& text) {
     }
 
     flush_token();
+    return length;
 }
 
 std::vector<std::string> Tokenizer::getTokens() const { return tokens; }
@@ -347,6 +352,12 @@ void PorterStemmer::step5() {
 }
 
 void PorterStemmer::stem(std::string& input_word) {
+    // The steps keep their state in members, so every word gets a scratch stemmer of its own
+    PorterStemmer scratch;
+    scratch.run(input_word);
+}
+
+void PorterStemmer::run(std::string& input_word) {
     word = std::move(input_word);
 
     end = static_cast<int>(word.length() - 1);
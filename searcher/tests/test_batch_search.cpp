@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <random>
+
+#include "searcher.h"
+
+class BatchSearchTest : public ::testing::Test {
+protected:
+    std::string path = "/tmp/web_spider_batch_" + std::to_string(getpid()) + ".idx";
+    std::shared_ptr<MappedIndexSource> mapped;
+    const std::vector<std::string> queries = {"apple",         "apple banana",    "apple | lemon", "banana & !mango",
+                                              "lemon | mango", "app*",            "kiwi",          "(apple | banana) & lemon",
+                                              "apple",         "missing | apple", "!apple"};
+
+    void SetUp() override {
+        RamIndexSource src;
+        std::mt19937 rng(9);
+        const std::vector<std::string> words = {"apple", "banana", "lemon", "mango", "apricot", "kiwi"};
+        for (uint32_t d = 0; d < 3000; ++d) {
+            src.addUrl("http://doc/" + std::to_string(d));
+            for (size_t w = 0; w < words.size(); ++w) {
+                if (rng() % (2 + 2 * w) == 0) src.addDocument(words[w], d, 1 + rng() % 4);
+            }
+        }
+        BinaryFormat::DumpOptions options;
+        options.format = BinaryFormat::PostingFormat::Blocked;
+        options.front_coded_terms = true;
+        options.block_max = true;
+        src.dump(path, options);
+        mapped = std::make_shared<MappedIndexSource>(path);
+    }
+    void TearDown() override { unlink(path.c_str()); }
+
+    void expectSameAsSingleQueries(const ISearcher& searcher, size_t k) {
+        BatchResult batch = searcher.findDocuments(queries, k, 4);
+        ASSERT_EQ(batch.hits.size(), queries.size());
+        for (size_t i = 0; i < queries.size(); ++i) {
+            auto single = searcher.findDocument(queries[i], k);
+            ASSERT_EQ(batch.hits[i].size(), single.size()) << queries[i];
+            for (size_t j = 0; j < single.size(); ++j) {
+                EXPECT_EQ(batch.hits[i][j].doc_id, single[j].doc_id) << queries[i];
+                EXPECT_DOUBLE_EQ(batch.hits[i][j].score, single[j].score) << queries[i];
+            }
+        }
+    }
+};
+
+TEST_F(BatchSearchTest, RankedBatchMatchesSingleQueries) {
+    TFIDFSearcher searcher(mapped, std::make_shared<Tokenizer>());
+    expectSameAsSingleQueries(searcher, 10);
+    expectSameAsSingleQueries(searcher, 5000);
+}
+
+TEST_F(BatchSearchTest, BooleanBatchMatchesSingleQueries) {
+    BinarySearcher searcher(mapped, std::make_shared<Tokenizer>());
+    expectSameAsSingleQueries(searcher, 20);
+}
+
+TEST_F(BatchSearchTest, SharedListsAreDecodedOnce) {
+    TFIDFSearcher searcher(mapped, std::make_shared<Tokenizer>());
+    BatchResult batch = searcher.findDocuments(queries, 10);
+    // apple, banana, lemon, mango, kiwi and the missing term; apricot does not match app*
+    EXPECT_EQ(batch.stats.queries, queries.size());
+    EXPECT_EQ(batch.stats.distinct_terms, 6u);
+    // kiwi is only in one query, missing has no postings to share
+    EXPECT_EQ(batch.stats.decoded_terms, 4u);
+    uint64_t postings = 0;
+    for (const std::string term : {"apple", "banana", "lemon", "mango"}) postings += mapped->openCursor(term).size();
+    EXPECT_EQ(batch.stats.decoded_postings, postings);
+    EXPECT_GT(batch.stats.queriesPerSecond(), 0);
+    // Nothing from the batch lands in the result cache
+    EXPECT_EQ(searcher.resultCacheStats().misses, 0u);
+}
+
+TEST_F(BatchSearchTest, EmptyBatch) {
+    TFIDFSearcher searcher(mapped, std::make_shared<Tokenizer>());
+    BatchResult batch = searcher.findDocuments({}, 10);
+    EXPECT_TRUE(batch.hits.empty());
+    EXPECT_EQ(batch.stats.distinct_terms, 0u);
+}
@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+
+#include "external_index.h"
+#include "indexing_pipeline.h"
+
+class ExternalIndexTest : public ::testing::Test {
+protected:
+    std::string dir = "/tmp/web_spider_spimi_test_" + std::to_string(getpid());
+    std::string memory_path = dir + "/memory.idx";
+    std::string external_path = dir + "/external.idx";
+    std::vector<std::pair<std::string, std::string>> docs;
+    std::shared_ptr<Tokenizer> tokenizer = std::make_shared<Tokenizer>(std::make_unique<PorterStemmer>());
+    IndexatorFactory factory = [this](std::shared_ptr<RamIndexSource> source) {
+        return std::make_shared<TFIDFIndexator>(source, tokenizer);
+    };
+
+    void SetUp() override {
+        std::filesystem::create_directories(dir);
+        std::mt19937 rng(9);
+        for (int d = 0; d < 400; ++d) {
+            std::string text;
+            // A long tail of rare words keeps many terms in a single run
+            for (uint32_t w = 0, n = 5 + rng() % 40; w < n; ++w) {
+                text += "word" + std::to_string(rng() % (50 + rng() % 300)) + ' ';
+            }
+            if (d % 3 == 0) text += "running runners ";
+            docs.emplace_back("http://doc/" + std::to_string(d), text);
+        }
+    }
+    void TearDown() override { std::filesystem::remove_all(dir); }
+
+    std::shared_ptr<RamIndexSource> buildInMemory() {
+        auto source = std::make_shared<RamIndexSource>();
+        TFIDFIndexator indexator(source, tokenizer);
+        for (const auto& [url, text] : docs) indexator.addDocument(url, text);
+        return source;
+    }
+
+    static std::string readFile(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    }
+};
+
+TEST_F(ExternalIndexTest, SpilledRunsMergeIntoTheSameIndex) {
+    auto source = buildInMemory();
+
+    // An empty source already holds its hash table
+    const uint64_t empty = RamIndexSource().memoryUsage();
+
+    for (auto format : {BinaryFormat::PostingFormat::Raw, BinaryFormat::PostingFormat::VarInt,
+                        BinaryFormat::PostingFormat::Blocked, BinaryFormat::PostingFormat::StreamVByte}) {
+        const bool front_coded = format != BinaryFormat::PostingFormat::Raw && format != BinaryFormat::PostingFormat::Blocked;
+        BinaryFormat::DumpOptions options;
+        options.format = format;
+        options.block_max = true;
+        options.front_coded_terms = front_coded;
+        options.eytzinger_directory = !front_coded;
+        options.quantize_doc_lengths = !front_coded;
+        options.bitmap_containers = true;
+        options.perfect_hash = true;
+        source->dump(memory_path, options);
+
+        ExternalIndexBuilder::Options build_options;
+        build_options.memory_budget = empty + (8 << 10);
+        build_options.temp_dir = dir;
+        ExternalIndexBuilder builder(factory, build_options);
+        for (const auto& [url, text] : docs) builder.addDocument(url, text);
+        BinaryFormat::DumpStats stats = builder.finish(external_path, options);
+
+        EXPECT_GT(builder.stats().runs, 10u);
+        EXPECT_EQ(builder.stats().docs, docs.size());
+        EXPECT_GE(builder.stats().peak_memory, build_options.memory_budget);
+        EXPECT_LT(builder.stats().peak_memory, build_options.memory_budget + 8192);
+        EXPECT_LT(builder.stats().peak_memory - empty, (source->memoryUsage() - empty) / 10);
+        EXPECT_EQ(stats.bytes, readFile(memory_path).size());
+        EXPECT_TRUE(readFile(memory_path) == readFile(external_path));
+
+        // Runs and scratch files are gone, only the two indexes are left
+        EXPECT_EQ(std::distance(std::filesystem::directory_iterator(dir), std::filesystem::directory_iterator()), 2);
+    }
+
+    MappedIndexSource mapped(external_path);
+    EXPECT_EQ(mapped.getTotalDocs(), docs.size());
+    EXPECT_EQ(mapped.getPostings("run").size(), source->getPostings("run").size());
+}
+
+TEST_F(ExternalIndexTest, SingleRunWhenEverythingFits) {
+    auto source = buildInMemory();
+    source->dump(memory_path, BinaryFormat::PostingFormat::Blocked);
+
+    ExternalIndexBuilder builder(factory, {1ull << 30, dir});
+    for (const auto& [url, text] : docs) builder.addDocument(url, text);
+    BinaryFormat::DumpOptions options;
+    options.format = BinaryFormat::PostingFormat::Blocked;
+    builder.finish(external_path, options);
+
+    EXPECT_EQ(builder.stats().runs, 1u);
+    EXPECT_TRUE(readFile(memory_path) == readFile(external_path));
+}
+
+TEST_F(ExternalIndexTest, FeedsFromThePipeline) {
+    auto source = buildInMemory();
+    source->dump(memory_path, BinaryFormat::PostingFormat::StreamVByte);
+
+    // Every run gets its own tokenizer, so the workers must not reach the current run's
+    auto own_tokenizer = [](std::shared_ptr<RamIndexSource> source) {
+        return std::make_shared<TFIDFIndexator>(source, std::make_shared<Tokenizer>(std::make_unique<PorterStemmer>()));
+    };
+    const uint64_t budget = RamIndexSource().memoryUsage() + (16 << 10);
+    auto builder = std::make_shared<ExternalIndexBuilder>(own_tokenizer, ExternalIndexBuilder::Options{budget, dir});
+    IndexingPipeline::Options pipeline_options;
+    pipeline_options.workers = 3;
+    IndexingPipeline pipeline(builder, [](const std::string& raw, std::string& text) { text = raw; }, pipeline_options);
+    for (const auto& [url, text] : docs) pipeline.push(url, text);
+    pipeline.finish();
+
+    BinaryFormat::DumpOptions options;
+    options.format = BinaryFormat::PostingFormat::StreamVByte;
+    builder->finish(external_path, options);
+    EXPECT_GT(builder->stats().runs, 1u);
+    EXPECT_TRUE(readFile(memory_path) == readFile(external_path));
+}
+
+TEST_F(ExternalIndexTest, RejectsImpactSections) {
+    ExternalIndexBuilder builder(factory, {1 << 20, dir});
+    builder.addDocument("http://a", "apple apple banana");
+    BinaryFormat::DumpOptions options;
+    options.impacts = true;
+    EXPECT_THROW(builder.finish(external_path, options), std::invalid_argument);
+}
@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "eytzinger.h"
+#include "index.h"
+
+TEST(EytzingerTests, LowerBoundMatchesSortedSearch) {
+    std::mt19937 rng(3);
+    for (uint32_t n : {0u, 1u, 2u, 3u, 15u, 16u, 17u, 100u, 1023u, 4096u}) {
+        std::vector<uint32_t> sorted(n);
+        // Small value range so there are plenty of duplicates
+        for (auto& v : sorted) v = rng() % (n + 1) * 3;
+        std::sort(sorted.begin(), sorted.end());
+
+        std::vector<uint32_t> keys, ranks;
+        Eytzinger::build(sorted.data(), n, keys, ranks);
+        ASSERT_EQ(keys.size(), n + 1);
+
+        for (uint32_t x = 0; x <= 3 * n + 4; ++x) {
+            uint32_t expected = std::lower_bound(sorted.begin(), sorted.end(), x) - sorted.begin();
+            EXPECT_EQ(Eytzinger::lowerBound(keys.data(), ranks.data(), n, x), expected) << "n=" << n << " x=" << x;
+        }
+    }
+}
+
+TEST(EytzingerTests, MappedIndexLooksUpThroughSection) {
+    // Two terms with the same 32-bit hash exercise the collision scan after the search
+    std::unordered_map<uint32_t, std::string> seen;
+    std::string first, second;
+    for (uint32_t i = 0; second.empty(); ++i) {
+        std::string term = "c" + std::to_string(i);
+        auto [it, inserted] = seen.emplace(stringHash(term), term);
+        if (!inserted) {
+            first = it->second;
+            second = term;
+        }
+    }
+
+    auto src = std::make_shared<RamIndexSource>();
+    const uint32_t N = 300;
+    for (uint32_t d = 0; d < N; ++d) {
+        src->addUrl("u" + std::to_string(d));
+        for (uint32_t t = 0; t < 60; ++t) {
+            if (d % (t + 2) == 0) src->addDocument("term" + std::to_string(t), d, 1);
+        }
+        if (d % 3 == 0) src->addDocument(first, d, 1);
+        if (d % 4 == 0) src->addDocument(second, d, 1);
+    }
+
+    std::string path = "/tmp/web_spider_eytzinger_" + std::to_string(getpid()) + ".idx";
+    BinaryFormat::DumpOptions options;
+    options.eytzinger_directory = true;
+    src->dump(path, options);
+
+    MappedIndexSource mapped(path);
+    EXPECT_TRUE(mapped.hasEytzingerDirectory());
+    for (uint32_t t = 0; t < 60; ++t) {
+        EXPECT_EQ(mapped.getPostings("term" + std::to_string(t)).size(), (N + t + 1) / (t + 2)) << t;
+    }
+    EXPECT_EQ(mapped.getPostings(first).size(), N / 3);
+    EXPECT_EQ(mapped.getPostings(second).size(), N / 4);
+    EXPECT_TRUE(mapped.getPostings("term60").empty());
+    EXPECT_TRUE(mapped.getPostings("").empty());
+
+    unlink(path.c_str());
+}
@@ -0,0 +1,160 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <random>
+
+#include "index.h"
+#include "searcher.h"
+
+class ImpactsTest : public ::testing::Test {
+protected:
+    std::string path = "/tmp/web_spider_impacts_" + std::to_string(getpid()) + ".idx";
+    std::shared_ptr<RamIndexSource> src = std::make_shared<RamIndexSource>();
+    const std::vector<std::string> words = {"apple", "banana", "lemon", "mango"};
+
+    void SetUp() override {
+        std::mt19937 rng(11);
+        for (uint32_t d = 0; d < 3000; ++d) {
+            src->addUrl("http://doc/" + std::to_string(d));
+            for (size_t w = 0; w < words.size(); ++w) {
+                // Rarer words get higher idf; tfs are skewed towards 1
+                if (rng() % (2 + 3 * w) == 0) src->addDocument(words[w], d, 1 + rng() % 3 * (rng() % 5));
+            }
+        }
+    }
+    void TearDown() override { unlink(path.c_str()); }
+
+    std::shared_ptr<MappedIndexSource> dump(bool ordered) {
+        BinaryFormat::DumpOptions options;
+        options.format = BinaryFormat::PostingFormat::StreamVByte;
+        options.impacts = true;
+        options.impact_ordered = ordered;
+        src->dump(path, options);
+        return std::make_shared<MappedIndexSource>(path);
+    }
+};
+
+TEST_F(ImpactsTest, QuantizedScoresStayWithinHalfAUnit) {
+    auto mapped = dump(true);
+    ASSERT_TRUE(mapped->hasImpacts());
+    ASSERT_TRUE(mapped->hasImpactOrder());
+
+    uint32_t top = 0;
+    for (const auto& word : words) {
+        TermImpacts impacts = mapped->getImpacts(word);
+        PostingCursor cursor = mapped->openCursor(word);
+        ASSERT_EQ(impacts.impacts.size(), cursor.size());
+        double idf = std::log(3000.0 / (1 + cursor.size()));
+        EXPECT_FLOAT_EQ(impacts.idf, (float)idf);
+        for (size_t i = 0; cursor.valid(); cursor.next(), ++i) {
+            double exact = tfWeight(cursor.tf()) * idf;
+            EXPECT_LE(std::abs(impacts.impacts[i] * impacts.scale - exact), impacts.scale * 0.5 + 1e-6);
+            EXPECT_LE(impacts.impacts[i], impacts.max_impact);
+        }
+        top = std::max(top, impacts.max_impact);
+    }
+    EXPECT_EQ(top, 255u);
+}
+
+TEST_F(ImpactsTest, OrderedSegmentsCoverTheList) {
+    auto mapped = dump(true);
+    for (const auto& word : words) {
+        TermImpacts impacts = mapped->getImpacts(word);
+        std::vector<uint32_t> docs;
+        const uint32_t* next = impacts.docs;
+        for (size_t s = 0; s < impacts.segments.size(); ++s) {
+            if (s > 0) {
+                EXPECT_LT(impacts.segments[s].impact, impacts.segments[s - 1].impact);
+            }
+            EXPECT_TRUE(std::is_sorted(next, next + impacts.segments[s].count));
+            docs.insert(docs.end(), next, next + impacts.segments[s].count);
+            next += impacts.segments[s].count;
+        }
+        std::sort(docs.begin(), docs.end());
+        std::vector<uint32_t> expected;
+        for (PostingCursor cursor = mapped->openCursor(word); cursor.valid(); cursor.next()) expected.push_back(cursor.doc());
+        EXPECT_EQ(docs, expected);
+    }
+}
+
+TEST_F(ImpactsTest, ScoreAtATimeMatchesExhaustiveRanking) {
+    auto mapped = dump(true);
+    TFIDFSearcher searcher(mapped, std::make_shared<Tokenizer>());
+    searcher.setResultCacheCapacity(0);
+    searcher.setImpactScoring(true);
+
+    for (const std::string query : {"apple | banana", "banana | lemon | mango", "apple | banana | lemon | mango", "mango"}) {
+        auto all = searcher.findDocument(query);
+        for (size_t k : {1, 10, 100, 5000}) {
+            auto page = searcher.findDocument(query, k);
+            ASSERT_EQ(page.size(), std::min(k, all.size())) << query;
+            for (size_t i = 0; i < page.size(); ++i) {
+                EXPECT_EQ(searcher.getUrl(page[i].doc_id), all[i].first) << query << " k=" << k << " i=" << i;
+                EXPECT_DOUBLE_EQ(page[i].score, all[i].second);
+            }
+        }
+    }
+}
+
+TEST_F(ImpactsTest, ImpactScoresApproximateExactOnes) {
+    auto mapped = dump(false);
+    TFIDFSearcher exact(mapped, std::make_shared<Tokenizer>());
+    TFIDFSearcher quantized(mapped, std::make_shared<Tokenizer>());
+    quantized.setImpactScoring(true);
+    const double scale = mapped->getImpacts("apple").scale;
+
+    // Without impact-ordered lists OR queries go through the exhaustive path, AND queries always do
+    for (const std::string query : {"apple | lemon", "apple & banana", "banana & !mango"}) {
+        auto a = exact.findDocument(query);
+        auto b = quantized.findDocument(query);
+        ASSERT_EQ(a.size(), b.size());
+        std::unordered_map<std::string, double> exact_scores(a.begin(), a.end());
+        for (const auto& [url, score] : b) EXPECT_NEAR(score, exact_scores[url], 2 * scale * 0.5 + 1e-6) << query;
+    }
+}
+
+TEST_F(ImpactsTest, PlainIndexKeepsExactScoring) {
+    src->dump(path, BinaryFormat::PostingFormat::VarInt);
+    auto mapped = std::make_shared<MappedIndexSource>(path);
+    EXPECT_FALSE(mapped->hasImpacts());
+    EXPECT_TRUE(mapped->getImpacts("apple").impacts.empty());
+
+    TFIDFSearcher exact(mapped, std::make_shared<Tokenizer>());
+    TFIDFSearcher quantized(mapped, std::make_shared<Tokenizer>());
+    quantized.setImpactScoring(true);
+    auto a = exact.findDocument("apple | banana", 20);
+    auto b = quantized.findDocument("apple | banana", 20);
+    ASSERT_EQ(a.size(), b.size());
+    for (size_t i = 0; i < a.size(); ++i) EXPECT_DOUBLE_EQ(a[i].score, b[i].score);
+}
+
+TEST_F(ImpactsTest, ScoreAtATimeStopsOnSkewedImpacts) {
+    // Ten documents repeat every word, the rest mention them once: the page is decided early
+    src = std::make_shared<RamIndexSource>();
+    std::mt19937 rng(5);
+    for (uint32_t d = 0; d < 3000; ++d) {
+        src->addUrl("http://doc/" + std::to_string(d));
+        for (const auto& word : words) {
+            if (d % 300 == 0) {
+                src->addDocument(word, d, 40 + d / 300);
+            } else if (rng() % 3 == 0) {
+                src->addDocument(word, d, 1 + rng() % 2);
+            }
+        }
+    }
+    auto mapped = dump(true);
+    TFIDFSearcher searcher(mapped, std::make_shared<Tokenizer>());
+    searcher.setResultCacheCapacity(0);
+    searcher.setImpactScoring(true);
+
+    auto all = searcher.findDocument("apple | banana | lemon | mango");
+    for (size_t k : {1, 5, 10, 11}) {
+        auto page = searcher.findDocument("apple | banana | lemon | mango", k);
+        ASSERT_EQ(page.size(), k);
+        for (size_t i = 0; i < k; ++i) {
+            EXPECT_EQ(searcher.getUrl(page[i].doc_id), all[i].first) << "k=" << k << " i=" << i;
+            EXPECT_DOUBLE_EQ(page[i].score, all[i].second);
+        }
+    }
+}
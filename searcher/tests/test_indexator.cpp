@@ -431,4 +431,29 @@ TEST(TFIDFIndexatorTests, PostingsAreAppendedInIncreasingOrder) {
     std::vector<int> actual;
     for (const auto &p : *shared) actual.push_back(p.doc_id);
     EXPECT_EQ(actual, expected);
-}
\ No newline at end of file
+}
+
+TEST(IndexatorTests, RecordsDocumentLengthsAndCollectionStats) {
+    auto src = std::make_shared<RamIndexSource>();
+    auto tokenizer = std::make_shared<Tokenizer>();
+
+    TFIDFIndexator idx(src, tokenizer);
+    idx.addDocument("http://a", "apple banana apple");
+    idx.addDocument("http://b", "");
+    idx.addDocument("http://c", "apple cherry date fig");
+
+    DocLengths lengths = src->getDocLengths();
+    ASSERT_EQ(lengths.size, 3u);
+    EXPECT_EQ(lengths[0], 3u);
+    EXPECT_EQ(lengths[1], 0u);
+    EXPECT_EQ(lengths[2], 4u);
+
+    CollectionStats stats = src->getCollectionStats();
+    EXPECT_EQ(stats.num_docs, 3u);
+    EXPECT_EQ(stats.total_tokens, 7u);
+    EXPECT_DOUBLE_EQ(stats.averageDocLength(), 7.0 / 3);
+
+    EXPECT_EQ(src->getCollectionFrequency("apple"), 3u);
+    EXPECT_EQ(src->getCollectionFrequency("date"), 1u);
+    EXPECT_EQ(src->getCollectionFrequency("missing"), 0u);
+}
@@ -0,0 +1,206 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <thread>
+
+#include "indexing_pipeline.h"
+
+TEST(BoundedQueueTest, PushPopAndCapacity) {
+    BoundedQueue<int> queue(5);
+    EXPECT_EQ(queue.capacity(), 8u);
+    for (int i = 0; i < 8; ++i) {
+        int value = i;
+        ASSERT_TRUE(queue.tryPush(value));
+    }
+    int extra = 8;
+    EXPECT_FALSE(queue.tryPush(extra));
+    EXPECT_EQ(queue.size(), 8u);
+
+    for (int i = 0; i < 8; ++i) EXPECT_EQ(queue.pop(), i);
+    int value;
+    EXPECT_FALSE(queue.tryPop(value));
+    queue.close();
+    EXPECT_FALSE(queue.pop().has_value());
+}
+
+TEST(BoundedQueueTest, ManyProducersAndConsumersSeeEveryItemOnce) {
+    BoundedQueue<uint64_t> queue(64);
+    const uint64_t per_producer = 20000;
+    std::vector<std::thread> producers, consumers;
+    std::vector<uint64_t> sums(4, 0), counts(4, 0);
+
+    for (uint64_t p = 0; p < 4; ++p) {
+        producers.emplace_back([&, p] {
+            for (uint64_t i = 0; i < per_producer; ++i) queue.push(p * per_producer + i);
+        });
+    }
+    for (int c = 0; c < 4; ++c) {
+        consumers.emplace_back([&, c] {
+            while (auto value = queue.pop()) {
+                sums[c] += *value;
+                counts[c]++;
+            }
+        });
+    }
+    for (auto& producer : producers) producer.join();
+    queue.close();
+    for (auto& consumer : consumers) consumer.join();
+
+    uint64_t total = 4 * per_producer, sum = 0, count = 0;
+    for (int c = 0; c < 4; ++c) {
+        sum += sums[c];
+        count += counts[c];
+    }
+    EXPECT_EQ(count, total);
+    EXPECT_EQ(sum, total * (total - 1) / 2);
+}
+
+class IndexingPipelineTest : public ::testing::Test {
+protected:
+    std::string serial_path = "/tmp/web_spider_serial_" + std::to_string(getpid()) + ".idx";
+    std::string pipeline_path = "/tmp/web_spider_pipeline_" + std::to_string(getpid()) + ".idx";
+    std::vector<std::pair<std::string, std::string>> docs;
+
+    void SetUp() override {
+        std::mt19937 rng(3);
+        const std::vector<std::string> words = {"running", "runners", "apple", "<b>banana</b>", "lemons", "connected",
+                                                "generalization", "mango", "<i>hopping</i>", "42"};
+        for (int d = 0; d < 300; ++d) {
+            std::string html;
+            for (uint32_t w = 0, n = 5 + rng() % 20; w < n; ++w) html += words[rng() % words.size()] + ' ';
+            docs.emplace_back("http://doc/" + std::to_string(d), html);
+        }
+    }
+    void TearDown() override {
+        unlink(serial_path.c_str());
+        unlink(pipeline_path.c_str());
+    }
+
+    // Drops tags, standing in for the HTML extraction of the downloader
+    static void stripTags(const std::string& raw, std::string& text) {
+        bool in_tag = false;
+        for (char ch : raw) {
+            if (ch == '<') in_tag = true;
+            if (!in_tag) text += ch;
+            if (ch == '>') in_tag = false;
+        }
+    }
+
+    static std::string readFile(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    }
+};
+
+TEST_F(IndexingPipelineTest, MatchesSerialBuild) {
+    auto serial = std::make_shared<RamIndexSource>();
+    TFIDFIndexator serial_indexator(serial, std::make_shared<Tokenizer>(std::make_unique<PorterStemmer>()));
+    for (const auto& [url, html] : docs) {
+        std::string text;
+        stripTags(html, text);
+        serial_indexator.addDocument(url, text);
+    }
+
+    for (unsigned workers : {1u, 3u, 8u}) {
+        auto piped = std::make_shared<RamIndexSource>();
+        auto indexator = std::make_shared<TFIDFIndexator>(piped, std::make_shared<Tokenizer>(std::make_unique<PorterStemmer>()));
+        IndexingPipeline::Options options;
+        options.workers = workers;
+        options.queue_capacity = 16;
+        IndexingPipeline pipeline(indexator, stripTags, options);
+        EXPECT_EQ(pipeline.workers(), workers);
+        for (const auto& [url, html] : docs) pipeline.push(url, html);
+        PipelineStats stats = pipeline.finish();
+
+        EXPECT_EQ(stats.read.items, docs.size());
+        EXPECT_EQ(stats.parse.items, docs.size());
+        EXPECT_EQ(stats.index.items, docs.size());
+        EXPECT_EQ(stats.parse.threads, workers);
+        EXPECT_EQ(stats.parse.bytes, stats.read.bytes);
+        EXPECT_EQ(stats.index.bytes, serial->total_tokens);
+        EXPECT_LE(stats.parse.max_depth, 16u);
+        EXPECT_LE(stats.index.max_depth, 16u);
+
+        EXPECT_EQ(piped->urls, serial->urls);
+        EXPECT_EQ(piped->doc_lengths, serial->doc_lengths);
+        BinaryFormat::DumpOptions dump_options;
+        dump_options.format = BinaryFormat::PostingFormat::StreamVByte;
+        serial->dump(serial_path, dump_options);
+        piped->dump(pipeline_path, dump_options);
+        EXPECT_EQ(readFile(serial_path), readFile(pipeline_path)) << workers << " workers";
+    }
+}
+
+TEST_F(IndexingPipelineTest, DestructorFinishesTheBuild) {
+    auto source = std::make_shared<RamIndexSource>();
+    auto indexator = std::make_shared<BooleanIndexator>(source, std::make_shared<Tokenizer>());
+    {
+        IndexingPipeline pipeline(indexator, stripTags);
+        for (size_t d = 0; d < 100; ++d) pipeline.push(docs[d].first, docs[d].second);
+    }
+    ASSERT_EQ(source->urls.size(), 100u);
+    EXPECT_EQ(source->urls[99], docs[99].first);
+}
+
+TEST_F(IndexingPipelineTest, StalledWorkerKeepsTheReorderBufferBounded) {
+    auto source = std::make_shared<RamIndexSource>();
+    auto indexator = std::make_shared<BooleanIndexator>(source, std::make_shared<Tokenizer>());
+    IndexingPipeline::Options options;
+    options.workers = 4;
+    options.queue_capacity = 64;
+    options.reorder_window = 8;
+    auto slow_first = [](const std::string& raw, std::string& text) {
+        if (raw == "stall") std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        stripTags(raw, text);
+    };
+    IndexingPipeline pipeline(indexator, slow_first, options);
+    pipeline.push("http://stall", "stall");
+    for (size_t d = 0; d < 200; ++d) pipeline.push(docs[d].first, docs[d].second);
+    PipelineStats stats = pipeline.finish();
+
+    EXPECT_LT(stats.max_reorder, 8u);
+    ASSERT_EQ(source->urls.size(), 201u);
+    EXPECT_EQ(source->urls[0], "http://stall");
+    EXPECT_EQ(source->urls[200], docs[199].first);
+}
+
+TEST_F(IndexingPipelineTest, ShardedBuildDumpsLikeSerialBuild) {
+    auto serial = std::make_shared<RamIndexSource>();
+    TFIDFIndexator serial_indexator(serial, std::make_shared<Tokenizer>(std::make_unique<PorterStemmer>()));
+    for (const auto& [url, html] : docs) {
+        std::string text;
+        stripTags(html, text);
+        serial_indexator.addDocument(url, text);
+    }
+    BinaryFormat::DumpOptions dump_options;
+    dump_options.format = BinaryFormat::PostingFormat::Blocked;
+    dump_options.block_max = true;
+    serial->dump(serial_path, dump_options);
+
+    auto tokenizer = std::make_shared<Tokenizer>(std::make_unique<PorterStemmer>());
+    auto factory = [&](std::shared_ptr<RamIndexSource> shard) { return std::make_shared<TFIDFIndexator>(shard, tokenizer); };
+    // Twelve equal shards, whatever the size of the corpus
+    const uint32_t shard_docs = docs.size() / 12;
+    for (unsigned indexers : {1u, 3u}) {
+        IndexingPipeline::Options options;
+        options.workers = 4;
+        options.queue_capacity = 16;
+        options.indexers = indexers;
+        options.shard_docs = shard_docs;
+        IndexingPipeline pipeline(factory, stripTags, options);
+        for (const auto& [url, html] : docs) pipeline.push(url, html);
+        PipelineStats stats = pipeline.finish();
+
+        EXPECT_EQ(stats.index.items, docs.size());
+        EXPECT_EQ(stats.index.threads, indexers);
+        ASSERT_EQ(pipeline.shards().size(), 12u);
+        for (const auto& shard : pipeline.shards()) EXPECT_EQ(shard->getTotalDocs(), shard_docs);
+        EXPECT_EQ(pipeline.shards()[1]->urls[0], docs[shard_docs].first);
+
+        RamIndexSource::dumpShards(pipeline.shards(), pipeline_path, dump_options);
+        EXPECT_EQ(readFile(serial_path), readFile(pipeline_path)) << indexers << " indexers";
+    }
+}
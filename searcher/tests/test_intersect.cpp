@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+
+#include "intersect.h"
+#include "searcher.h"
+
+static std::vector<TermInfo> random_list(std::mt19937& rng, uint32_t size, uint32_t universe) {
+    std::vector<uint32_t> docs(size);
+    for (auto& d : docs) d = rng() % universe;
+    std::sort(docs.begin(), docs.end());
+    docs.erase(std::unique(docs.begin(), docs.end()), docs.end());
+    std::vector<TermInfo> list;
+    for (uint32_t d : docs) list.push_back({d, d % 7 + 1});
+    return list;
+}
+
+static std::vector<TermInfo> naive_intersect(const std::vector<TermInfo>& a, const std::vector<TermInfo>& b) {
+    std::vector<TermInfo> res;
+    for (const auto& t : a) {
+        if (std::binary_search(b.begin(), b.end(), t, [](const TermInfo& x, const TermInfo& y) { return x.doc_id < y.doc_id; }))
+            res.push_back(t);
+    }
+    return res;
+}
+
+static void expect_same(const std::vector<TermInfo>& got, const std::vector<TermInfo>& want) {
+    ASSERT_EQ(got.size(), want.size());
+    for (size_t i = 0; i < got.size(); ++i) {
+        EXPECT_EQ(got[i].doc_id, want[i].doc_id) << "at " << i;
+        EXPECT_EQ(got[i].tf, want[i].tf) << "at " << i;
+    }
+}
+
+TEST(IntersectKernels, AllKernelsMatchNaive) {
+    std::mt19937 rng(3);
+    for (uint32_t a_size : {0u, 1u, 3u, 7u, 8u, 9u, 100u, 1000u}) {
+        for (uint32_t b_size : {0u, 1u, 5u, 16u, 33u, 1000u, 20000u}) {
+            auto a = random_list(rng, a_size, 3000);
+            auto b = random_list(rng, b_size, 3000);
+            auto want = naive_intersect(a, b);
+            for (auto kernel : {Intersect::Kernel::Auto, Intersect::Kernel::Merge, Intersect::Kernel::Gallop,
+                                Intersect::Kernel::Sse, Intersect::Kernel::Avx2}) {
+                std::vector<TermInfo> got;
+                Intersect::intersect(a, b, got, kernel);
+                SCOPED_TRACE(testing::Message() << a_size << "x" << b_size << " kernel " << (int)kernel);
+                expect_same(got, want);
+            }
+        }
+    }
+}
+
+TEST(IntersectKernels, PrefixStopsWhenOneSideRunsOut) {
+    std::vector<TermInfo> a = {{1, 1}, {2, 1}, {3, 1}, {4, 1}, {5, 1}, {6, 1}, {7, 1}, {8, 1}, {9, 1}};
+    std::vector<TermInfo> b = {{2, 1}, {4, 1}, {20, 1}};
+    std::vector<TermInfo> out;
+    auto [i, j] = Intersect::intersectPrefix(a, b, out);
+    EXPECT_EQ(i, a.size());
+    EXPECT_EQ(j, 2u);
+    ASSERT_EQ(out.size(), 2u);
+    EXPECT_EQ(out[1].doc_id, 4u);
+}
+
+TEST(IntersectKernels, CursorIntersectionAcrossEncodings) {
+    std::mt19937 rng(5);
+    for (auto [a_size, b_size] : {std::pair{5000u, 4000u}, std::pair{50u, 40000u}, std::pair{40000u, 50u}}) {
+        auto a = random_list(rng, a_size, 100000);
+        auto b = random_list(rng, b_size, 100000);
+        auto want = naive_intersect(a, b);
+
+        RamIndexSource src;
+        for (uint32_t d = 0; d < 100000; ++d) src.addUrl("u");
+        for (const auto& t : a) src.addDocument("alpha", t.doc_id, t.tf);
+        for (const auto& t : b) src.addDocument("beta", t.doc_id, t.tf);
+        PostingCursor c1 = src.openCursor("alpha"), c2 = src.openCursor("beta");
+        expect_same(intersect_lists(c1, c2), want);
+        expect_same(intersect_lists(a, b), want);
+
+        // Windowed cursors: the block kernel and skipTo have to agree across window boundaries
+        std::string path = "/tmp/web_spider_intersect_" + std::to_string(getpid()) + ".idx";
+        for (auto format : {BinaryFormat::PostingFormat::VarInt, BinaryFormat::PostingFormat::Blocked,
+                            BinaryFormat::PostingFormat::StreamVByte}) {
+            src.dump(path, format);
+            MappedIndexSource mapped(path);
+            PostingCursor m1 = mapped.openCursor("alpha"), m2 = mapped.openCursor("beta");
+            SCOPED_TRACE(testing::Message() << a_size << "x" << b_size << " format " << (int)format);
+            expect_same(intersect_lists(m1, m2), want);
+        }
+        unlink(path.c_str());
+    }
+}
@@ -1,8 +1,10 @@
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <gtest/gtest.h>
 #include <unistd.h>
 
 #include <cstdio>
+#include <fstream>
 #include <memory>
 #include <string>
 #include <vector>
@@ -166,3 +168,395 @@ TEST(MappedIndexSourceTests, DumpToDirectoryThrows) {
 
     rmdir(dirpath.c_str());
 }
+
+static std::shared_ptr<RamIndexSource> make_strided_source(uint32_t num_docs) {
+    auto src = std::make_shared<RamIndexSource>();
+    for (uint32_t d = 0; d < num_docs; ++d) {
+        src->addUrl("http://doc" + std::to_string(d));
+        if (d % 3 == 0) src->addDocument("three", d, d % 7 + 1);
+        if (d % 5 == 0) src->addDocument("five", d, 2);
+    }
+    return src;
+}
+
+TEST(PostingCursorTests, IteratesAndSkipsAcrossWindowsAllFormats) {
+    const uint32_t N = 1000;
+    auto src = make_strided_source(N);
+
+    for (auto format : {BinaryFormat::PostingFormat::Raw, BinaryFormat::PostingFormat::VarInt,
+                        BinaryFormat::PostingFormat::Blocked, BinaryFormat::PostingFormat::StreamVByte}) {
+        std::string path = create_temp_file();
+        src->dump(path, format);
+        MappedIndexSource mapped(path);
+
+        PostingCursor c = mapped.openCursor("three");
+        EXPECT_EQ(c.size(), (N + 2) / 3);
+        uint32_t expected = 0;
+        for (; c.valid(); c.next(), expected += 3) {
+            ASSERT_EQ(c.doc(), expected);
+            EXPECT_EQ(c.tf(), expected % 7 + 1);
+        }
+        EXPECT_EQ(expected, 1002u);
+        EXPECT_EQ(c.doc(), PostingCursor::END);
+
+        PostingCursor s = mapped.openCursor("three");
+        s.skipTo(500);
+        EXPECT_EQ(s.doc(), 501u);
+        s.skipTo(501);
+        EXPECT_EQ(s.doc(), 501u);
+        s.skipTo(998);
+        EXPECT_EQ(s.doc(), 999u);
+        s.skipTo(1000);
+        EXPECT_FALSE(s.valid());
+
+        unlink(path.c_str());
+    }
+}
+
+TEST(PostingCursorTests, CopyKeepsIndependentPosition) {
+    auto src = make_strided_source(1000);
+    std::string path = create_temp_file();
+    src->dump(path, true);
+    MappedIndexSource mapped(path);
+
+    PostingCursor a = mapped.openCursor("five");
+    a.skipTo(400);
+    PostingCursor b = a;
+    a.next();
+    EXPECT_EQ(a.doc(), 405u);
+    EXPECT_EQ(b.doc(), 400u);
+    b.skipTo(995);
+    EXPECT_EQ(b.doc(), 995u);
+    EXPECT_EQ(a.doc(), 405u);
+
+    unlink(path.c_str());
+}
+
+TEST(PostingCursorTests, MissingTermGivesEmptyCursor) {
+    auto src = make_strided_source(10);
+    PostingCursor c = src->openCursor("absent");
+    EXPECT_FALSE(c.valid());
+    EXPECT_EQ(c.size(), 0u);
+    EXPECT_EQ(src->index.find("absent"), nullptr);
+}
+
+TEST(PostingCursorTests, BlockedSkipsWholeBlocks) {
+    auto src = std::make_shared<RamIndexSource>();
+    const uint32_t N = 10000;
+    for (uint32_t d = 0; d < N; ++d) {
+        src->addUrl("u" + std::to_string(d));
+        if (d % 10 != 9) src->addDocument("common", d, 1);
+        if (d == 4321 || d == 9876) src->addDocument("rare", d, 1);
+    }
+    for (auto format : {BinaryFormat::PostingFormat::Blocked, BinaryFormat::PostingFormat::StreamVByte}) {
+        std::string path = create_temp_file();
+        src->dump(path, format);
+        MappedIndexSource mapped(path);
+
+        PostingCursor common = mapped.openCursor("common");
+        PostingCursor rare = mapped.openCursor("rare");
+        EXPECT_EQ(common.size(), 9000u);
+
+        common.skipTo(4321);
+        EXPECT_EQ(common.doc(), 4321u);
+        common.skipTo(4329);
+        EXPECT_EQ(common.doc(), 4330u);
+
+        common = mapped.openCursor("common");
+        auto both = intersect_lists(rare, common);
+        ASSERT_EQ(both.size(), 2u);
+        EXPECT_EQ(both[0].doc_id, 4321u);
+        EXPECT_EQ(both[1].doc_id, 9876u);
+
+        unlink(path.c_str());
+    }
+}
+
+TEST(MappedIndexSourceTests, SearchOverBlockedVersion) {
+    auto src = std::make_shared<RamIndexSource>();
+    auto tok = std::make_shared<Tokenizer>();
+    TFIDFIndexator idx(src, tok);
+
+    idx.addDocument("http://a", "apple banana apple");
+    idx.addDocument("http://b", "banana apple");
+    idx.addDocument("http://c", "cherry cherry");
+
+    std::string path = create_temp_file();
+    src->dump(path, BinaryFormat::PostingFormat::Blocked);
+
+    auto mapped = std::make_shared<MappedIndexSource>(path);
+    EXPECT_EQ(mapped->getPostings("apple").size(), 2u);
+
+    TFIDFSearcher s(mapped, tok);
+    auto res = s.findDocument("apple | cherry");
+    EXPECT_EQ(res.size(), 3u);
+
+    unlink(path.c_str());
+}
+
+TEST(MappedIndexSourceTests, UnknownVersionThrows) {
+    auto src = make_strided_source(10);
+    std::string path = create_temp_file();
+    src->dump(path, 0);
+    set_file_version(path, 42);
+
+    EXPECT_THROW(MappedIndexSource mapped(path), std::runtime_error);
+
+    unlink(path.c_str());
+}
+
+static std::shared_ptr<RamIndexSource> make_url_source(uint32_t num_docs) {
+    auto src = std::make_shared<RamIndexSource>();
+    for (uint32_t d = 0; d < num_docs; ++d) {
+        src->addUrl("http://site/" + std::string(d % 7 + 1, 'p') + std::to_string(d));
+        if (d % 2 == 0) src->addDocument("even", d, 2);
+    }
+    return src;
+}
+
+TEST(MappedIndexSourceTests, UrlsResolvedThroughOffsetTable) {
+    auto src = make_url_source(50);
+    std::string path = create_temp_file();
+    src->dump(path, 0);
+
+    MappedIndexSource mapped(path);
+    ASSERT_EQ(mapped.getTotalDocs(), 50u);
+    for (int d = 0; d < 50; ++d) EXPECT_EQ(mapped.getUrl(d), src->getUrl(d));
+    EXPECT_EQ(mapped.getUrl(50), "");
+    EXPECT_EQ(mapped.getUrl(-1), "");
+    EXPECT_EQ(mapped.getPostings("even").size(), 25u);
+
+    unlink(path.c_str());
+}
+
+TEST(MappedIndexSourceTests, LegacyFileWithoutOffsetTable) {
+    auto src = make_url_source(20);
+    std::string path = create_temp_file();
+    src->dump(path, 0);
+
+    // Cutting the section table and footer leaves a file as it was written before the offsets section
+    struct stat sb;
+    ASSERT_EQ(stat(path.c_str(), &sb), 0);
+    ASSERT_EQ(truncate(path.c_str(), sb.st_size - sizeof(BinaryFormat::SectionEntry) - sizeof(BinaryFormat::Footer)), 0);
+
+    MappedIndexSource mapped(path);
+    ASSERT_EQ(mapped.getTotalDocs(), 20u);
+    for (int d = 0; d < 20; ++d) EXPECT_EQ(mapped.getUrl(d), src->getUrl(d));
+    EXPECT_EQ(mapped.getPostings("even").size(), 10u);
+
+    unlink(path.c_str());
+}
+
+TEST(MappedIndexSourceTests, MovedSourceKeepsMapping) {
+    auto src = make_url_source(10);
+    std::string path = create_temp_file();
+    src->dump(path, BinaryFormat::PostingFormat::Blocked);
+
+    auto moved = std::make_unique<MappedIndexSource>(MappedIndexSource(path));
+    std::string_view url = moved->getUrl(3);
+    EXPECT_EQ(url, src->getUrl(3));
+    EXPECT_EQ(moved->getPostings("even").size(), 5u);
+
+    unlink(path.c_str());
+}
+
+TEST(MappedIndexSourceTests, ResidencyOptionsKeepResultsAndReportCoverage) {
+    auto src = make_strided_source(2000);
+    std::string path = create_temp_file();
+    src->dump(path, BinaryFormat::PostingFormat::StreamVByte);
+
+    LoadOptions options;
+    options.populate = true;
+    options.dictionary_advice = LoadOptions::Advice::Random;
+    options.postings_advice = LoadOptions::Advice::Sequential;
+    options.lock_dictionary = true;
+    options.lock_top_postings = 2;
+    options.huge_pages = true;
+
+    MappedIndexSource plain(path);
+    MappedIndexSource warmed(path, options);
+    for (const char* term : {"three", "five", "missing"}) {
+        auto expected = plain.getPostings(term);
+        auto actual = warmed.getPostings(term);
+        ASSERT_EQ(actual.size(), expected.size()) << term;
+        for (size_t i = 0; i < expected.size(); ++i) EXPECT_EQ(actual[i].doc_id, expected[i].doc_id);
+    }
+
+    ResidencyReport report = warmed.residency();
+    size_t page = sysconf(_SC_PAGESIZE);
+    struct stat sb;
+    ASSERT_EQ(stat(path.c_str(), &sb), 0);
+    EXPECT_EQ(report.total.pages, (sb.st_size + page - 1) / page);
+    EXPECT_EQ(report.total.pages, report.dictionary.pages + report.postings.pages);
+    EXPECT_GT(report.postings.pages, 0u);
+    // Populated mapping of a file that was just written is fully in the page cache
+    EXPECT_EQ(report.total.resident, report.total.pages);
+    // Locks may be refused by RLIMIT_MEMLOCK, but every attempt is accounted for
+    EXPECT_TRUE(report.locked_bytes > 0 || report.lock_failures > 0);
+
+    unlink(path.c_str());
+}
+
+static std::string read_file(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+TEST(MappedIndexSourceTests, ParallelDumpIsDeterministic) {
+    auto src = std::make_shared<RamIndexSource>();
+    for (uint32_t d = 0; d < 3000; ++d) {
+        src->addUrl("http://doc" + std::to_string(d));
+        for (uint32_t t = 1; t < 600; t *= 2) {
+            if (d % t == 0) src->addDocument("w" + std::to_string(t) + "_" + std::to_string(d % 5), d, d % 3 + 1);
+        }
+    }
+
+    for (auto format : {BinaryFormat::PostingFormat::Raw, BinaryFormat::PostingFormat::VarInt,
+                        BinaryFormat::PostingFormat::Blocked, BinaryFormat::PostingFormat::StreamVByte}) {
+        BinaryFormat::DumpOptions options;
+        options.format = format;
+        options.perfect_hash = true;
+        std::string serial_path = create_temp_file();
+        std::string parallel_path = create_temp_file();
+
+        options.threads = 1;
+        BinaryFormat::DumpStats serial = src->dump(serial_path, options);
+        options.threads = 4;
+        BinaryFormat::DumpStats parallel = src->dump(parallel_path, options);
+
+        EXPECT_EQ(serial.bytes, parallel.bytes);
+        EXPECT_EQ(serial.terms, parallel.terms);
+        EXPECT_EQ(read_file(serial_path).size(), serial.bytes);
+        EXPECT_TRUE(read_file(serial_path) == read_file(parallel_path));
+
+        MappedIndexSource mapped(parallel_path);
+        for (uint32_t t = 2; t < 600; t *= 2) {
+            std::string term = "w" + std::to_string(t) + "_0";
+            auto postings = mapped.getPostings(term);
+            auto expected = src->getPostings(term);
+            ASSERT_EQ(postings.size(), expected.size()) << term;
+            for (size_t i = 0; i < postings.size(); ++i) EXPECT_EQ(postings[i].doc_id, expected[i].doc_id);
+        }
+
+        unlink(serial_path.c_str());
+        unlink(parallel_path.c_str());
+    }
+}
+
+static std::shared_ptr<RamIndexSource> make_length_source(uint32_t num_docs) {
+    auto src = std::make_shared<RamIndexSource>();
+    for (uint32_t d = 0; d < num_docs; ++d) {
+        src->addUrl("http://doc" + std::to_string(d), d * d % 100003);
+        if (d % 2 == 0) src->addDocument("even", d, d % 5 + 1);
+    }
+    return src;
+}
+
+TEST(MappedIndexSourceTests, DocLengthsAndStatsRoundTrip) {
+    auto src = make_length_source(1000);
+    std::string path = create_temp_file();
+    src->dump(path, BinaryFormat::PostingFormat::Blocked);
+
+    MappedIndexSource mapped(path);
+    DocLengths lengths = mapped.getDocLengths();
+    ASSERT_EQ(lengths.size, 1000u);
+    for (uint32_t d = 0; d < 1000; ++d) EXPECT_EQ(lengths[d], d * d % 100003);
+    EXPECT_EQ(mapped.getCollectionStats().total_tokens, src->total_tokens);
+    EXPECT_EQ(mapped.getCollectionStats().num_docs, 1000u);
+    EXPECT_EQ(mapped.getCollectionFrequency("even"), src->getCollectionFrequency("even"));
+    EXPECT_EQ(mapped.getCollectionFrequency("odd"), 0u);
+
+    unlink(path.c_str());
+}
+
+TEST(MappedIndexSourceTests, CollectionFrequencySaturates) {
+    auto src = make_length_source(100);
+    src->addDocument("huge", 0, UINT32_MAX - 1);
+    src->addDocument("huge", 1, 5);
+    std::string path = create_temp_file();
+    src->dump(path, BinaryFormat::PostingFormat::VarInt);
+
+    MappedIndexSource mapped(path);
+    EXPECT_EQ(src->getCollectionFrequency("huge"), UINT32_MAX + 4ull);
+    EXPECT_EQ(mapped.getCollectionFrequency("huge"), UINT32_MAX);
+    unlink(path.c_str());
+}
+
+TEST(MappedIndexSourceTests, QuantizedDocLengthsStayClose) {
+    auto src = make_length_source(1000);
+    std::string path = create_temp_file();
+    BinaryFormat::DumpOptions options;
+    options.quantize_doc_lengths = true;
+    src->dump(path, options);
+
+    MappedIndexSource mapped(path);
+    DocLengths lengths = mapped.getDocLengths();
+    ASSERT_EQ(lengths.size, 1000u);
+    EXPECT_EQ(lengths.exact, nullptr);
+    for (uint32_t d = 0; d < 1000; ++d) {
+        uint32_t real = d * d % 100003;
+        EXPECT_LE(lengths[d], real);
+        if (real < 32) {
+            EXPECT_EQ(lengths[d], real);
+        }
+        EXPECT_GE(lengths[d] + real / 16 + 1, real) << real;
+    }
+    // Totals are kept exact
+    EXPECT_EQ(mapped.getCollectionStats().total_tokens, src->total_tokens);
+
+    unlink(path.c_str());
+}
+
+TEST(MappedIndexSourceTests, ShardedDumpMatchesSingleSource) {
+    // The same documents once in one source and once split over shards with local doc ids
+    auto whole = std::make_shared<RamIndexSource>();
+    std::vector<std::shared_ptr<RamIndexSource>> shards;
+    const std::vector<uint32_t> shard_begin = {0, 700, 700, 1900, 3000};
+    for (size_t s = 0; s + 1 < shard_begin.size(); ++s) {
+        auto shard = std::make_shared<RamIndexSource>();
+        for (uint32_t d = shard_begin[s]; d < shard_begin[s + 1]; ++d) {
+            whole->addUrl("http://doc" + std::to_string(d), d % 17 + 1);
+            shard->addUrl("http://doc" + std::to_string(d), d % 17 + 1);
+            for (uint32_t t = 1; t < 600; t *= 2) {
+                if (d % t != 0) continue;
+                std::string term = "w" + std::to_string(t) + "_" + std::to_string(d % 5);
+                whole->addDocument(term, d, d % 3 + 1);
+                shard->addDocument(term, d - shard_begin[s], d % 3 + 1);
+            }
+            // Only in the last shard, and a single posting with tf 1 that the dump drops
+            if (d >= 1900 && d % 7 == 0) {
+                whole->addDocument("late", d, 2);
+                shard->addDocument("late", d - shard_begin[s], 2);
+            }
+        }
+        if (s == 0) {
+            whole->addDocument("once", 0);
+            shard->addDocument("once", 0);
+        }
+        shards.push_back(shard);
+    }
+
+    BinaryFormat::DumpOptions options;
+    options.format = BinaryFormat::PostingFormat::StreamVByte;
+    options.block_max = true;
+    options.front_coded_terms = true;
+    options.bitmap_containers = true;
+    options.impact_ordered = true;
+    std::string whole_path = create_temp_file();
+    std::string sharded_path = create_temp_file();
+    BinaryFormat::DumpStats expected = whole->dump(whole_path, options);
+    BinaryFormat::DumpStats stats = RamIndexSource::dumpShards(shards, sharded_path, options);
+
+    EXPECT_EQ(stats.terms, expected.terms);
+    EXPECT_TRUE(read_file(whole_path) == read_file(sharded_path));
+    MappedIndexSource mapped(sharded_path);
+    EXPECT_EQ(mapped.getTotalDocs(), 3000u);
+    EXPECT_EQ(mapped.getUrl(1900), "http://doc1900");
+    auto postings = mapped.getPostings("late");
+    ASSERT_FALSE(postings.empty());
+    EXPECT_EQ(postings[0].doc_id, 1904u);
+    EXPECT_TRUE(mapped.getPostings("once").empty());
+
+    unlink(whole_path.c_str());
+    unlink(sharded_path.c_str());
+}
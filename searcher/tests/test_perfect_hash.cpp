@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "index.h"
+#include "perfect_hash.h"
+
+TEST(PerfectHashTests, EveryKeyGetsItsOwnSlot) {
+    for (uint32_t n : {1u, 2u, 7u, 1000u, 50000u}) {
+        std::vector<uint64_t> hashes;
+        for (uint32_t i = 0; i < n; ++i) hashes.push_back(PerfectHash::hash("term" + std::to_string(i)));
+
+        PerfectHash::Table table = PerfectHash::build(hashes);
+        EXPECT_EQ(table.header.num_keys, n);
+
+        std::vector<bool> used(n, false);
+        for (uint64_t h : hashes) {
+            uint32_t slot = PerfectHash::slot(h, table.header, table.pilots.data());
+            ASSERT_LT(slot, n);
+            EXPECT_FALSE(used[slot]);
+            used[slot] = true;
+        }
+    }
+}
+
+TEST(PerfectHashTests, EmptyKeySet) {
+    PerfectHash::Table table = PerfectHash::build({});
+    EXPECT_EQ(table.header.num_keys, 0u);
+}
+
+TEST(PerfectHashTests, DuplicateKeysThrow) {
+    uint64_t h = PerfectHash::hash("same");
+    EXPECT_THROW(PerfectHash::build({h, h}), std::runtime_error);
+}
+
+TEST(PerfectHashTests, MappedIndexLooksUpThroughSection) {
+    auto src = std::make_shared<RamIndexSource>();
+    const uint32_t N = 200;
+    for (uint32_t d = 0; d < N; ++d) {
+        src->addUrl("u" + std::to_string(d));
+        for (uint32_t t = 0; t < 50; ++t) {
+            if (d % (t + 2) == 0) src->addDocument("term" + std::to_string(t), d, 1);
+        }
+    }
+
+    for (auto format : {BinaryFormat::PostingFormat::Raw, BinaryFormat::PostingFormat::StreamVByte}) {
+        std::string path = "/tmp/web_spider_mph_" + std::to_string(getpid()) + ".idx";
+        BinaryFormat::DumpOptions options;
+        options.format = format;
+        options.perfect_hash = true;
+        src->dump(path, options);
+
+        MappedIndexSource mapped(path);
+        EXPECT_TRUE(mapped.hasPerfectHash());
+        for (uint32_t t = 0; t < 50; ++t) {
+            auto postings = mapped.getPostings("term" + std::to_string(t));
+            EXPECT_EQ(postings.size(), (N + t + 1) / (t + 2)) << t;
+        }
+        EXPECT_TRUE(mapped.getPostings("term50").empty());
+        EXPECT_TRUE(mapped.getPostings("").empty());
+
+        unlink(path.c_str());
+    }
+}
+
+TEST(PerfectHashTests, IndexWithoutSectionFallsBackToDirectorySearch) {
+    auto src = std::make_shared<RamIndexSource>();
+    src->addUrl("a");
+    src->addUrl("b");
+    src->addUrl("c");
+    src->addDocument("x", 0, 2);
+
+    std::string path = "/tmp/web_spider_nomph_" + std::to_string(getpid()) + ".idx";
+    src->dump(path, false);
+    MappedIndexSource mapped(path);
+    EXPECT_FALSE(mapped.hasPerfectHash());
+    EXPECT_EQ(mapped.getPostings("x").size(), 1u);
+
+    unlink(path.c_str());
+}
@@ -0,0 +1,150 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include "index.h"
+#include "posting_cache.h"
+
+static PostingCache::List make_list(uint32_t size) {
+    auto list = std::make_shared<std::vector<TermInfo>>();
+    for (uint32_t i = 0; i < size; ++i) list->push_back({i, 1});
+    return list;
+}
+
+TEST(FrequencySketchTest, CountsAndAges) {
+    FrequencySketch sketch(64);
+    for (int i = 0; i < 5; ++i) sketch.record(7);
+    sketch.record(8);
+    EXPECT_GE(sketch.estimate(7), 5u);
+    EXPECT_GE(sketch.estimate(8), 1u);
+    EXPECT_LT(sketch.estimate(8), sketch.estimate(7));
+
+    // Many other keys push it past the sample size, which halves every counter
+    for (uint32_t i = 0; i < 640; ++i) sketch.record(1000 + i % 50);
+    EXPECT_LE(sketch.estimate(7), 3u);
+}
+
+TEST(PostingCacheTest, AdmitsOnlyRepeatedTerms) {
+    PostingCache cache(1 << 20, 16);
+    EXPECT_FALSE(cache.find(1));
+    EXPECT_FALSE(cache.shouldAdmit(1, 100 * sizeof(TermInfo)));
+    EXPECT_FALSE(cache.find(1));
+    ASSERT_TRUE(cache.shouldAdmit(1, 100 * sizeof(TermInfo)));
+    cache.insert(1, make_list(100));
+
+    auto list = cache.find(1);
+    ASSERT_TRUE(list);
+    EXPECT_EQ(list->size(), 100u);
+    auto stats = cache.stats();
+    EXPECT_EQ(stats.hits, 1u);
+    EXPECT_EQ(stats.admitted, 1u);
+    EXPECT_EQ(stats.bytes, 100 * sizeof(TermInfo));
+}
+
+TEST(PostingCacheTest, HugeColdListCannotFlushHotOnes) {
+    PostingCache cache(100 * sizeof(TermInfo), 16);
+    for (uint32_t term = 0; term < 4; ++term) {
+        for (int i = 0; i < 5; ++i) cache.find(term);
+        ASSERT_TRUE(cache.shouldAdmit(term, 25 * sizeof(TermInfo)));
+        cache.insert(term, make_list(25));
+    }
+
+    // Seen twice, but every hot list it would push out is more popular
+    cache.find(9);
+    cache.find(9);
+    EXPECT_FALSE(cache.shouldAdmit(9, 100 * sizeof(TermInfo)));
+    EXPECT_FALSE(cache.shouldAdmit(9, 101 * sizeof(TermInfo)));
+    for (uint32_t term = 0; term < 4; ++term) EXPECT_TRUE(cache.find(term));
+
+    // Once it is the most popular one it evicts the least recently used lists
+    for (int i = 0; i < 10; ++i) cache.find(9);
+    ASSERT_TRUE(cache.shouldAdmit(9, 50 * sizeof(TermInfo)));
+    cache.insert(9, make_list(50));
+    EXPECT_FALSE(cache.find(0));
+    EXPECT_FALSE(cache.find(1));
+    EXPECT_TRUE(cache.find(9));
+    EXPECT_EQ(cache.stats().bytes, 100 * sizeof(TermInfo));
+}
+
+TEST(PostingCacheTest, EvictedListStaysValidForReaders) {
+    PostingCache cache(10 * sizeof(TermInfo), 16);
+    cache.find(1);
+    cache.find(1);
+    cache.insert(1, make_list(10));
+    auto held = cache.find(1);
+    for (int i = 0; i < 5; ++i) cache.find(2);
+    cache.insert(2, make_list(10));
+    EXPECT_FALSE(cache.find(1));
+    ASSERT_EQ(held->size(), 10u);
+    EXPECT_EQ(held->back().doc_id, 9u);
+}
+
+class MappedPostingCacheTest : public ::testing::TestWithParam<BinaryFormat::PostingFormat> {
+protected:
+    std::string path = "/tmp/web_spider_postings_" + std::to_string(getpid()) + ".idx";
+
+    void SetUp() override {
+        RamIndexSource src;
+        for (uint32_t d = 0; d < 1000; ++d) {
+            src.addUrl("http://doc/" + std::to_string(d));
+            if (d % 2 == 0) src.addDocument("common", d, d % 7 + 1);
+            if (d % 9 == 0) src.addDocument("rare", d, 2);
+        }
+        src.dump(path, GetParam());
+    }
+    void TearDown() override { unlink(path.c_str()); }
+};
+
+TEST_P(MappedPostingCacheTest, CachedCursorsMatchDecodedOnes) {
+    MappedIndexSource plain(path);
+    LoadOptions options;
+    options.posting_cache_bytes = 1 << 20;
+    MappedIndexSource cached(path, options);
+
+    for (int round = 0; round < 3; ++round) {
+        for (const std::string term : {"common", "rare", "missing"}) {
+            PostingCursor a = plain.openCursor(term);
+            PostingCursor b = cached.openCursor(term);
+            ASSERT_EQ(a.size(), b.size());
+            for (; a.valid(); a.next(), b.next()) {
+                ASSERT_TRUE(b.valid());
+                EXPECT_EQ(a.doc(), b.doc());
+                EXPECT_EQ(a.tf(), b.tf());
+            }
+            EXPECT_FALSE(b.valid());
+
+            PostingCursor c = cached.openCursor(term);
+            c.skipTo(500);
+            if (term != "missing") {
+                EXPECT_EQ(c.doc(), term == "common" ? 500u : 504u);
+            }
+        }
+    }
+
+    auto stats = cached.postingCacheStats();
+    if (GetParam() == BinaryFormat::PostingFormat::Raw) {
+        EXPECT_EQ(stats.admitted, 0u);
+    } else {
+        EXPECT_EQ(stats.admitted, 2u);
+        EXPECT_GT(stats.hits, 0u);
+        EXPECT_EQ(stats.bytes, (500 + 112) * sizeof(TermInfo));
+    }
+}
+
+TEST_P(MappedPostingCacheTest, CursorOutlivesReload) {
+    LoadOptions options;
+    options.posting_cache_bytes = 1 << 20;
+    MappedIndexSource cached(path, options);
+    cached.openCursor("common");
+    PostingCursor cursor = cached.openCursor("common");
+    cached.load(path, options);
+    EXPECT_EQ(cached.postingCacheStats().bytes, 0u);
+
+    if (GetParam() == BinaryFormat::PostingFormat::Raw) return;  // Raw cursors point into the mapping itself
+    uint32_t seen = 0;
+    for (; cursor.valid(); cursor.next()) ++seen;
+    EXPECT_EQ(seen, 500u);
+}
+
+INSTANTIATE_TEST_SUITE_P(Formats, MappedPostingCacheTest,
+                         ::testing::Values(BinaryFormat::PostingFormat::Raw, BinaryFormat::PostingFormat::VarInt,
+                                           BinaryFormat::PostingFormat::Blocked, BinaryFormat::PostingFormat::StreamVByte));
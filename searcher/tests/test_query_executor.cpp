@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <random>
+#include <thread>
+
+#include "query_executor.h"
+#include "searcher.h"
+
+TEST(ReentrantTokenizerTest, MatchesStatefulTokenizer) {
+    Tokenizer tokenizer(std::make_unique<PorterStemmer>());
+    const std::string text = "Running runners ran quickly, 3.14 isn't 42abc";
+    tokenizer.tokenize(text);
+
+    std::vector<std::string> out = {"kept"};
+    size_t length = tokenizer.tokenize(text, out);
+    ASSERT_EQ(out.size(), tokenizer.tokensAmount() + 1);
+    EXPECT_EQ(out[0], "kept");
+    EXPECT_EQ(std::vector<std::string>(out.begin() + 1, out.end()), tokenizer.getTokens());
+    EXPECT_DOUBLE_EQ((double)length / tokenizer.tokensAmount(), tokenizer.avgTokenLen());
+}
+
+TEST(ReentrantTokenizerTest, SharedTokenizerAcrossThreads) {
+    Tokenizer tokenizer(std::make_unique<PorterStemmer>());
+    const std::vector<std::string> texts = {"connections connected connecting", "generalizations relational",
+                                            "hopping hoping happily", "electrical electricity"};
+    std::vector<std::vector<std::string>> expected(texts.size());
+    for (size_t i = 0; i < texts.size(); ++i) tokenizer.tokenize(texts[i], expected[i]);
+
+    std::vector<std::thread> threads;
+    std::vector<int> mismatches(8, 0);
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&, t] {
+            for (int round = 0; round < 2000; ++round) {
+                size_t i = (round + t) % texts.size();
+                std::vector<std::string> out;
+                tokenizer.tokenize(texts[i], out);
+                if (out != expected[i]) ++mismatches[t];
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    for (int m : mismatches) EXPECT_EQ(m, 0);
+}
+
+class ConcurrentSearchTest : public ::testing::Test {
+protected:
+    std::string path = "/tmp/web_spider_concurrent_" + std::to_string(getpid()) + ".idx";
+    std::shared_ptr<TFIDFSearcher> searcher;
+    const std::vector<std::string> queries = {"apple",          "apple banana", "apple | lemon", "banana & !mango",
+                                              "lemon | mango",  "app*",         "(apple | banana) & lemon"};
+
+    void SetUp() override {
+        RamIndexSource src;
+        std::mt19937 rng(7);
+        const std::vector<std::string> words = {"apple", "banana", "lemon", "mango", "apricot"};
+        for (uint32_t d = 0; d < 2000; ++d) {
+            src.addUrl("http://doc/" + std::to_string(d));
+            for (size_t w = 0; w < words.size(); ++w) {
+                if (rng() % (2 + w) == 0) src.addDocument(words[w], d, 1 + rng() % 4);
+            }
+        }
+        BinaryFormat::DumpOptions options;
+        options.format = BinaryFormat::PostingFormat::StreamVByte;
+        options.block_max = true;
+        options.front_coded_terms = true;
+        src.dump(path, options);
+        LoadOptions load_options;
+        load_options.posting_cache_bytes = 1 << 20;
+        auto mapped = std::make_shared<MappedIndexSource>(path, load_options);
+        searcher = std::make_shared<TFIDFSearcher>(mapped, std::make_shared<Tokenizer>(std::make_unique<PorterStemmer>()));
+    }
+    void TearDown() override { unlink(path.c_str()); }
+};
+
+static bool same_hits(const std::vector<SearchHit>& a, const std::vector<SearchHit>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].doc_id != b[i].doc_id || a[i].score != b[i].score) return false;
+    }
+    return true;
+}
+
+TEST_F(ConcurrentSearchTest, ConstSearcherServesManyThreads) {
+    const TFIDFSearcher& shared = *searcher;
+    std::vector<std::vector<SearchHit>> expected;
+    for (const auto& query : queries) expected.push_back(shared.findDocument(query, 20));
+
+    std::vector<std::thread> threads;
+    std::vector<int> mismatches(8, 0);
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&, t] {
+            for (int round = 0; round < 300; ++round) {
+                size_t q = (round * 3 + t) % queries.size();
+                if (!same_hits(shared.findDocument(queries[q], 20), expected[q])) ++mismatches[t];
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    for (int m : mismatches) EXPECT_EQ(m, 0);
+}
+
+TEST_F(ConcurrentSearchTest, ExecutorAnswersLikeTheSearcher) {
+    searcher->setResultCacheCapacity(0);
+    QueryExecutor executor(searcher, 4);
+    EXPECT_EQ(executor.threads(), 4u);
+
+    std::vector<std::future<std::vector<SearchHit>>> pending;
+    for (int round = 0; round < 50; ++round) {
+        for (const auto& query : queries) pending.push_back(executor.submit(query, 10, round % 3));
+    }
+    for (size_t i = 0; i < pending.size(); ++i) {
+        const auto& query = queries[i % queries.size()];
+        size_t offset = (i / queries.size()) % 3;
+        EXPECT_TRUE(same_hits(pending[i].get(), searcher->findDocument(query, 10, offset))) << query;
+    }
+}
+
+TEST_F(ConcurrentSearchTest, ExecutorDrainsQueueOnDestruction) {
+    std::vector<std::future<std::vector<SearchHit>>> pending;
+    {
+        QueryExecutor executor(searcher, 2);
+        for (int i = 0; i < 100; ++i) pending.push_back(executor.submit(queries[i % queries.size()], 5));
+    }
+    for (auto& result : pending) EXPECT_LE(result.get().size(), 5u);
+}
@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+
+#include "query_plan.h"
+#include "searcher.h"
+
+static RamIndexSource make_source() {
+    // the: every doc, football: multiples of 3, messi: multiples of 30
+    RamIndexSource src;
+    for (uint32_t d = 0; d < 300; ++d) {
+        src.addUrl("http://doc/" + std::to_string(d));
+        src.addDocument("the", d);
+        if (d % 3 == 0) src.addDocument("football", d);
+        if (d % 30 == 0) src.addDocument("messi", d);
+    }
+    return src;
+}
+
+static std::vector<uint32_t> ids(const std::vector<TermInfo>& v) {
+    std::vector<uint32_t> res;
+    for (const auto& t : v) res.push_back(t.doc_id);
+    return res;
+}
+
+TEST(QueryPlanTest, AndChainRunsRarestFirst) {
+    RamIndexSource src = make_source();
+    QueryPlan plan(300);
+    for (const char* term : {"the", "football"}) plan.pushTerm(term, src.openCursor(term));
+    plan.applyAnd();
+    plan.pushTerm("messi", src.openCursor("messi"));
+    plan.applyAnd();
+
+    EXPECT_EQ(plan.describe(), "&(messi,football,the)");
+    auto result = ids(plan.execute());
+    ASSERT_EQ(result.size(), 10u);
+    for (uint32_t d : result) EXPECT_EQ(d % 30, 0u);
+}
+
+TEST(QueryPlanTest, DuplicatesAreMerged) {
+    RamIndexSource src = make_source();
+    // (football | messi) & the & (messi | football) & football
+    QueryPlan plan(300);
+    plan.pushTerm("football", src.openCursor("football"));
+    plan.pushTerm("messi", src.openCursor("messi"));
+    plan.applyOr();
+    plan.pushTerm("the", src.openCursor("the"));
+    plan.applyAnd();
+    plan.pushTerm("messi", src.openCursor("messi"));
+    plan.pushTerm("football", src.openCursor("football"));
+    plan.applyOr();
+    plan.applyAnd();
+    plan.pushTerm("football", src.openCursor("football"));
+    plan.applyAnd();
+
+    EXPECT_EQ(plan.describe(), "&(football,|(messi,football),the)");
+    EXPECT_EQ(plan.execute().size(), 100u);
+}
+
+TEST(QueryPlanTest, EmptyOperandShortCircuits) {
+    RamIndexSource src = make_source();
+    QueryPlan plan(300);
+    plan.pushTerm("the", src.openCursor("the"));
+    plan.pushTerm("missing", src.openCursor("missing"));
+    plan.applyAnd();
+    EXPECT_EQ(plan.describe(), "&(missing,the)");
+    EXPECT_TRUE(plan.execute().empty());
+}
+
+TEST(QueryPlanTest, NegatedUnionDoesNotShortCircuit) {
+    // c: every doc, a and b: docs 0-5, so a | b is an overestimate and !(a | b) is not empty
+    RamIndexSource src;
+    for (uint32_t d = 0; d < 10; ++d) {
+        src.addUrl("http://doc/" + std::to_string(d));
+        if (d < 6) src.addDocument("a", d);
+        if (d < 6) src.addDocument("b", d);
+        src.addDocument("c", d);
+    }
+    QueryPlan plan(10);
+    plan.pushTerm("c", src.openCursor("c"));
+    plan.pushTerm("a", src.openCursor("a"));
+    plan.pushTerm("b", src.openCursor("b"));
+    plan.applyOr();
+    plan.applyNot();
+    plan.applyAnd();
+    EXPECT_EQ(ids(plan.execute()), std::vector<uint32_t>({6, 7, 8, 9}));
+}
+
+TEST(QueryPlanTest, SearcherResultsMatchSetSemantics) {
+    auto src = std::make_shared<RamIndexSource>(make_source());
+    auto tok = std::make_shared<Tokenizer>();
+    BinarySearcher searcher(src, tok);
+
+    auto count = [&](const std::string& q) { return searcher.findDocument(q, 1000).size(); };
+    EXPECT_EQ(count("the football messi"), 10u);
+    EXPECT_EQ(count("messi | football"), 100u);
+    EXPECT_EQ(count("football !messi"), 90u);
+    EXPECT_EQ(count("(football | messi) & (messi | football) & the"), 100u);
+    EXPECT_EQ(count("!(football | messi)"), 200u);
+    EXPECT_EQ(count("the !football !messi"), 200u);
+    EXPECT_EQ(count("!football !messi"), 200u);
+    EXPECT_EQ(count("the football !messi"), 90u);
+}
+
+TEST(QueryPlanTest, NegatedRootOnlyGeneratesThePage) {
+    RamIndexSource src = make_source();
+    QueryPlan plan(300);
+    plan.pushTerm("football", src.openCursor("football"));
+    plan.applyNot();
+    EXPECT_TRUE(plan.unscored());
+    auto page = ids(plan.execute(3));
+    EXPECT_EQ(page, std::vector<uint32_t>({1, 2, 4}));
+}
+
+TEST(QueryPlanTest, NegatedPageMatchesFullRankingForTFIDF) {
+    auto src = std::make_shared<RamIndexSource>(make_source());
+    auto tok = std::make_shared<Tokenizer>();
+    TFIDFSearcher searcher(src, tok);
+    for (const char* q : {"!football", "!(football | messi)", "!(football & messi)"}) {
+        auto full = searcher.findDocument(q, 1000);
+        auto page = searcher.findDocument(q, 5, 10);
+        ASSERT_EQ(page.size(), 5u) << q;
+        for (size_t i = 0; i < page.size(); ++i) {
+            EXPECT_EQ(page[i].doc_id, full[10 + i].doc_id) << q;
+            EXPECT_DOUBLE_EQ(page[i].score, full[10 + i].score) << q;
+        }
+    }
+}
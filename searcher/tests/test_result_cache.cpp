@@ -0,0 +1,148 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <thread>
+
+#include "lru_cache.h"
+#include "query_plan.h"
+#include "searcher.h"
+
+TEST(ShardedLruCacheTest, EvictsLeastRecentlyUsed) {
+    ShardedLruCache<int> cache(2, 1);
+    cache.put("a", 1, 1);
+    cache.put("b", 1, 2);
+    EXPECT_EQ(cache.get("a", 1), 1);  // a is now the most recent
+    cache.put("c", 1, 3);
+    EXPECT_FALSE(cache.get("b", 1));
+    EXPECT_EQ(cache.get("a", 1), 1);
+    EXPECT_EQ(cache.get("c", 1), 3);
+    EXPECT_EQ(cache.stats().evictions, 1u);
+    EXPECT_EQ(cache.stats().hits, 3u);
+    EXPECT_EQ(cache.stats().misses, 1u);
+}
+
+TEST(ShardedLruCacheTest, NewerGenerationDropsEntries) {
+    ShardedLruCache<int> cache(16, 4);
+    cache.put("a", 1, 1);
+    EXPECT_TRUE(cache.get("a", 1));
+    EXPECT_FALSE(cache.get("a", 2));
+    // A result computed from the old data must not come back
+    cache.put("a", 1, 1);
+    EXPECT_FALSE(cache.get("a", 2));
+}
+
+TEST(ShardedLruCacheTest, ConcurrentAccessStaysBounded) {
+    ShardedLruCache<int> cache(64, 8);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 5000; ++i) {
+                std::string key = std::to_string((i * 7 + t) % 200);
+                if (!cache.get(key, 1)) cache.put(key, 1, i);
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    auto stats = cache.stats();
+    EXPECT_EQ(stats.hits + stats.misses, 20000u);
+    EXPECT_GT(stats.evictions, 0u);
+}
+
+TEST(CanonicalQueryTest, CommutativeOperandsAreSorted) {
+    using V = std::vector<std::string>;
+    EXPECT_EQ(QueryPlan::canonicalQuery(V{"b", "a", "&"}), QueryPlan::canonicalQuery(V{"a", "b", "&"}));
+    EXPECT_EQ(QueryPlan::canonicalQuery(V{"a", "b", "&", "a", "&"}), "&(a,b)");
+    EXPECT_EQ(QueryPlan::canonicalQuery(V{"c", "b", "a", "|", "&"}), "&(c,|(a,b))");
+    EXPECT_EQ(QueryPlan::canonicalQuery(V{"a", "!", "b", "&"}), "&(!(a),b)");
+    EXPECT_NE(QueryPlan::canonicalQuery(V{"a", "b", "&"}), QueryPlan::canonicalQuery(V{"a", "b", "|"}));
+}
+
+static std::shared_ptr<RamIndexSource> make_source() {
+    auto src = std::make_shared<RamIndexSource>();
+    for (uint32_t d = 0; d < 100; ++d) {
+        src->addUrl("http://doc/" + std::to_string(d));
+        if (d % 2 == 0) src->addDocument("apple", d, d % 5 + 1);
+        if (d % 3 == 0) src->addDocument("banana", d, d % 4 + 1);
+    }
+    return src;
+}
+
+TEST(ResultCacheTest, EquivalentQueriesHitTheCache) {
+    auto src = make_source();
+    TFIDFSearcher searcher(src, std::make_shared<Tokenizer>());
+    searcher.setResultCacheCapacity(64);
+
+    auto first = searcher.findDocument("apple banana", 10);
+    auto second = searcher.findDocument("banana & apple", 10);
+    auto page = searcher.findDocument("banana apple", 5, 5);
+    EXPECT_EQ(searcher.resultCacheStats().misses, 1u);
+    EXPECT_EQ(searcher.resultCacheStats().hits, 2u);
+    ASSERT_EQ(first.size(), second.size());
+    for (size_t i = 0; i < first.size(); ++i) EXPECT_EQ(first[i].doc_id, second[i].doc_id);
+    ASSERT_EQ(page.size(), 5u);
+    EXPECT_EQ(page[0].doc_id, first[5].doc_id);
+
+    // A deeper page than what is cached is recomputed
+    searcher.findDocument("apple banana", 10, 10);
+    EXPECT_EQ(searcher.resultCacheStats().misses, 2u);
+}
+
+TEST(ResultCacheTest, RepeatedTermsAreNotServedTheDedupedPage) {
+    auto src = make_source();
+    TFIDFSearcher cached(src, std::make_shared<Tokenizer>());
+    cached.setResultCacheCapacity(64);
+    TFIDFSearcher uncached(src, std::make_shared<Tokenizer>());
+    EXPECT_EQ(uncached.resultCacheStats().misses, 0u);
+
+    cached.findDocument("apple banana", 10);
+    for (const char* q : {"apple banana apple", "apple apple banana"}) {
+        auto expected = uncached.findDocument(q, 10);
+        auto page = cached.findDocument(q, 10);
+        ASSERT_EQ(page.size(), expected.size()) << q;
+        for (size_t i = 0; i < page.size(); ++i) {
+            EXPECT_EQ(page[i].doc_id, expected[i].doc_id) << q;
+            EXPECT_DOUBLE_EQ(page[i].score, expected[i].score) << q;
+        }
+    }
+    // The second spelling of the repeated query is the only hit
+    EXPECT_EQ(cached.resultCacheStats().misses, 2u);
+    EXPECT_EQ(cached.resultCacheStats().hits, 1u);
+}
+
+TEST(ResultCacheTest, SourceChangesInvalidate) {
+    auto src = make_source();
+    BinarySearcher searcher(src, std::make_shared<Tokenizer>());
+    searcher.setResultCacheCapacity(64);
+    EXPECT_EQ(searcher.findDocument("apple", 1000).size(), 50u);
+
+    src->addUrl("http://doc/100");
+    src->addDocument("apple", 100);
+    EXPECT_EQ(searcher.findDocument("apple", 1000).size(), 51u);
+    EXPECT_EQ(searcher.resultCacheStats().hits, 0u);
+
+    searcher.setResultCacheCapacity(0);
+    searcher.findDocument("apple", 1000);
+    EXPECT_EQ(searcher.resultCacheStats().misses, 0u);
+}
+
+TEST(ResultCacheTest, ReloadedIndexInvalidates) {
+    std::string path = "/tmp/web_spider_cache_" + std::to_string(getpid()) + ".idx";
+    auto src = make_source();
+    src->dump(path, BinaryFormat::PostingFormat::VarInt);
+    auto mapped = std::make_shared<MappedIndexSource>(path);
+    BinarySearcher searcher(mapped, std::make_shared<Tokenizer>());
+    searcher.setResultCacheCapacity(64);
+    EXPECT_EQ(searcher.findDocument("apple", 1000).size(), 50u);
+
+    for (uint32_t d = 100; d < 110; ++d) {
+        src->addUrl("http://doc/" + std::to_string(d));
+        src->addDocument("apple", d);
+    }
+    src->dump(path, BinaryFormat::PostingFormat::VarInt);
+    uint64_t generation = mapped->generation();
+    mapped->load(path);
+    EXPECT_GT(mapped->generation(), generation);
+    EXPECT_EQ(searcher.findDocument("apple", 1000).size(), 60u);
+    EXPECT_EQ(searcher.resultCacheStats().hits, 0u);
+    unlink(path.c_str());
+}
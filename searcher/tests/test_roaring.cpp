@@ -0,0 +1,167 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+
+#include "roaring.h"
+#include "searcher.h"
+#include "stream_vbyte.h"
+
+// Mixes sparse chunks (array containers) with dense ones (bitmaps)
+static std::vector<uint32_t> random_docs(std::mt19937& rng, uint32_t universe) {
+    std::vector<uint32_t> docs;
+    for (uint32_t d = 0; d < universe; ++d) {
+        uint32_t chunk = d >> 16;
+        uint32_t density = chunk % 3 == 0 ? 2 : (chunk % 3 == 1 ? 100 : 5000);
+        if (rng() % density == 0) docs.push_back(d);
+    }
+    return docs;
+}
+
+static std::string encode(const std::vector<uint32_t>& docs, const std::vector<uint32_t>& tfs = {}) {
+    std::string out;
+    Roaring::append(docs, tfs, out);
+    out.append(StreamVByte::PADDING, '\0');
+    return out;
+}
+
+static std::vector<uint32_t> decode(const Roaring::Set& set) {
+    std::vector<uint32_t> docs(set.size());
+    if (!docs.empty()) set.decodeDocs(0, set.size(), docs.data());
+    return docs;
+}
+
+TEST(RoaringTest, RoundTripWithTfs) {
+    std::mt19937 rng(1);
+    auto docs = random_docs(rng, 400000);
+    std::vector<uint32_t> tfs(docs.size());
+    for (auto& tf : tfs) tf = rng() % 1000 + 1;
+
+    std::string bytes = encode(docs, tfs);
+    Roaring::Set set(bytes.data());
+    ASSERT_EQ(set.size(), docs.size());
+    EXPECT_EQ(decode(set), docs);
+
+    // Windows start anywhere, tf blocks at multiples of TF_BLOCK_SIZE
+    for (uint32_t from : {0u, 1u, 4095u, 4096u, (uint32_t)docs.size() - 7}) {
+        uint32_t n = std::min<uint32_t>(300, (uint32_t)docs.size() - from);
+        std::vector<uint32_t> window(n);
+        set.decodeDocs(from, n, window.data());
+        EXPECT_TRUE(std::equal(window.begin(), window.end(), docs.begin() + from)) << from;
+    }
+    std::vector<uint32_t> block(Roaring::TF_BLOCK_SIZE);
+    set.decodeTfs(3, Roaring::TF_BLOCK_SIZE, block.data());
+    EXPECT_TRUE(std::equal(block.begin(), block.end(), tfs.begin() + 3 * Roaring::TF_BLOCK_SIZE));
+}
+
+TEST(RoaringTest, StreamWriterMatchesAppend) {
+    std::mt19937 rng(4);
+    auto docs = random_docs(rng, 400000);
+    std::vector<uint32_t> tfs(docs.size());
+    for (auto& tf : tfs) tf = rng() % 300 + 1;
+    std::string want;
+    Roaring::append(docs, tfs, want);
+
+    // Batches that do not line up with tf blocks or containers
+    Roaring::StreamWriter writer([&](const auto& visit) {
+        for (size_t begin = 0; begin < docs.size(); begin += 100) {
+            visit(docs.data() + begin, tfs.data() + begin, (uint32_t)std::min<size_t>(100, docs.size() - begin));
+        }
+    });
+    std::ostringstream out;
+    writer.write(out);
+    EXPECT_EQ(writer.size(), want.size());
+    EXPECT_TRUE(out.str() == want);
+}
+
+TEST(RoaringTest, RankAndContains) {
+    std::mt19937 rng(2);
+    auto docs = random_docs(rng, 300000);
+    std::string bytes = encode(docs);
+    Roaring::Set set(bytes.data());
+    for (uint32_t probe = 0; probe < 300000; probe += 37) {
+        uint32_t want = (uint32_t)(std::lower_bound(docs.begin(), docs.end(), probe) - docs.begin());
+        ASSERT_EQ(set.rank(probe), want) << probe;
+        ASSERT_EQ(set.contains(probe), std::binary_search(docs.begin(), docs.end(), probe)) << probe;
+    }
+    EXPECT_EQ(set.rank(1u << 30), docs.size());
+}
+
+TEST(RoaringTest, SetOperationsMatchStd) {
+    std::mt19937 rng(3);
+    auto a = random_docs(rng, 400000);
+    auto b = random_docs(rng, 400000);
+    std::string ab = encode(a), bb = encode(b);
+    Roaring::Set sa(ab.data()), sb(bb.data());
+
+    std::vector<uint32_t> want;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(want));
+    std::string r = Roaring::intersect(sa, sb);
+    EXPECT_EQ(decode(Roaring::Set(r.data())), want);
+
+    want.clear();
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(want));
+    r = Roaring::unite(sa, sb);
+    EXPECT_EQ(decode(Roaring::Set(r.data())), want);
+
+    want.clear();
+    std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(want));
+    r = Roaring::subtract(sa, sb);
+    EXPECT_EQ(decode(Roaring::Set(r.data())), want);
+}
+
+TEST(RoaringTest, DenseTermsDumpAsBitmaps) {
+    const uint32_t num_docs = 131072;
+    auto ram = std::make_shared<RamIndexSource>();
+    RamIndexSource& src = *ram;
+    for (uint32_t d = 0; d < num_docs; ++d) {
+        src.addUrl("u");
+        if (d % 2 == 0) src.addDocument("half", d, d % 5 + 1);
+        if (d % 3 == 0) src.addDocument("third", d, 2);
+        if (d % 500 == 0) src.addDocument("rare", d);
+    }
+    std::string path = "/tmp/web_spider_roaring_" + std::to_string(getpid()) + ".idx";
+    for (auto format : {BinaryFormat::PostingFormat::Raw, BinaryFormat::PostingFormat::VarInt,
+                        BinaryFormat::PostingFormat::StreamVByte}) {
+        BinaryFormat::DumpOptions options;
+        options.format = format;
+        uint64_t plain_size = src.dump(path, options).bytes;
+        options.bitmap_containers = true;
+        uint64_t bitmap_size = src.dump(path, options).bytes;
+        EXPECT_LT(bitmap_size, plain_size) << (int)format;
+
+        auto mapped = std::make_shared<MappedIndexSource>(path);
+        for (const char* term : {"half", "third", "rare"}) {
+            auto want = src.getPostings(term);
+            auto got = mapped->getPostings(term);
+            ASSERT_EQ(got.size(), want.size()) << term;
+            for (size_t i = 0; i < got.size(); ++i) {
+                ASSERT_EQ(got[i].doc_id, want[i].doc_id);
+                ASSERT_EQ(got[i].tf, want[i].tf);
+            }
+            PostingCursor cursor = mapped->openCursor(term);
+            for (uint32_t target : {7u, 6001u, 6002u, 70001u, 131071u}) {
+                cursor.skipTo(target);
+                auto it = std::lower_bound(want.begin(), want.end(), target,
+                                           [](const TermInfo& t, uint32_t v) { return t.doc_id < v; });
+                EXPECT_EQ(cursor.doc(), it == want.end() ? PostingCursor::END : it->doc_id) << term << " " << target;
+            }
+        }
+        EXPECT_TRUE(mapped->openCursor("half").roaring());
+        EXPECT_FALSE(mapped->openCursor("rare").roaring());
+
+        // Word-wise plan results agree with the list path
+        auto tok = std::make_shared<Tokenizer>();
+        BinarySearcher on_disk(mapped, tok);
+        BinarySearcher in_ram(ram, tok);
+        for (const char* q : {"half third", "half | third", "half !third", "third !half rare", "(half | third) !rare"}) {
+            auto a = on_disk.findDocument(q, num_docs);
+            auto b = in_ram.findDocument(q, num_docs);
+            ASSERT_EQ(a.size(), b.size()) << q;
+            for (size_t i = 0; i < a.size(); ++i) ASSERT_EQ(a[i].doc_id, b[i].doc_id) << q;
+        }
+    }
+    unlink(path.c_str());
+}
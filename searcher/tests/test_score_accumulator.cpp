@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "score_accumulator.h"
+#include "searcher.h"
+
+TEST(ScoreAccumulatorTest, ResetForgetsPreviousQuery) {
+    ScoreAccumulator scores;
+    scores.reset(10);
+    scores.track(3);
+    scores.add(3, 1.5);
+    scores.add(3, 2.0);
+    EXPECT_TRUE(scores.tracked(3));
+    EXPECT_FALSE(scores.tracked(4));
+    EXPECT_DOUBLE_EQ(scores.score(3), 3.5);
+
+    scores.reset(10);
+    EXPECT_FALSE(scores.tracked(3));
+    scores.track(3);
+    EXPECT_DOUBLE_EQ(scores.score(3), 0.0);
+}
+
+TEST(ScoreAccumulatorTest, GrowsOnlyWithCollection) {
+    ScoreAccumulator scores;
+    scores.reset(100);
+    scores.reset(10);
+    EXPECT_EQ(scores.capacity(), 100u);
+    scores.reset(1000);
+    EXPECT_EQ(scores.capacity(), 1000u);
+    EXPECT_FALSE(scores.tracked(999));
+}
+
+TEST(ScoreAccumulatorTest, EveryThreadHasItsOwn) {
+    ScoreAccumulator* main_thread = &ScoreAccumulator::local();
+    ScoreAccumulator* other = nullptr;
+    std::thread([&] { other = &ScoreAccumulator::local(); }).join();
+    EXPECT_NE(main_thread, other);
+    EXPECT_EQ(main_thread, &ScoreAccumulator::local());
+}
+
+TEST(ScoreAccumulatorTest, RepeatedRankingIsStable) {
+    auto src = std::make_shared<RamIndexSource>();
+    for (uint32_t d = 0; d < 200; ++d) {
+        src->addUrl("http://doc/" + std::to_string(d));
+        if (d % 2 == 0) src->addDocument("apple", d, d % 5 + 1);
+        if (d % 3 == 0) src->addDocument("banana", d, d % 4 + 1);
+    }
+    TFIDFSearcher searcher(src, std::make_shared<Tokenizer>());
+    searcher.setResultCacheCapacity(0);
+
+    auto first = searcher.findDocument("apple | banana");
+    searcher.findDocument("banana");
+    auto second = searcher.findDocument("apple | banana");
+    ASSERT_EQ(first.size(), second.size());
+    for (size_t i = 0; i < first.size(); ++i) EXPECT_EQ(first[i], second[i]);
+}
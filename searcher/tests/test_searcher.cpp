@@ -1,8 +1,10 @@
 #include <gtest/gtest.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <cstdio>
 #include <memory>
+#include <random>
 #include <string>
 
 #include "indexator.h"
@@ -512,4 +514,155 @@ TEST(Integration, LargeIndex_ManyDocsAndWords_NonZipped) {
     EXPECT_EQ(res_group3.size(), ND / 5);
 
     std::remove(fname);
-}
\ No newline at end of file
+}
+TEST(SearcherTests, PrefixQueryExpandsToMatchingTerms) {
+    auto src = std::make_shared<RamIndexSource>();
+    auto tokenizer = std::make_shared<Tokenizer>();
+
+    BooleanIndexator idx(src, tokenizer);
+    idx.addDocument("http://a", "football club");
+    idx.addDocument("http://b", "footnote page");
+    idx.addDocument("http://c", "forest club");
+
+    BinarySearcher s(src, tokenizer);
+    auto res = s.findDocument("Foot*");
+    std::vector<std::pair<std::string, double>> expected = {{"http://a", 0.}, {"http://b", 0.}};
+    EXPECT_TRUE(vec_eq(res, expected));
+
+    auto with_and = s.findDocument("foot* club");
+    std::vector<std::pair<std::string, double>> expected_and = {{"http://a", 0.}};
+    EXPECT_TRUE(vec_eq(with_and, expected_and));
+
+    EXPECT_TRUE(s.findDocument("zzz*").empty());
+}
+
+TEST(SearcherTests, PrefixQueryRanksExpandedTerms) {
+    auto src = std::make_shared<RamIndexSource>();
+    auto tokenizer = std::make_shared<Tokenizer>();
+
+    TFIDFIndexator idx(src, tokenizer);
+    idx.addDocument("http://a", "football football football");
+    idx.addDocument("http://b", "footnote");
+    idx.addDocument("http://c", "other");
+    idx.addDocument("http://d", "other");
+
+    TFIDFSearcher s(src, tokenizer);
+    auto res = s.findDocument("foot*");
+    ASSERT_EQ(res.size(), 2u);
+    EXPECT_EQ(res[0].first, "http://a");
+    EXPECT_GT(res[0].second, res[1].second);
+}
+
+// Letters only, so the query tokenizer neither splits nor stems the terms
+static std::string zipf_term(uint32_t t) {
+    const std::string letters = "bcdfghjkmnpqrtvwxz";
+    return std::string("q") + letters[t / letters.size()] + letters[t % letters.size()];
+}
+
+static std::shared_ptr<RamIndexSource> make_zipf_source(uint32_t num_docs, uint32_t num_terms, uint32_t seed) {
+    auto src = std::make_shared<RamIndexSource>();
+    std::mt19937 rng(seed);
+    for (uint32_t d = 0; d < num_docs; ++d) {
+        src->addUrl("http://doc" + std::to_string(d));
+        for (uint32_t t = 0; t < num_terms; ++t) {
+            if (rng() % (t + 2) == 0) src->addDocument(zipf_term(t), d, rng() % 9 + 1);
+        }
+    }
+    return src;
+}
+
+// Top-k has to return the k best scores of the exhaustive ranking; equal scores may come in any order
+static void expect_same_top(TFIDFSearcher& s, const std::string& query, size_t k) {
+    auto all = s.findDocument(query);
+    auto top = s.findTopDocuments(query, k);
+    ASSERT_EQ(top.size(), std::min(k, all.size())) << query;
+    for (size_t i = 0; i < top.size(); ++i) EXPECT_DOUBLE_EQ(top[i].second, all[i].second) << query << " #" << i;
+    for (const auto& [url, score] : top) {
+        auto it = std::find_if(all.begin(), all.end(), [&](const auto& p) { return p.first == url; });
+        ASSERT_NE(it, all.end()) << query << " " << url;
+        EXPECT_DOUBLE_EQ(it->second, score);
+    }
+}
+
+TEST(SearcherTests, TopKMatchesExhaustiveRanking) {
+    auto src = make_zipf_source(3000, 40, 11);
+    auto tokenizer = std::make_shared<Tokenizer>();
+
+    std::string path = "/tmp/web_spider_topk_" + std::to_string(getpid()) + ".idx";
+    BinaryFormat::DumpOptions options;
+    options.format = BinaryFormat::PostingFormat::Blocked;
+    options.block_max = true;
+    src->dump(path, options);
+    auto mapped = std::make_shared<MappedIndexSource>(path);
+    ASSERT_FALSE(mapped->getBlockMaxes(zipf_term(3)).empty());
+
+    auto w = [](uint32_t t) { return zipf_term(t); };
+    const std::vector<std::string> queries = {w(1),
+                                              w(0) + " | " + w(5),
+                                              w(2) + " | " + w(9) + " | " + w(20) + " | " + w(33),
+                                              w(1) + " " + w(4),
+                                              w(3) + " & " + w(7) + " & " + w(11),
+                                              w(0) + " " + w(1),
+                                              w(6) + " | !" + w(2),
+                                              "(" + w(1) + " | " + w(2) + ") & " + w(8),
+                                              w(1) + " & !" + w(3),
+                                              w(39) + " | " + w(38) + " | " + w(0),
+                                              "qc* | " + w(1),
+                                              "missing | " + w(4)};
+    for (auto source : {std::static_pointer_cast<IIndexSource>(src), std::static_pointer_cast<IIndexSource>(mapped)}) {
+        TFIDFSearcher s(source, tokenizer);
+        for (const auto& query : queries) {
+            ASSERT_FALSE(s.findDocument(query).empty()) << query;
+            for (size_t k : {1u, 10u, 100u, 5000u}) expect_same_top(s, query, k);
+        }
+        EXPECT_TRUE(s.findTopDocuments(w(1) + " missing", 10).empty());
+        EXPECT_TRUE(s.findTopDocuments(w(1), 0).empty());
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST(SearcherTests, PagesConcatenateToTheFullRanking) {
+    auto src = make_zipf_source(2000, 20, 5);
+    auto tokenizer = std::make_shared<Tokenizer>();
+    TFIDFSearcher s(src, tokenizer);
+
+    for (const std::string& query : {zipf_term(1) + " | " + zipf_term(2), zipf_term(0) + " " + zipf_term(3),
+                                     zipf_term(2) + " & !" + zipf_term(4)}) {
+        auto all = s.findDocument(query, 1000000);
+        ASSERT_FALSE(all.empty()) << query;
+        for (size_t i = 1; i < all.size(); ++i) {
+            bool ordered =
+                all[i - 1].score > all[i].score || (all[i - 1].score == all[i].score && all[i - 1].doc_id < all[i].doc_id);
+            EXPECT_TRUE(ordered);
+        }
+
+        std::vector<SearchHit> paged;
+        for (size_t offset = 0; offset < all.size() + 7; offset += 7) {
+            auto page = s.findDocument(query, 7, offset);
+            EXPECT_LE(page.size(), 7u);
+            paged.insert(paged.end(), page.begin(), page.end());
+        }
+        ASSERT_EQ(paged.size(), all.size()) << query;
+        for (size_t i = 0; i < all.size(); ++i) {
+            EXPECT_EQ(paged[i].doc_id, all[i].doc_id) << query << " #" << i;
+            EXPECT_DOUBLE_EQ(paged[i].score, all[i].score);
+        }
+        EXPECT_EQ(s.getUrl(all[0].doc_id), "http://doc" + std::to_string(all[0].doc_id));
+        EXPECT_TRUE(s.findDocument(query, 10, all.size()).empty());
+    }
+}
+
+TEST(SearcherTests, BinarySearcherPagesInDocOrder) {
+    auto src = std::make_shared<RamIndexSource>();
+    auto tokenizer = std::make_shared<Tokenizer>();
+    BooleanIndexator idx(src, tokenizer);
+    for (int d = 0; d < 25; ++d) idx.addDocument("http://d" + std::to_string(d), d % 2 ? "apple" : "pear");
+
+    BinarySearcher s(src, tokenizer);
+    auto page = s.findDocument("apple", 5, 3);
+    ASSERT_EQ(page.size(), 5u);
+    for (size_t i = 0; i < page.size(); ++i) EXPECT_EQ(page[i].doc_id, 2 * (3 + i) + 1);
+    EXPECT_EQ(s.getUrl(page[0].doc_id), "http://d7");
+    EXPECT_EQ(s.findDocument("apple", 100, 10).size(), 2u);
+}
@@ -566,3 +566,33 @@ TEST_F(RealWorldScenariosTest, MultipleUnions) {
 
     EXPECT_EQ(abc.size(), 3);
 }
+
+TEST(DifferenceListsTest, RemovesSecondListDocs) {
+    std::vector<TermInfo> l1 = {T(1, 4), T(3), T(5, 2), T(7), T(9)};
+    std::vector<TermInfo> l2 = {T(0), T(3), T(4), T(9), T(12)};
+    auto result = difference_lists(l1, l2);
+    EXPECT_EQ(ids(result), std::vector<int>({1, 5, 7}));
+    EXPECT_EQ(result[0].tf, 4u);
+    EXPECT_EQ(result[1].tf, 2u);
+}
+
+TEST(DifferenceListsTest, EmptyOperands) {
+    auto l = make_range(0, 10);
+    EXPECT_EQ(difference_lists(l, {}).size(), 10u);
+    EXPECT_TRUE(difference_lists({}, l).empty());
+    EXPECT_TRUE(difference_lists(l, l).empty());
+}
+
+TEST(DifferenceListsTest, MatchesIntersectionWithComplement) {
+    auto l1 = make_range(0, 1000);
+    std::vector<TermInfo> l2;
+    for (int i = 0; i < 1000; i += 7) l2.push_back(T(i));
+    EXPECT_EQ(ids(difference_lists(l1, l2)), ids(intersect_lists(l1, not_list(l2, 1000))));
+}
+
+TEST_F(NotListTest, LimitStopsEarly) {
+    std::vector<TermInfo> l = {T(0), T(2), T(3)};
+    PostingCursor c(l);
+    auto result = not_list(c, 100, 4);
+    EXPECT_EQ(ids(result), std::vector<int>({1, 4, 5, 6}));
+}
@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "stream_vbyte.h"
+
+static std::vector<uint32_t> random_values(size_t count, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<uint32_t> values(count);
+    for (auto& v : values) {
+        // Mix every byte length so all control codes show up
+        int bytes = rng() % 4 + 1;
+        v = rng() & (bytes == 4 ? 0xFFFFFFFFu : ((1u << (8 * bytes)) - 1));
+    }
+    return values;
+}
+
+TEST(StreamVByteTests, RoundTripAllLengths) {
+    for (uint32_t count : {0u, 1u, 3u, 4u, 5u, 17u, 128u, 1000u}) {
+        auto values = random_values(count, count);
+        std::vector<uint8_t> encoded(count * 5 + StreamVByte::PADDING);
+        size_t size = StreamVByte::encode(values.data(), count, encoded.data());
+        EXPECT_EQ(size, StreamVByte::encodedSize(values.data(), count));
+
+        std::vector<uint32_t> decoded(count);
+        const uint8_t* end = StreamVByte::decode(encoded.data(), count, decoded.data());
+        EXPECT_EQ(end, encoded.data() + size);
+        EXPECT_EQ(decoded, values);
+
+        std::vector<uint32_t> scalar(count);
+        StreamVByte::decodeScalar(encoded.data(), count, scalar.data());
+        EXPECT_EQ(scalar, values);
+    }
+}
+
+TEST(StreamVByteTests, DeltaRoundTrip) {
+    std::mt19937 rng(7);
+    for (uint32_t count : {1u, 4u, 9u, 128u, 513u}) {
+        std::vector<uint32_t> ids(count);
+        uint32_t cur = 1000;
+        for (auto& id : ids) id = cur += rng() % 70000 + 1;
+
+        std::vector<uint8_t> encoded(count * 5 + StreamVByte::PADDING);
+        size_t size = StreamVByte::encodeDelta(ids.data(), count, 1000, encoded.data());
+        EXPECT_EQ(size, StreamVByte::encodedDeltaSize(ids.data(), count, 1000));
+
+        std::vector<uint32_t> decoded(count);
+        StreamVByte::decodeDelta(encoded.data(), count, 1000, decoded.data());
+        EXPECT_EQ(decoded, ids);
+
+        std::vector<uint32_t> scalar(count);
+        StreamVByte::decodeDeltaScalar(encoded.data(), count, 1000, scalar.data());
+        EXPECT_EQ(scalar, ids);
+    }
+}
+
+TEST(StreamVByteTests, SmallValuesUseOneBytePerValue) {
+    std::vector<uint32_t> values(8, 5);
+    std::vector<uint8_t> encoded(64);
+    EXPECT_EQ(StreamVByte::encode(values.data(), 8, encoded.data()), 2u + 8u);
+}
@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "indexator.h"
+#include "searcher.h"
+#include "term_dictionary.h"
+
+static std::vector<std::string> sample_terms() {
+    std::vector<std::string> terms = {"foot", "football", "footballer", "footnote", "for", "fork", "form",
+                                      "a", "ab", "abc", "b", "zeta", "zebra", "zero", "f", "fo"};
+    for (int i = 0; i < 100; ++i) terms.push_back("term" + std::to_string(i));
+    std::sort(terms.begin(), terms.end());
+    return terms;
+}
+
+static std::string encode_terms(const std::vector<std::string>& terms) {
+    std::vector<std::string_view> views(terms.begin(), terms.end());
+    std::vector<uint32_t> entries;
+    for (uint32_t i = 0; i < terms.size(); ++i) entries.push_back(i * 10);
+    return FrontCoding::encode(views, entries);
+}
+
+TEST(FrontCodingTests, TermAtAndEqualsRoundTrip) {
+    auto terms = sample_terms();
+    std::string section = encode_terms(terms);
+    FrontCoding::Reader reader(section.data());
+
+    ASSERT_EQ(reader.size(), terms.size());
+    for (uint32_t i = 0; i < terms.size(); ++i) {
+        EXPECT_EQ(reader.termAt(i), terms[i]);
+        EXPECT_TRUE(reader.equals(i, terms[i]));
+        EXPECT_FALSE(reader.equals(i, terms[i] + "x"));
+        if (terms[i].size() > 1) {
+            EXPECT_FALSE(reader.equals(i, terms[i].substr(0, terms[i].size() - 1)));
+        }
+    }
+    EXPECT_FALSE(reader.equals((uint32_t)terms.size(), "zeta"));
+}
+
+TEST(FrontCodingTests, PrefixRangeReturnsSortedMatches) {
+    auto terms = sample_terms();
+    std::string section = encode_terms(terms);
+    FrontCoding::Reader reader(section.data());
+
+    auto foot = reader.prefixRange("foot", 100);
+    ASSERT_EQ(foot.size(), 4u);
+    EXPECT_EQ(foot[0].first, "foot");
+    EXPECT_EQ(foot[1].first, "football");
+    EXPECT_EQ(foot[2].first, "footballer");
+    EXPECT_EQ(foot[3].first, "footnote");
+    auto pos = std::find(terms.begin(), terms.end(), "football") - terms.begin();
+    EXPECT_EQ(foot[1].second, pos * 10);
+
+    EXPECT_EQ(reader.prefixRange("term", 1000).size(), 100u);
+    EXPECT_EQ(reader.prefixRange("term", 7).size(), 7u);
+    EXPECT_EQ(reader.prefixRange("a", 100).size(), 3u);
+    EXPECT_EQ(reader.prefixRange("zz", 100).size(), 0u);
+    EXPECT_EQ(reader.prefixRange("", 1000).size(), terms.size());
+}
+
+static std::shared_ptr<RamIndexSource> make_prefix_source() {
+    auto src = std::make_shared<RamIndexSource>();
+    auto tok = std::make_shared<Tokenizer>();
+    BooleanIndexator idx(src, tok);
+    idx.addDocument("d0", "football footballer other");
+    idx.addDocument("d1", "footnote football");
+    idx.addDocument("d2", "forest footnote");
+    idx.addDocument("d3", "forest other");
+    idx.addDocument("d4", "nothing here");
+    return src;
+}
+
+static off_t file_size(const std::string& path) {
+    struct stat sb;
+    stat(path.c_str(), &sb);
+    return sb.st_size;
+}
+
+TEST(FrontCodingTests, MappedIndexWithFrontCodedTerms) {
+    auto src = make_prefix_source();
+    std::string plain = "/tmp/web_spider_plain_" + std::to_string(getpid()) + ".idx";
+    std::string coded = "/tmp/web_spider_fc_" + std::to_string(getpid()) + ".idx";
+    src->dump(plain, BinaryFormat::PostingFormat::VarInt);
+
+    for (bool mph : {false, true}) {
+        BinaryFormat::DumpOptions options;
+        options.format = BinaryFormat::PostingFormat::VarInt;
+        options.front_coded_terms = true;
+        options.perfect_hash = mph;
+        src->dump(coded, options);
+
+        MappedIndexSource mapped(coded);
+        EXPECT_TRUE(mapped.hasSortedTerms());
+        EXPECT_EQ(mapped.getPostings("football").size(), 2u);
+        EXPECT_EQ(mapped.getPostings("footnote").size(), 2u);
+        EXPECT_TRUE(mapped.getPostings("foot").empty());
+        EXPECT_TRUE(mapped.getPostings("footballs").empty());
+
+        auto expanded = mapped.expandPrefix("foot", 10);
+        std::vector<std::string> expected = {"football", "footnote"};
+        EXPECT_EQ(expanded, expected);
+    }
+    MappedIndexSource mapped_plain(plain);
+    EXPECT_EQ(mapped_plain.expandPrefix("foot", 10), (std::vector<std::string>{"football", "footnote"}));
+
+    unlink(plain.c_str());
+    unlink(coded.c_str());
+}
+
+TEST(FrontCodingTests, FrontCodingShrinksTermArea) {
+    auto src = std::make_shared<RamIndexSource>();
+    src->addUrl("a");
+    src->addUrl("b");
+    for (int i = 0; i < 2000; ++i) src->addDocument("internationalization" + std::to_string(i), 0, 2);
+
+    std::string plain = "/tmp/web_spider_plain2_" + std::to_string(getpid()) + ".idx";
+    std::string coded = "/tmp/web_spider_fc2_" + std::to_string(getpid()) + ".idx";
+    src->dump(plain, BinaryFormat::PostingFormat::VarInt);
+    BinaryFormat::DumpOptions options;
+    options.format = BinaryFormat::PostingFormat::VarInt;
+    options.front_coded_terms = true;
+    src->dump(coded, options);
+
+    EXPECT_LT(file_size(coded), file_size(plain));
+
+    unlink(plain.c_str());
+    unlink(coded.c_str());
+}